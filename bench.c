@@ -0,0 +1,957 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Micro-benchmarks of the hot-path kernels: checksums, query templates,
+ * report parsing, the membership table and the timer wheel. Inputs come
+ * from a fixed seed, results are printed as one CSV line per benchmark.
+ * Heap allocations are counted by wrapping the allocator at link time. */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/icmp6.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "igmp.h"
+#include "logging.h"
+#include "membership.h"
+#include "mld.h"
+#include "sources.h"
+#include "wheel.h"
+
+#define BENCH_SEED      0x9E3779B97F4A7C15ULL
+#define BENCH_TARGET    200             /* Milliseconds per benchmark */
+#define BENCH_MAXSRC    IGMP_V3_QUERY_MAXSRC
+#define BENCH_SPREAD    60000           /* Timer deadlines, milliseconds */
+
+typedef struct bench bench_t;
+
+typedef void (*bench_fn_t)(bench_t *b);
+
+struct bench {
+    const char *name;
+    bench_fn_t  fn;
+    size_t      arg;            /* Input size, the meaning is the benchmark's */
+    uint64_t    n;              /* Operations to run */
+
+    /* Measurement, paused around setup work */
+    int         running;
+    uint64_t    started;
+    uint64_t    elapsed;        /* Nanoseconds */
+    uint64_t    allocs_start;
+    uint64_t    allocs;
+    uint64_t    bytes_start;
+    uint64_t    bytes;
+};
+
+static uint64_t rng = BENCH_SEED;
+static uint64_t allocs;
+static uint64_t alloc_bytes;
+static volatile uint64_t sink;
+
+/* Allocator wrappers, see the bench target in the Makefile */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t align, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+    allocs++;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+    allocs++;
+    alloc_bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    allocs++;
+    alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+void *
+__wrap_aligned_alloc(size_t align, size_t size)
+{
+    allocs++;
+    alloc_bytes += size;
+    return __real_aligned_alloc(align, size);
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64*, the same sequence on every run */
+static uint32_t
+bench_random(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+
+    return (uint32_t)((rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static void
+bench_pause(bench_t *b)
+{
+    if (b->running) {
+        b->elapsed += now_ns() - b->started;
+        b->allocs += allocs - b->allocs_start;
+        b->bytes += alloc_bytes - b->bytes_start;
+        b->running = 0;
+    }
+}
+
+static void
+bench_resume(bench_t *b)
+{
+    if (!b->running) {
+        b->allocs_start = allocs;
+        b->bytes_start = alloc_bytes;
+        b->running = 1;
+        b->started = now_ns();
+    }
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p = calloc(1, size);
+
+    if (p == NULL) {
+        fprintf(stderr, "Error: Could not allocate %zu bytes: %s\n", size, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    return p;
+}
+
+/* Checksums */
+
+static void
+bench_cksum(bench_t *b)
+{
+    uint8_t buf[1500];
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = bench_random();
+    }
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        buf[0] = i;
+        sum += cksum(buf, b->arg);
+    }
+    bench_pause(b);
+    sink = sum;
+}
+
+static void
+bench_cksum_partial(bench_t *b)
+{
+    uint8_t buf[1500];
+    uint64_t i, sum = 0;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = bench_random();
+    }
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        buf[0] = i;
+        sum += cksum_finish(cksum_partial(buf, b->arg, 0));
+    }
+    bench_pause(b);
+    sink = sum;
+}
+
+static void
+bench_cksum_update(bench_t *b)
+{
+    uint32_t old = bench_random(), new;
+    uint64_t i;
+    uint16_t ck = bench_random();
+
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        new = old + i;
+        ck = cksum_update(ck, &old, &new, sizeof(new));
+    }
+    bench_pause(b);
+    sink = ck;
+}
+
+/* Query construction */
+
+static void
+default_params(igmp_params_t *params, int family, int version)
+{
+    memset(params, 0, sizeof(*params));
+    params->family = family;
+    params->version = version;
+    params->max_resp = IGMP_QUERY_RESPONSE_INTERVAL;
+    params->robustness = IGMP_ROBUSTNESS;
+    params->interval = 125;
+    params->lmqi = IGMP_LAST_MEMBER_INTERVAL;
+    params->lmqc = IGMP_ROBUSTNESS;
+}
+
+static void
+bench_igmp_build(bench_t *b)
+{
+    uint8_t buf[IGMP_V3_QUERY_MINLEN];
+    igmp_params_t params;
+    struct in_addr group;
+    uint64_t i, sum = 0;
+
+    default_params(&params, AF_INET, b->arg);
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        group.s_addr = htonl(0xEF000000 | (i & 0xFFFFFF));
+        sum += igmp_build_query(buf, &params, group);
+        sum += buf[2];
+    }
+    bench_pause(b);
+    sink = sum;
+}
+
+static void
+bench_igmp_template(bench_t *b)
+{
+    uint8_t buf[IGMP_V3_QUERY_MINLEN + BENCH_MAXSRC * 4];
+    uint8_t sources[BENCH_MAXSRC * 4];
+    igmp_template_t tpl;
+    igmp_params_t params;
+    struct in_addr group;
+    uint64_t i, sum = 0;
+    int version = (b->arg > 0 ? 3 : 2);
+
+    for (i = 0; i < sizeof(sources); i++) {
+        sources[i] = bench_random();
+    }
+    default_params(&params, AF_INET, version);
+    igmp_template_init(&tpl, &params, 1);
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        group.s_addr = htonl(0xEF000000 | (i & 0xFFFFFF));
+        sum += igmp_template_build(&tpl, buf, group, 0, sources, b->arg);
+        sum += buf[2];
+    }
+    bench_pause(b);
+    sink = sum;
+}
+
+static void
+bench_mld_template(bench_t *b)
+{
+    uint8_t buf[MLD_TEMPLATE_MAXLEN];
+    mld_template_t tpl;
+    igmp_params_t params;
+    struct in6_addr src, group;
+    uint64_t i, sum = 0;
+    uint32_t word;
+
+    default_params(&params, AF_INET6, b->arg);
+    inet_pton(AF_INET6, "fe80::1", &src);
+    inet_pton(AF_INET6, "ff05::1:0", &group);
+    mld_template_init(&tpl, &params, &src, 1);
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        word = htonl(i);
+        memcpy(&group.s6_addr[12], &word, sizeof(word));
+        sum += mld_template_build(&tpl, buf, &group);
+        sum += buf[MLD_HDRLEN + 2];
+    }
+    bench_pause(b);
+    sink = sum;
+}
+
+/* Report parsing */
+
+/* IPv4 header with Router Alert in front of an IGMP message of len bytes */
+static size_t
+build_ip(uint8_t *buf, struct in_addr dst, size_t len)
+{
+    struct ip *ip = (struct ip*)buf;
+
+    memset(buf, 0, 24);
+    ip->ip_v = 4;
+    ip->ip_hl = 6;
+    ip->ip_len = htons(24 + len);
+    ip->ip_ttl = 1;
+    ip->ip_p = IPPROTO_IGMP;
+    ip->ip_src.s_addr = htonl(0x0A000001);
+    ip->ip_dst = dst;
+    buf[20] = 0x94;
+    buf[21] = 0x04;
+    ip->ip_sum = cksum(buf, 24);
+
+    return 24;
+}
+
+/* Report of the given type, IGMPv3 ones with records of n_sources each,
+ * filling at most one Ethernet MTU */
+static size_t
+build_report(uint8_t *buf, int type, size_t n_records, size_t n_sources)
+{
+    struct in_addr dst, group;
+    uint8_t *igmp = buf + 24, *p;
+    size_t len = 8, i, j;
+    uint16_t ck;
+    uint32_t src;
+
+    group.s_addr = htonl(0xEF010101);
+    memset(igmp, 0, 1500 - 24);
+    igmp[0] = type;
+    if (type == IGMP_V3_MEMBERSHIP_REPORT) {
+        dst.s_addr = htonl(0xE0000016);
+        igmp[6] = n_records >> 8;
+        igmp[7] = n_records & 0xFF;
+        p = igmp + 8;
+        for (i = 0; i < n_records; i++) {
+            p[0] = IGMP_MODE_IS_INCLUDE;
+            p[2] = n_sources >> 8;
+            p[3] = n_sources & 0xFF;
+            group.s_addr = htonl(0xEF010000 + i);
+            memcpy(p + 4, &group, sizeof(group));
+            for (j = 0; j < n_sources; j++) {
+                src = htonl(0x0A000000 | (bench_random() & 0xFFFFFF));
+                memcpy(p + 8 + j * 4, &src, sizeof(src));
+            }
+            p += 8 + n_sources * 4;
+        }
+        len = p - igmp;
+    } else {
+        dst = group;
+        memcpy(igmp + 4, &group, sizeof(group));
+    }
+    ck = cksum(igmp, len);
+    memcpy(igmp + 2, &ck, sizeof(ck));
+
+    return build_ip(buf, dst, len);
+}
+
+static void
+bench_igmp_parse(bench_t *b)
+{
+    static const int types[] = {
+        IGMP_V1_MEMBERSHIP_REPORT, IGMP_V2_MEMBERSHIP_REPORT, IGMP_V3_MEMBERSHIP_REPORT
+    };
+    uint8_t buf[1500];
+    igmp_record_t rec;
+    igmp_msg_t msg;
+    size_t len, offset, records, sources;
+    uint64_t i, sum = 0;
+
+    /* arg packs version, records and sources per record */
+    records = (b->arg >> 8) & 0xFF;
+    sources = b->arg >> 16;
+    len = build_report(buf, types[(b->arg & 0xFF) - 1], records, sources);
+    len += ntohs(((struct ip*)buf)->ip_len) - 24;
+
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        if (igmp_parse(buf, len, &msg) != 0) {
+            break;
+        }
+        for (offset = 0; offset < msg.n_records || msg.n_records == 0; ) {
+            if (msg.n_records == 0 || igmp_next_record(&msg, &offset, &rec) != 0) {
+                break;
+            }
+            sum += rec.n_sources;
+        }
+        sum += msg.type;
+    }
+    bench_pause(b);
+    sink = sum;
+}
+
+/* MLDv2 report with one record, its checksum over the pseudo-header */
+static size_t
+build_mld_report(uint8_t *buf, size_t n_sources)
+{
+    struct ip6_hdr *ip6 = (struct ip6_hdr*)buf;
+    uint8_t *hbh = buf + sizeof(*ip6), *mld = hbh + 8, *rec = mld + 8;
+    size_t len = 8 + 20 + n_sources * 16, i;
+    uint32_t sum, word;
+    uint16_t ck;
+
+    memset(buf, 0, sizeof(*ip6) + 8 + len);
+    ip6->ip6_flow = htonl(6 << 28);
+    ip6->ip6_plen = htons(8 + len);
+    ip6->ip6_nxt = IPPROTO_HOPOPTS;
+    ip6->ip6_hlim = 1;
+    inet_pton(AF_INET6, "fe80::2", &ip6->ip6_src);
+    inet_pton(AF_INET6, "ff02::16", &ip6->ip6_dst);
+    hbh[0] = IPPROTO_ICMPV6;
+    hbh[2] = 5;
+    hbh[3] = 2;
+
+    mld[0] = MLD_V2_LISTENER_REPORT;
+    mld[7] = 1;
+    rec[0] = IGMP_MODE_IS_INCLUDE;
+    rec[2] = n_sources >> 8;
+    rec[3] = n_sources & 0xFF;
+    inet_pton(AF_INET6, "ff05::1:1", rec + 4);
+    for (i = 0; i < n_sources * 16; i++) {
+        rec[20 + i] = bench_random();
+    }
+
+    sum = cksum_partial(buf + 8, 32, 0);
+    word = htonl(len);
+    sum = cksum_partial(&word, sizeof(word), sum);
+    word = htonl(IPPROTO_ICMPV6);
+    sum = cksum_partial(&word, sizeof(word), sum);
+    ck = cksum_finish(cksum_partial(mld, len, sum));
+    memcpy(mld + 2, &ck, sizeof(ck));
+
+    return sizeof(*ip6) + 8 + len;
+}
+
+static void
+bench_mld_parse(bench_t *b)
+{
+    uint8_t buf[1500];
+    mld_record_t rec;
+    mld_msg_t msg;
+    size_t len, offset;
+    uint64_t i, sum = 0;
+
+    len = build_mld_report(buf, b->arg);
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        if (mld_parse(buf, len, &msg) != 0) {
+            break;
+        }
+        offset = 0;
+        if (mld_next_record(&msg, &offset, &rec) == 0) {
+            sum += rec.n_sources;
+        }
+    }
+    bench_pause(b);
+    sink = sum;
+}
+
+/* Source list processing of a report, as done for every IGMPv3 record */
+
+static void
+bench_sources_sort(bench_t *b)
+{
+    uint32_t addrs[SOURCES_MAX], input[SOURCES_MAX], tmp[SOURCES_MAX];
+    uint64_t i, sum = 0;
+    size_t j;
+
+    for (j = 0; j < b->arg; j++) {
+        input[j] = 0x0A000000 | (bench_random() & 0xFFFFFF);
+    }
+    for (i = 0; i < b->n; i++) {
+        memcpy(addrs, input, b->arg * sizeof(*addrs));
+        bench_resume(b);
+        sum += sources_sort(addrs, tmp, b->arg);
+        bench_pause(b);
+    }
+    sink = sum;
+}
+
+static void
+bench_sources_apply(bench_t *b)
+{
+    static source_t cur[SOURCES_MAX], out[SOURCES_MAX];
+    uint32_t report[SOURCES_MAX], tmp[SOURCES_MAX];
+    sources_times_t times;
+    size_t j, n_cur, n_report, n_out;
+    uint64_t i, sum = 0;
+    int mode, group_timer;
+
+    /* Half of the reported sources are new to the group */
+    for (j = 0; j < b->arg; j++) {
+        report[j] = 0x0A000000 | (bench_random() & 0xFFFFFF);
+    }
+    n_report = sources_sort(report, tmp, b->arg);
+    for (j = 0, n_cur = 0; j < n_report; j += 2) {
+        cur[n_cur].addr = report[j];
+        cur[n_cur].expires = 1000000;
+        cur[n_cur].retrans = 0;
+        n_cur++;
+    }
+    times.gmi = 1260000;
+    times.group = 1000000;
+    times.lmqt = 1002000;
+    times.lmqc = IGMP_ROBUSTNESS;
+
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        mode = SOURCES_INCLUDE;
+        group_timer = 0;
+        sum += sources_apply(&mode, &group_timer, IGMP_MODE_IS_INCLUDE, cur, n_cur,
+            report, n_report, &times, out, &n_out);
+        sum += n_out;
+    }
+    bench_pause(b);
+    sink = sum;
+}
+
+/* Membership table at a given number of groups */
+
+static void
+noop_cb(wheel_timer_t *timer, void *arg)
+{
+}
+
+/* Indices 0 to n - 1 in random order */
+static size_t *
+random_order(size_t n)
+{
+    size_t *order = xmalloc(n * sizeof(*order));
+    size_t i, j, t;
+
+    for (i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = bench_random() % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    return order;
+}
+
+/* Distinct multicast addresses, in random order */
+static struct in_addr *
+random_groups(size_t n)
+{
+    struct in_addr *addrs = xmalloc(n * sizeof(*addrs));
+    size_t *order = random_order(n);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        addrs[i].s_addr = htonl(0xE0000100 + order[i] * 7);
+    }
+    free(order);
+
+    return addrs;
+}
+
+static void
+table_init(membership_t *table, size_t n)
+{
+    if (membership_init(table, (n + 1024) * sizeof(group_t) * 2, noop_cb, noop_cb, noop_cb,
+            NULL) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+table_fill(membership_t *table, const struct in_addr *addrs, size_t n, group_t **groups)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        groups[i] = membership_insert(table, 1, addrs[i]);
+    }
+}
+
+static void
+table_empty(membership_t *table, group_t **groups, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (groups[i] != NULL) {
+            membership_remove(table, groups[i]);
+            groups[i] = NULL;
+        }
+    }
+}
+
+static void
+bench_membership_insert(bench_t *b)
+{
+    struct in_addr *addrs = random_groups(b->arg);
+    group_t **groups = xmalloc(b->arg * sizeof(*groups));
+    membership_t table;
+    uint64_t i;
+    size_t k = 0;
+
+    /* One untimed round first, so no page is touched for the first time */
+    table_init(&table, b->arg);
+    table_fill(&table, addrs, b->arg, groups);
+    table_empty(&table, groups, b->arg);
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        if (k == b->arg) {
+            bench_pause(b);
+            table_empty(&table, groups, k);
+            k = 0;
+            bench_resume(b);
+        }
+        groups[k] = membership_insert(&table, 1, addrs[k]);
+        k++;
+    }
+    bench_pause(b);
+
+    membership_free(&table);
+    free(groups);
+    free(addrs);
+}
+
+static void
+bench_membership_lookup(bench_t *b)
+{
+    struct in_addr *addrs = random_groups(b->arg);
+    group_t **groups = xmalloc(b->arg * sizeof(*groups));
+    membership_t table;
+    uint64_t i, sum = 0;
+    size_t k = 0;
+
+    table_init(&table, b->arg);
+    table_fill(&table, addrs, b->arg, groups);
+
+    /* Looked up in an order of their own, half of them missing */
+    for (k = 0; k < b->arg; k++) {
+        addrs[k].s_addr = htonl(ntohl(addrs[k].s_addr) + (bench_random() & 1));
+    }
+    bench_resume(b);
+    for (i = 0, k = 0; i < b->n; i++) {
+        sum += (membership_lookup(&table, 1, addrs[k]) != NULL);
+        if (++k == b->arg) {
+            k = 0;
+        }
+    }
+    bench_pause(b);
+    sink = sum;
+
+    membership_free(&table);
+    free(groups);
+    free(addrs);
+}
+
+/* Removal of expired groups, in the random order their timers fire */
+static void
+bench_membership_expire(bench_t *b)
+{
+    struct in_addr *addrs = random_groups(b->arg);
+    group_t **groups = xmalloc(b->arg * sizeof(*groups));
+    size_t *order = random_order(b->arg);
+    membership_t table;
+    uint64_t i;
+    size_t k;
+
+    table_init(&table, b->arg);
+    for (i = 0; i < b->n; i += k) {
+        table_fill(&table, addrs, b->arg, groups);
+        bench_resume(b);
+        for (k = 0; k < b->arg && i + k < b->n; k++) {
+            membership_remove(&table, groups[order[k]]);
+        }
+        bench_pause(b);
+        while (k > 0) {
+            groups[order[--k]] = NULL;
+        }
+        table_empty(&table, groups, b->arg);
+        k = b->arg;
+    }
+
+    membership_free(&table);
+    free(order);
+    free(groups);
+    free(addrs);
+}
+
+/* Timer wheel holding a given number of timers */
+
+static void
+count_cb(wheel_timer_t *timer, void *arg)
+{
+    (*(uint64_t*)arg)++;
+}
+
+static wheel_timer_t *
+timers_init(size_t n, uint64_t *fired)
+{
+    wheel_timer_t *timers = xmalloc(n * sizeof(*timers));
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        wheel_timer_init(&timers[i], count_cb, fired);
+    }
+
+    return timers;
+}
+
+static void
+bench_wheel_add(bench_t *b)
+{
+    uint64_t fired = 0, i;
+    wheel_timer_t *timers = timers_init(b->arg, &fired);
+    uint32_t *deadline = xmalloc(b->arg * sizeof(*deadline));
+    timer_wheel_t *wheel = xmalloc(sizeof(*wheel));
+    size_t k = 0;
+
+    for (k = 0; k < b->arg; k++) {
+        deadline[k] = 1 + bench_random() % BENCH_SPREAD;
+    }
+    wheel_init(wheel, 0);
+    k = 0;
+    bench_resume(b);
+    for (i = 0; i < b->n; i++) {
+        if (k == b->arg) {
+            bench_pause(b);
+            for (k = 0; k < b->arg; k++) {
+                wheel_cancel(wheel, &timers[k]);
+            }
+            k = 0;
+            bench_resume(b);
+        }
+        wheel_add(wheel, &timers[k], deadline[k]);
+        k++;
+    }
+    bench_pause(b);
+
+    free(wheel);
+    free(deadline);
+    free(timers);
+}
+
+static void
+bench_wheel_cancel(bench_t *b)
+{
+    uint64_t fired = 0, i;
+    wheel_timer_t *timers = timers_init(b->arg, &fired);
+    timer_wheel_t *wheel = xmalloc(sizeof(*wheel));
+    size_t *order = random_order(b->arg);
+    size_t k;
+
+    wheel_init(wheel, 0);
+    for (i = 0; i < b->n; i += k) {
+        for (k = 0; k < b->arg; k++) {
+            wheel_add(wheel, &timers[k], 1 + bench_random() % BENCH_SPREAD);
+        }
+        bench_resume(b);
+        for (k = 0; k < b->arg && i + k < b->n; k++) {
+            wheel_cancel(wheel, &timers[order[k]]);
+        }
+        bench_pause(b);
+    }
+
+    free(order);
+    free(wheel);
+    free(timers);
+}
+
+/* Expiry of timers spread over a minute, advancing a millisecond at a
+ * time as the engine does; one operation is one timer fired */
+static void
+bench_wheel_expire(bench_t *b)
+{
+    uint64_t fired = 0, now = 0, i;
+    wheel_timer_t *timers = timers_init(b->arg, &fired);
+    timer_wheel_t *wheel = xmalloc(sizeof(*wheel));
+    size_t k;
+
+    wheel_init(wheel, now);
+    for (i = 0; i < b->n; ) {
+        for (k = 0; k < b->arg; k++) {
+            wheel_add(wheel, &timers[k], now + 1 + bench_random() % BENCH_SPREAD);
+        }
+        fired = 0;
+        bench_resume(b);
+        while (fired < b->arg) {
+            wheel_advance(wheel, ++now);
+        }
+        bench_pause(b);
+        i += b->arg;
+    }
+    b->n = i;
+
+    free(wheel);
+    free(timers);
+}
+
+#define REPORT(version, records, sources) ((version) | ((records) << 8) | ((sources) << 16))
+
+static bench_t benches[] = {
+    { "cksum/20", bench_cksum, 20 },
+    { "cksum/64", bench_cksum, 64 },
+    { "cksum/1500", bench_cksum, 1500 },
+    { "cksum_partial/20", bench_cksum_partial, 20 },
+    { "cksum_partial/64", bench_cksum_partial, 64 },
+    { "cksum_partial/1500", bench_cksum_partial, 1500 },
+    { "cksum_update/4", bench_cksum_update, 4 },
+    { "igmp_build_query/v2", bench_igmp_build, 2 },
+    { "igmp_build_query/v3", bench_igmp_build, 3 },
+    { "igmp_template_build/v2", bench_igmp_template, 0 },
+    { "igmp_template_build/v3/1", bench_igmp_template, 1 },
+    { "igmp_template_build/v3/64", bench_igmp_template, 64 },
+    { "igmp_template_build/v3/366", bench_igmp_template, BENCH_MAXSRC },
+    { "mld_template_build/v1", bench_mld_template, 2 },
+    { "mld_template_build/v2", bench_mld_template, 3 },
+    { "igmp_parse/v1", bench_igmp_parse, REPORT(1, 0, 0) },
+    { "igmp_parse/v2", bench_igmp_parse, REPORT(2, 0, 0) },
+    { "igmp_parse/v3/1x0", bench_igmp_parse, REPORT(3, 1, 0) },
+    { "igmp_parse/v3/32x8", bench_igmp_parse, REPORT(3, 32, 8) },
+    { "igmp_parse/v3/1x366", bench_igmp_parse, REPORT(3, 1, 366) },
+    { "mld_parse/v2/1x0", bench_mld_parse, 0 },
+    { "mld_parse/v2/1x89", bench_mld_parse, 89 },
+    { "sources_sort/366", bench_sources_sort, 366 },
+    { "sources_sort/1024", bench_sources_sort, SOURCES_MAX },
+    { "sources_apply/366", bench_sources_apply, 366 },
+    { "sources_apply/1024", bench_sources_apply, SOURCES_MAX },
+    { "membership_insert/1k", bench_membership_insert, 1000 },
+    { "membership_insert/100k", bench_membership_insert, 100000 },
+    { "membership_insert/1M", bench_membership_insert, 1000000 },
+    { "membership_lookup/1k", bench_membership_lookup, 1000 },
+    { "membership_lookup/100k", bench_membership_lookup, 100000 },
+    { "membership_lookup/1M", bench_membership_lookup, 1000000 },
+    { "membership_expire/1k", bench_membership_expire, 1000 },
+    { "membership_expire/100k", bench_membership_expire, 100000 },
+    { "membership_expire/1M", bench_membership_expire, 1000000 },
+    { "wheel_add/1k", bench_wheel_add, 1000 },
+    { "wheel_add/100k", bench_wheel_add, 100000 },
+    { "wheel_add/1M", bench_wheel_add, 1000000 },
+    { "wheel_cancel/1k", bench_wheel_cancel, 1000 },
+    { "wheel_cancel/100k", bench_wheel_cancel, 100000 },
+    { "wheel_cancel/1M", bench_wheel_cancel, 1000000 },
+    { "wheel_expire/1k", bench_wheel_expire, 1000 },
+    { "wheel_expire/100k", bench_wheel_expire, 100000 },
+    { "wheel_expire/1M", bench_wheel_expire, 1000000 },
+};
+
+/* Grows the operation count until a run takes the target time, each run
+ * starting from the same seed so inputs do not depend on the count */
+static void
+run(bench_t *b, uint64_t target)
+{
+    uint64_t n = 1;
+
+    for (;;) {
+        rng = BENCH_SEED;
+        b->n = n;
+        b->running = 0;
+        b->elapsed = 0;
+        b->allocs = 0;
+        b->bytes = 0;
+        b->fn(b);
+        if (b->elapsed >= target || n >= (1ULL << 40)) {
+            break;
+        }
+        /* Aim a fifth over the target, growing at most a hundredfold */
+        if (b->elapsed == 0) {
+            n *= 100;
+        } else {
+            n = (target * 6 / 5) * b->n / b->elapsed + 1;
+            if (n > b->n * 100) {
+                n = b->n * 100;
+            }
+            if (n <= b->n) {
+                n = b->n + 1;
+            }
+        }
+    }
+
+    printf("%s,%llu,%.2f,%.3f,%.1f\n", b->name, (unsigned long long)b->n,
+        (double)b->elapsed / b->n, (double)b->allocs / b->n, (double)b->bytes / b->n);
+    fflush(stdout);
+}
+
+static void
+usage(char *command)
+{
+    printf("usage: %s [-hl] [-t MILLISECONDS] [PATTERN]...\n", command);
+}
+
+int
+main(int argc, char **argv)
+{
+    uint64_t target = BENCH_TARGET;
+    char *endptr = NULL;
+    size_t i;
+    int c, j, list = 0, match;
+
+    while ((c = getopt(argc, argv, "hlt:")) != -1) {
+        switch (c) {
+        case 'l':
+            list = 1;
+            break;
+
+        case 't':
+            target = strtoul(optarg, &endptr, 10);
+            if (*optarg == '\0' || *endptr != '\0' || target == 0) {
+                fprintf(stderr, "Error: Invalid target time '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        case 'h':
+        default:
+            usage(argv[0]);
+            exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    init_logger(0);
+
+    if (!list) {
+        printf("benchmark,ops,ns_per_op,allocs_per_op,bytes_per_op\n");
+    }
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        /* Benchmarks whose name contains any of the patterns */
+        for (j = optind, match = (optind == argc); j < argc && !match; j++) {
+            match = (strstr(benches[i].name, argv[j]) != NULL);
+        }
+        if (!match) {
+            continue;
+        }
+        if (list) {
+            printf("%s\n", benches[i].name);
+        } else {
+            run(&benches[i], target * 1000000);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
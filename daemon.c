@@ -30,9 +30,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <linux/capability.h>
 
 #include "logging.h"
 
@@ -54,8 +57,24 @@ typedef struct daemon_status {
     int            errnum;
 } daemon_status_t;
 
+/* Narrows the capabilities kept across setuid() down to CAP_NET_RAW */
+static int
+keep_net_raw(void)
+{
+    struct __user_cap_header_struct hdr;
+    struct __user_cap_data_struct data[2];
+
+    memset(&hdr, 0, sizeof(hdr));
+    memset(data, 0, sizeof(data));
+    hdr.version = _LINUX_CAPABILITY_VERSION_3;
+    data[0].effective = 1 << CAP_NET_RAW;
+    data[0].permitted = 1 << CAP_NET_RAW;
+
+    return syscall(SYS_capset, &hdr, data);
+}
+
 int
-drop_privileges(char* username, char *groupname)
+drop_privileges(char* username, char *groupname, int net_raw)
 {
     struct passwd *passwd = NULL;
     struct group *group = NULL;
@@ -93,11 +112,23 @@ drop_privileges(char* username, char *groupname)
             return -1;
         }
 
+        if (net_raw && prctl(PR_SET_KEEPCAPS, 1, 0, 0, 0) < 0) {
+            logger(LOG_LEVEL_ERR, "Could not keep capabilities: %s", strerror(errno));
+            return -1;
+        }
+
         if (setuid(passwd->pw_uid) < 0) {
             logger(LOG_LEVEL_ERR, "Could not drop privileges to user '%s' (UID %d): %s",
                 username, passwd->pw_uid, strerror(errno));
             return -1;
         }
+
+        /* Interfaces opened later still need raw sockets */
+        if (net_raw && keep_net_raw() < 0) {
+            logger(LOG_LEVEL_ERR, "Could not retain raw socket capability: %s",
+                strerror(errno));
+            return -1;
+        }
     }
 
     return 0;
@@ -26,7 +26,7 @@
 #ifndef __DAEMON_H__
 #define __DAEMON_H__
 
-int drop_privileges(char* username, char *groupname);
+int drop_privileges(char* username, char *groupname, int net_raw);
 
 int daemonize(char *pidfile);
 
@@ -0,0 +1,2562 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "handover.h"
+#include "igmp.h"
+#include "logging.h"
+#include "mld.h"
+
+/* Link-local groups (224.0.0.0/24) are never reported or tracked */
+#define IS_LOCAL_GROUP(addr) ((ntohl((addr).s_addr) & 0xFFFFFF00) == 0xE0000000)
+
+static void group_expired_cb(wheel_timer_t *timer, void *arg);
+static void lmq_timer_cb(wheel_timer_t *timer, void *arg);
+static void src_timer_cb(wheel_timer_t *timer, void *arg);
+static void pace_timer_cb(wheel_timer_t *timer, void *arg);
+static void query_timer_cb(wheel_timer_t *timer, void *arg);
+static void other_querier_timer_cb(wheel_timer_t *timer, void *arg);
+static void held_timer_cb(wheel_timer_t *timer, void *arg);
+static void set_sources(group_t *group, size_t n);
+static void socket_cb(uint32_t events, void *arg);
+static void start_querier(engine_t *engine, iface_t *iface);
+static void remove_iface(engine_t *engine, iface_t *iface);
+
+static uint64_t
+monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Shared by all engines, the simulator swaps in a virtual clock */
+static uint64_t (*clock_us)(void) = monotonic_us;
+
+void
+engine_set_clock(uint64_t (*now_us)(void))
+{
+    clock_us = now_us;
+}
+
+uint64_t
+engine_now_us(void)
+{
+    return clock_us();
+}
+
+uint64_t
+engine_now(void)
+{
+    return engine_now_us() / 1000;
+}
+
+static void
+rearm(engine_t *engine)
+{
+    struct itimerspec its;
+    uint64_t next;
+
+    next = wheel_next(&engine->wheel);
+    if (next == engine->armed) {
+        return;
+    }
+    engine->armed = next;
+
+    /* Absolute deadline on the monotonic clock, a zero value disarms */
+    memset(&its, 0, sizeof(its));
+    if (next != UINT64_MAX) {
+        its.it_value.tv_sec = next / 1000;
+        its.it_value.tv_nsec = (next % 1000) * 1000000;
+    }
+
+    if (timerfd_settime(engine->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not arm engine timer: %s", strerror(errno));
+    }
+}
+
+void
+engine_timer_add(engine_t *engine, wheel_timer_t *timer, uint64_t expires)
+{
+    wheel_add(&engine->wheel, timer, expires);
+    if (expires < engine->armed && engine->timerfd >= 0) {
+        rearm(engine);
+    }
+}
+
+void
+engine_timer_cancel(engine_t *engine, wheel_timer_t *timer)
+{
+    /* A stale deadline only costs a spurious wakeup, so no rearm here */
+    wheel_cancel(&engine->wheel, timer);
+}
+
+int
+engine_init(engine_t *engine, const igmp_params_t *params, size_t memory)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->loop.epfd = -1;
+    engine->timerfd = -1;
+    engine->stats.fd = -1;
+    engine->handover_fd = -1;
+    engine->wakefd = -1;
+    engine->mrouter_fd = -1;
+    engine->igmp_mrouter_fd = -1;
+    engine->n_shards = 1;
+    engine->main = engine;
+    engine->nl.fd = -1;
+    engine->snapshot.fd = -1;
+    engine->armed = UINT64_MAX;
+    engine->params = *params;
+    engine->rx_ops = &pktio_socket_ops;
+    wheel_init(&engine->wheel, engine_now());
+    wheel_timer_init(&engine->held_timer, held_timer_cb, engine);
+    tx_init(&engine->tx);
+
+    /* Receive buffers shared by all raw socket backends */
+    engine->rxbufs = malloc(PKTIO_BATCH * sizeof(*engine->rxbufs));
+    if (engine->rxbufs == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate receive buffers: %s", strerror(errno));
+        return -1;
+    }
+
+    /* General queries go to the all-systems group */
+    engine->dst.sin_family = AF_INET;
+    engine->dst.sin_port = htons(0);
+    engine->dst.sin_addr.s_addr = htonl(INADDR_ALLHOSTS_GROUP);
+
+    return membership_init(&engine->groups, memory,
+        group_expired_cb, lmq_timer_cb, src_timer_cb, engine);
+}
+
+int
+engine_set_backend(engine_t *engine, const char *name)
+{
+    const pktio_ops_t *ops;
+
+    ops = pktio_lookup(name);
+    if (ops == NULL) {
+        logger(LOG_LEVEL_ERR, "Unknown receive backend '%s'", name);
+        return -1;
+    }
+    engine->rx_ops = ops;
+
+    return 0;
+}
+
+void
+engine_set_fast_leave(engine_t *engine, int fast_leave)
+{
+    engine->fast_leave = fast_leave;
+}
+
+/* Runs an MLD querier next to the IGMP one on every interface */
+void
+engine_set_mld(engine_t *engine, int version)
+{
+    engine->mld = version;
+    if (version != 0 && engine->mrouter_fd < 0) {
+        engine->mrouter_fd = mld_mrouter_open();
+    }
+}
+
+/* The socket backend only sees reports to groups the host has joined,
+ * unless the stack takes us for a multicast router. Packet sockets see
+ * everything anyway. Must precede the interfaces. */
+void
+engine_set_mrouter(engine_t *engine)
+{
+    if (engine->rx_ops == &pktio_socket_ops && engine->igmp_mrouter_fd < 0) {
+        engine->igmp_mrouter_fd = igmp_mrouter_open();
+    }
+}
+
+void
+engine_set_pacing(engine_t *engine, unsigned rate, unsigned burst)
+{
+    engine->pace_rate = rate;
+    engine->pace_burst = burst;
+}
+
+void
+engine_set_adaptive(engine_t *engine, unsigned target, unsigned min, unsigned max)
+{
+    engine->mrt_target = target;
+    engine->mrt_min = min;
+    engine->mrt_max = max;
+}
+
+int
+engine_set_stats(engine_t *engine, const char *path)
+{
+    /* Handed over by the previous instance */
+    if (engine->stats.fd >= 0) {
+        return 0;
+    }
+
+    return stats_server_open(&engine->stats, path);
+}
+
+int
+engine_set_snapshot(engine_t *engine, const char *path)
+{
+    /* As many records as the membership cap has bytes for */
+    return snapshot_open(&engine->snapshot, path,
+        engine->groups.arena.size / sizeof(snapshot_record_t));
+}
+
+void
+engine_set_discovery(engine_t *engine, char **include, int n_include,
+    char **exclude, int n_exclude)
+{
+    engine->include = include;
+    engine->n_include = n_include;
+    engine->exclude = exclude;
+    engine->n_exclude = n_exclude;
+}
+
+static engine_t *
+shard_of(engine_t *engine, unsigned ifindex)
+{
+    return (engine->n_shards > 1 ? engine->shards[ifindex % engine->n_shards] : engine);
+}
+
+/* Queues a message and wakes up the receiving thread */
+static int
+shard_post(spsc_t *queue, int wakefd, const shard_msg_t *msg)
+{
+    uint64_t value = 1;
+
+    if (spsc_push(queue, msg) != 0) {
+        return -1;
+    }
+    if (write(wakefd, &value, sizeof(value)) < 0) {
+        /* Counter saturated, the receiver is awake anyway */
+    }
+
+    return 0;
+}
+
+/* Spreads interfaces over n shards, the main thread being the first.
+ * Every worker gets an engine of its own, set up like this one, so the
+ * packet path shares nothing. Must follow all other settings. */
+int
+engine_set_threads(engine_t *engine, unsigned n)
+{
+    engine_t *shard;
+    unsigned i;
+
+    if (n <= 1) {
+        return 0;
+    }
+
+    engine->shards = calloc(n, sizeof(*engine->shards));
+    if (engine->shards == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate worker threads: %s", strerror(errno));
+        return -1;
+    }
+    engine->shards[0] = engine;
+    engine->n_shards = n;
+
+    engine->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (engine->wakefd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not create worker event: %s", strerror(errno));
+        return -1;
+    }
+
+    for (i = 1; i < n; i++) {
+        shard = aligned_alloc(STATS_CACHELINE, sizeof(*shard));
+        if (shard == NULL) {
+            logger(LOG_LEVEL_ERR, "Could not allocate worker thread: %s", strerror(errno));
+            return -1;
+        }
+        engine->shards[i] = shard;
+
+        /* The memory cap was divided among the shards up front */
+        if (engine_init(shard, &engine->params, engine->groups.arena.size) != 0) {
+            return -1;
+        }
+        shard->id = i;
+        shard->main = engine;
+        shard->rx_ops = engine->rx_ops;
+        shard->fast_leave = engine->fast_leave;
+        shard->mld = engine->mld;
+        shard->pace_rate = engine->pace_rate;
+        shard->pace_burst = engine->pace_burst;
+        shard->mrt_target = engine->mrt_target;
+        shard->mrt_min = engine->mrt_min;
+        shard->mrt_max = engine->mrt_max;
+        engine_set_discovery(shard, engine->include, engine->n_include,
+            engine->exclude, engine->n_exclude);
+
+        shard->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->wakefd < 0) {
+            logger(LOG_LEVEL_ERR, "Could not create worker event: %s", strerror(errno));
+            return -1;
+        }
+        if (spsc_init(&shard->inbox, ENGINE_QUEUE, sizeof(shard_msg_t)) != 0 ||
+            spsc_init(&shard->outbox, ENGINE_QUEUE, sizeof(shard_msg_t)) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Asks every worker for its counters, returns how many will answer */
+int
+engine_request_stats(engine_t *engine, void *client)
+{
+    shard_msg_t msg;
+    unsigned i;
+    int n = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.cmd = SHARD_STATS;
+    msg.client = client;
+    for (i = 1; i < engine->n_shards; i++) {
+        if (shard_post(&engine->shards[i]->inbox, engine->shards[i]->wakefd, &msg) == 0) {
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/* Query templates of the instance's family, rebuilt as parameters change */
+static void
+init_templates(iface_t *iface)
+{
+    if (iface->params.family == AF_INET6) {
+        mld_template_init(&iface->general.mld, &iface->params, &iface->addr6, 0);
+        mld_template_init(&iface->specific.mld, &iface->params, &iface->addr6, 1);
+    } else {
+        igmp_template_init(&iface->general.igmp, &iface->params, 0);
+        igmp_template_init(&iface->specific.igmp, &iface->params, 1);
+    }
+}
+
+/* Engine side setup of an opened interface, once its parameters are set */
+static int
+attach_iface(engine_t *engine, iface_t *iface)
+{
+    iface->rx.bufs = engine->rxbufs;
+
+    if (pacer_init(&iface->pacer, engine->pace_rate, engine->pace_burst,
+            engine_now_us()) != 0) {
+        return -1;
+    }
+    wheel_timer_init(&iface->pace_timer, pace_timer_cb, iface);
+    init_templates(iface);
+
+    iface->engine = engine;
+    iface->next = engine->ifaces;
+    engine->ifaces = iface;
+
+    return 0;
+}
+
+static iface_t *
+add_iface(engine_t *engine, const char *name, int family, int version)
+{
+    iface_t *iface;
+
+    /* Aligned for the cache line sized counter block */
+    iface = aligned_alloc(STATS_CACHELINE, sizeof(*iface));
+    if (iface == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate memory for interface: %s",
+            strerror(errno));
+        return NULL;
+    }
+
+    if ((family == AF_INET6 ? iface_open6(iface, name) :
+            iface_open(iface, name, engine->rx_ops)) != 0) {
+        free(iface);
+        return NULL;
+    }
+
+    iface->params = engine->params;
+    iface->params.family = family;
+    if (version != 0) {
+        iface->params.version = version;
+    }
+    if (attach_iface(engine, iface) != 0) {
+        iface_close(iface);
+        free(iface);
+        return NULL;
+    }
+
+    if (family == AF_INET && iface->index != 0 && engine->main->igmp_mrouter_fd >= 0) {
+        iface->vif = igmp_mrouter_add(engine->main->igmp_mrouter_fd, iface->index);
+        if (iface->vif < 0) {
+            logger(LOG_LEVEL_INFO, "Could not route multicast on interface '%s', IGMPv1 and "
+                "IGMPv2 reports are only seen for groups joined locally: %s",
+                iface->name, strerror(errno));
+        }
+    }
+
+    /* Interfaces showing up at run time start out right away */
+    if (engine->running) {
+        start_querier(engine, iface);
+        if (event_add(&engine->loop, &iface->sock_ev, iface->rx.fd, EPOLLIN,
+                socket_cb, iface) != 0) {
+            iface->querier = 0;
+        }
+    }
+
+    return iface;
+}
+
+/* The IGMP instance of an interface, and its MLD one if enabled */
+static int
+add_instances(engine_t *engine, const char *name, int version, int dynamic)
+{
+    iface_t *iface;
+
+    iface = add_iface(engine, name, AF_INET, version);
+    if (iface == NULL) {
+        return -1;
+    }
+    iface->dynamic = dynamic;
+
+    if (engine->mld == 0 || name == NULL) {
+        return 0;
+    }
+    iface = add_iface(engine, name, AF_INET6, engine->mld + 1);
+    if (iface == NULL) {
+        return -1;
+    }
+    iface->dynamic = dynamic;
+
+    return 0;
+}
+
+/* Interfaces go to the shard their index points at, where the events
+ * about them are sent as well */
+int
+engine_add_iface(engine_t *engine, const char *name, int version)
+{
+    engine = shard_of(engine, (name != NULL ? if_nametoindex(name) : 0));
+
+    return add_instances(engine, name, version, 0);
+}
+
+/* Querier instance on a backend of the caller's, with no device behind it */
+int
+engine_add_virtual_iface(engine_t *engine, const char *name, unsigned index,
+    struct in_addr addr, const pktio_ops_t *ops)
+{
+    iface_t *iface;
+
+    iface = aligned_alloc(STATS_CACHELINE, sizeof(*iface));
+    if (iface == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate memory for interface: %s",
+            strerror(errno));
+        return -1;
+    }
+    if (iface_open_virtual(iface, name, index, addr, ops) != 0) {
+        free(iface);
+        return -1;
+    }
+
+    iface->params = engine->params;
+    if (attach_iface(engine, iface) != 0) {
+        iface_close(iface);
+        free(iface);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* One querier instance per VLAN, all on a single socket of the parent */
+int
+engine_add_trunk(engine_t *engine, const char *name, const uint16_t *vlans, int n_vlans)
+{
+    trunk_t *trunk;
+    iface_t *iface;
+    int i, n = 0;
+
+    /* All its VLANs live with the trunk socket */
+    engine = shard_of(engine, if_nametoindex(name));
+
+    trunk = malloc(sizeof(*trunk));
+    if (trunk == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate memory for trunk: %s", strerror(errno));
+        return -1;
+    }
+    if (trunk_open(trunk, name) != 0) {
+        free(trunk);
+        return -1;
+    }
+    trunk->engine = engine;
+    trunk->next = engine->trunks;
+    engine->trunks = trunk;
+
+    for (i = 0; i < n_vlans; i++) {
+        if (trunk->vlans[vlans[i]] != NULL) {
+            continue;
+        }
+
+        iface = aligned_alloc(STATS_CACHELINE, sizeof(*iface));
+        if (iface == NULL) {
+            logger(LOG_LEVEL_ERR, "Could not allocate memory for interface: %s",
+                strerror(errno));
+            goto fail;
+        }
+        if (trunk_add_vlan(trunk, iface, vlans[i]) != 0) {
+            free(iface);
+            goto fail;
+        }
+        iface->params = engine->params;
+        if (attach_iface(engine, iface) != 0) {
+            trunk->vlans[vlans[i]] = NULL;
+            free(iface);
+            goto fail;
+        }
+        n++;
+    }
+    logger(LOG_LEVEL_INFO, "Serving %d VLANs on trunk interface '%s'", n, name);
+
+    return 0;
+
+fail:
+    /* Nothing of the trunk stays behind, it is the newest one */
+    for (i = 0; i < TRUNK_VLANS; i++) {
+        if (trunk->vlans[i] != NULL) {
+            remove_iface(engine, trunk->vlans[i]);
+        }
+    }
+    engine->trunks = trunk->next;
+    trunk_close(trunk);
+    free(trunk);
+    return -1;
+}
+
+static int
+drop_group(group_t *group, void *arg)
+{
+    iface_t *iface = arg;
+
+    if (group->iface != iface) {
+        return 0;
+    }
+    engine_timer_cancel(iface->engine, &group->timer);
+    engine_timer_cancel(iface->engine, &group->lmq_timer);
+    engine_timer_cancel(iface->engine, &group->src_timer);
+    snapshot_drop(&iface->engine->snapshot, &group->snap);
+    set_sources(group, 0);
+    STATS_DEC(&iface->stats, groups);
+
+    return 1;
+}
+
+/* Tears down one querier instance, leaving all others untouched */
+static void
+remove_iface(engine_t *engine, iface_t *iface)
+{
+    iface_t **pp;
+
+    /* Nothing queued may point at the interface once it is gone */
+    tx_flush(&engine->tx);
+
+    engine_timer_cancel(engine, &iface->query_timer);
+    engine_timer_cancel(engine, &iface->oqp_timer);
+    engine_timer_cancel(engine, &iface->pace_timer);
+    membership_purge(&engine->groups, drop_group, iface);
+    stats_server_forget(&engine->stats, iface);
+    if (iface->vif >= 0) {
+        igmp_mrouter_del(engine->main->igmp_mrouter_fd, iface->vif);
+    }
+    if (engine->running && iface->rx.ops != NULL) {
+        event_del(&engine->loop, &iface->sock_ev);
+    }
+
+    for (pp = &engine->ifaces; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == iface) {
+            *pp = iface->next;
+            break;
+        }
+    }
+
+    iface_close(iface);
+    pacer_free(&iface->pacer);
+    free(iface);
+}
+
+static int
+discoverable(engine_t *engine, const char *name)
+{
+    int i, match = 0;
+
+    for (i = 0; i < engine->n_include && !match; i++) {
+        match = (fnmatch(engine->include[i], name, 0) == 0);
+    }
+    for (i = 0; i < engine->n_exclude && match; i++) {
+        match = (fnmatch(engine->exclude[i], name, 0) != 0);
+    }
+
+    return match;
+}
+
+/* A new primary address means new sockets, packet filter and templates
+ * and a fresh election, so the instance is rebuilt. Counters survive. */
+static void
+readdress(engine_t *engine, iface_t *iface)
+{
+    char name[IF_NAMESIZE], text[INET6_ADDRSTRLEN];
+    struct in6_addr addr6;
+    struct in_addr addr;
+    int family, version, dynamic, ret;
+    stats_t stats;
+
+    /* A failed lookup says nothing about the address, only its absence
+     * is worth the election state and memberships of a restart */
+    family = iface->params.family;
+    if (family == AF_INET6) {
+        ret = iface_link_local(iface, &addr6);
+    } else {
+        ret = iface_primary_addr(iface, &addr);
+    }
+    if (ret != 0 && errno != EADDRNOTAVAIL) {
+        logger(LOG_LEVEL_ERR, "Could not look up the address of interface '%s': %s",
+            iface->name, strerror(errno));
+        return;
+    }
+
+    if (family == AF_INET6) {
+        if (IN6_ARE_ADDR_EQUAL(&addr6, &iface->addr6)) {
+            return;
+        }
+        inet_ntop(AF_INET6, &addr6, text, sizeof(text));
+    } else {
+        if (addr.s_addr == iface->addr.s_addr) {
+            return;
+        }
+        inet_ntop(AF_INET, &addr, text, sizeof(text));
+    }
+    if (ret != 0) {
+        logger(LOG_LEVEL_INFO, "Address of interface '%s' removed, restarting querier",
+            iface->name);
+    } else {
+        logger(LOG_LEVEL_INFO, "Address of interface '%s' changed to %s, restarting querier",
+            iface->name, text);
+    }
+
+    snprintf(name, sizeof(name), "%s", iface->name);
+    version = iface->params.version;
+    dynamic = iface->dynamic;
+    stats = iface->stats;
+    remove_iface(engine, iface);
+
+    iface = add_iface(engine, name, family, version);
+    if (iface != NULL) {
+        iface->dynamic = dynamic;
+        iface->stats = stats;
+    }
+}
+
+/* Events were dropped, so compare every instance against the system */
+static void
+resync(engine_t *engine)
+{
+    iface_t *iface, *next;
+
+    logger(LOG_LEVEL_INFO, "Lost interface events, rescanning interfaces");
+    for (iface = engine->ifaces; iface != NULL; iface = next) {
+        next = iface->next;
+        if (iface->index == 0 || iface->trunk != NULL) {
+            continue;
+        }
+        if (iface->dynamic && if_nametoindex(iface->name) != iface->index) {
+            remove_iface(engine, iface);
+        } else {
+            readdress(engine, iface);
+        }
+    }
+
+    /* New interfaces turn up with the answer, workers get theirs passed on */
+    if (engine->nl.fd >= 0) {
+        netlink_dump_links(&engine->nl);
+    }
+}
+
+static void
+forward_link(engine_t *shard, netlink_event_t event, unsigned ifindex, const char *name,
+    unsigned flags)
+{
+    shard_msg_t msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.cmd = SHARD_LINK;
+    msg.event = event;
+    msg.ifindex = ifindex;
+    msg.flags = flags;
+    snprintf(msg.name, sizeof(msg.name), "%s", name != NULL ? name : "");
+    if (shard_post(&shard->inbox, shard->wakefd, &msg) != 0) {
+        logger(LOG_LEVEL_ERR, "Queue of worker %u full, interface event lost", shard->id);
+    }
+}
+
+static void
+link_cb(netlink_event_t event, unsigned ifindex, const char *name, unsigned flags, void *arg)
+{
+    engine_t *engine = arg;
+    iface_t *iface, *next;
+    unsigned i;
+    int found;
+
+    /* The listener runs on the main thread, interfaces of the workers
+     * are theirs to add and remove */
+    if (engine->n_shards > 1) {
+        if (event == NETLINK_RESYNC) {
+            for (i = 1; i < engine->n_shards; i++) {
+                forward_link(engine->shards[i], event, ifindex, name, flags);
+            }
+        } else if (shard_of(engine, ifindex) != engine) {
+            forward_link(shard_of(engine, ifindex), event, ifindex, name, flags);
+            return;
+        }
+    }
+
+    if (event == NETLINK_RESYNC) {
+        resync(engine);
+        return;
+    }
+
+    /* An interface may run an IGMP and an MLD instance */
+    switch (event) {
+    case NETLINK_LINK:
+        found = 0;
+        for (iface = engine->ifaces; iface != NULL; iface = next) {
+            next = iface->next;
+            if (iface->index != ifindex) {
+                continue;
+            }
+            /* Renamed interfaces are judged by their new name */
+            if (iface->dynamic && (!(flags & IFF_UP) || strcmp(iface->name, name) != 0)) {
+                logger(LOG_LEVEL_INFO, "Interface '%s' went away, removing querier",
+                    iface->name);
+                remove_iface(engine, iface);
+            } else {
+                found = 1;
+            }
+        }
+        if (!found && (flags & IFF_UP) && discoverable(engine, name)) {
+            logger(LOG_LEVEL_INFO, "Discovered interface '%s', starting querier", name);
+            add_instances(engine, name, 0, 1);
+        }
+        break;
+
+    case NETLINK_UNLINK:
+        for (iface = engine->ifaces; iface != NULL; iface = next) {
+            next = iface->next;
+            if (iface->index != ifindex) {
+                continue;
+            }
+            if (iface->dynamic) {
+                logger(LOG_LEVEL_INFO, "Interface '%s' removed, removing querier",
+                    iface->name);
+                remove_iface(engine, iface);
+            } else {
+                logger(LOG_LEVEL_ERR, "Interface '%s' removed, it stays configured but silent",
+                    iface->name);
+            }
+        }
+        break;
+
+    case NETLINK_ADDR:
+        for (iface = engine->ifaces; iface != NULL && ifindex != 0; iface = next) {
+            next = iface->next;
+            if (iface->index == ifindex) {
+                readdress(engine, iface);
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+netlink_cb(uint32_t events, void *arg)
+{
+    engine_t *engine = arg;
+
+    if (netlink_recv(&engine->nl, link_cb, engine) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not receive interface events: %s", strerror(errno));
+    }
+
+    tx_flush(&engine->tx);
+}
+
+static void
+handle_shard_msg(engine_t *engine, shard_msg_t *msg)
+{
+    switch (msg->cmd) {
+    case SHARD_LINK:
+        link_cb(msg->event, msg->ifindex, msg->name, msg->flags, engine);
+        break;
+
+    case SHARD_STATS:
+        if (stats_render_part(engine, &msg->buf, &msg->len) != 0) {
+            msg->buf = NULL;
+            msg->len = 0;
+        }
+        msg->mem_used = engine->groups.arena.used;
+        msg->mem_limit = engine->groups.arena.size;
+        msg->refused = engine->groups.refused;
+        /* The client waits for every part, so an answer is never
+         * dropped. A client has one request out at a time, the held
+         * answers are bounded by the number of clients. */
+        if (shard_post(&engine->outbox, engine->main->wakefd, msg) != 0) {
+            engine->held[engine->n_held++] = *msg;
+            if (!wheel_pending(&engine->held_timer)) {
+                engine_timer_add(engine, &engine->held_timer, engine_now() + ENGINE_RETRY);
+            }
+        }
+        break;
+
+    case SHARD_STOP:
+        event_loop_stop(&engine->loop);
+        break;
+    }
+}
+
+/* Posts the stats answers held back by a full outbox, as far as it has
+ * drained since */
+static void
+held_timer_cb(wheel_timer_t *timer, void *arg)
+{
+    engine_t *engine = arg;
+    int i, n = 0;
+
+    for (i = 0; i < engine->n_held; i++) {
+        if (shard_post(&engine->outbox, engine->main->wakefd, &engine->held[i]) != 0) {
+            engine->held[n++] = engine->held[i];
+        }
+    }
+    engine->n_held = n;
+    if (n > 0) {
+        engine_timer_add(engine, timer, engine_now() + ENGINE_RETRY);
+    }
+}
+
+/* Workers take orders from their inbox, the main thread collects the
+ * answers from all outboxes */
+static void
+wake_cb(uint32_t events, void *arg)
+{
+    engine_t *engine = arg;
+    shard_msg_t msg;
+    uint64_t value;
+    unsigned i;
+
+    /* Cleared before looking, a message after the look wakes us again */
+    if (read(engine->wakefd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        return;
+    }
+
+    if (engine->id != 0) {
+        while (spsc_pop(&engine->inbox, &msg)) {
+            handle_shard_msg(engine, &msg);
+        }
+    } else {
+        for (i = 1; i < engine->n_shards; i++) {
+            while (spsc_pop(&engine->shards[i]->outbox, &msg)) {
+                stats_server_collect(msg.client, msg.buf, msg.len, msg.mem_used,
+                    msg.mem_limit, msg.refused);
+            }
+        }
+    }
+
+    tx_flush(&engine->tx);
+}
+
+static void
+send_query(iface_t *iface)
+{
+    engine_t *engine = iface->engine;
+
+    /* Queued, goes out with everything else due in this tick */
+    if (iface->params.family == AF_INET6) {
+        memcpy(tx_packet6(&engine->tx, iface, iface->general.mld.len, &mld_all_nodes, 0),
+            iface->general.mld.data, iface->general.mld.len);
+    } else {
+        memcpy(tx_packet(&engine->tx, iface, iface->general.igmp.len, engine->dst.sin_addr, 0),
+            iface->general.igmp.data, iface->general.igmp.len);
+    }
+}
+
+static void
+group_address(const group_t *group, group_addr_t *addr)
+{
+    if (MEMBERSHIP_IS_V6(group->addr)) {
+        addr->v6 = group->addr6;
+    } else {
+        addr->v4 = group->addr;
+    }
+}
+
+static void
+transmit_group_query(iface_t *iface, const group_addr_t *addr, uint64_t stamp)
+{
+    engine_t *engine = iface->engine;
+    uint8_t *buf;
+
+    /* Sent to the group itself, patched from the interface template */
+    if (iface->params.family == AF_INET6) {
+        buf = tx_packet6(&engine->tx, iface, iface->specific.mld.len, &addr->v6, stamp);
+        mld_template_build(&iface->specific.mld, buf, &addr->v6);
+    } else {
+        buf = tx_packet(&engine->tx, iface, iface->specific.igmp.len, addr->v4, stamp);
+        igmp_template_build(&iface->specific.igmp, buf, addr->v4, 0, NULL, 0);
+    }
+    STATS_INC(&iface->stats, group_queries);
+}
+
+/* One round of group-and-source-specific queries for the sources still
+ * owed one, as many packets as the list needs. Returns 1 while further
+ * rounds are due. */
+static int
+transmit_source_queries(iface_t *iface, group_t *group, uint64_t stamp)
+{
+    engine_t *engine = iface->engine;
+    uint32_t addrs[IGMP_V3_QUERY_MAXSRC];
+    source_t *src;
+    size_t i, n = 0;
+    int pending = 0, sent = 0;
+    uint8_t *buf;
+
+    for (i = 0; i <= group->n_sources; i++) {
+        src = &group->sources[i];
+        if (i < group->n_sources && src->retrans > 0) {
+            addrs[n++] = htonl(src->addr);
+            pending |= (--src->retrans > 0);
+        }
+        if (n > 0 && (n == IGMP_V3_QUERY_MAXSRC || i == group->n_sources)) {
+            /* Rounds still run out after losing the election, silently */
+            if (iface->querier) {
+                buf = tx_packet(&engine->tx, iface, iface->specific.igmp.len + n * 4,
+                    group->addr, stamp);
+                igmp_template_build(&iface->specific.igmp, buf, group->addr, 0,
+                    (uint8_t*)addrs, n);
+                STATS_INC(&iface->stats, group_queries);
+                if (sent++ > 0) {
+                    pacer_charge(&iface->pacer, 1);
+                }
+            }
+            n = 0;
+        }
+    }
+
+    return pending;
+}
+
+/* Decides whether a group-specific query may go out now. Queries over
+ * budget are queued for the pace timer, at most one of each kind per
+ * group. */
+static int
+pace_query(iface_t *iface, group_t *group, uint8_t kind, uint64_t stamp)
+{
+    pacer_t *pacer = &iface->pacer;
+    pace_entry_t entry;
+    uint64_t now;
+
+    if (pacer->rate == 0) {
+        return 1;
+    }
+    if (group->paced & kind) {
+        return 0;
+    }
+
+    now = engine_now_us();
+    if (pacer->count == 0 && pacer_take(pacer, now)) {
+        return 1;
+    }
+
+    group_address(group, &entry.group);
+    entry.kind = kind;
+    entry.queued = now;
+    entry.stamp = stamp;
+    if (pacer_push(pacer, &entry) != 0) {
+        STATS_INC(&iface->stats, pace_drops);
+        return 0;
+    }
+    group->paced |= kind;
+    STATS_INC(&iface->stats, paced);
+
+    if (!wheel_pending(&iface->pace_timer)) {
+        engine_timer_add(iface->engine, &iface->pace_timer,
+            engine_now() + pacer_wait(pacer) / 1000 + 1);
+    }
+
+    return 0;
+}
+
+static void
+send_group_query(iface_t *iface, group_t *group, uint64_t stamp)
+{
+    group_addr_t addr;
+
+    if (pace_query(iface, group, PACE_GROUP, stamp)) {
+        group_address(group, &addr);
+        transmit_group_query(iface, &addr, stamp);
+    }
+}
+
+static int
+send_source_queries(iface_t *iface, group_t *group, uint64_t stamp)
+{
+    size_t i;
+
+    for (i = 0; i < group->n_sources && group->sources[i].retrans == 0; i++);
+    if (i == group->n_sources) {
+        return 0;
+    }
+
+    /* A deferred round leaves the retransmissions to the pace timer */
+    if (!pace_query(iface, group, PACE_SOURCES, stamp)) {
+        return 1;
+    }
+
+    return transmit_source_queries(iface, group, stamp);
+}
+
+/* Group Membership Interval, in milliseconds */
+static uint64_t
+membership_interval(iface_t *iface)
+{
+    return iface->params.robustness * iface->params.interval * 1000 +
+        igmp_max_resp(&iface->params) * 100;
+}
+
+static void
+set_sources(group_t *group, size_t n)
+{
+    STATS_ADD(&group->iface->stats, sources, (uint64_t)n - group->n_sources);
+    group->n_sources = n;
+}
+
+static void
+rearm_sources(engine_t *engine, group_t *group)
+{
+    uint64_t next;
+
+    next = sources_next_expiry(group->sources, group->n_sources);
+    if (next == UINT64_MAX) {
+        engine_timer_cancel(engine, &group->src_timer);
+    } else if (!wheel_pending(&group->src_timer) || group->src_timer.expires != next) {
+        engine_timer_add(engine, &group->src_timer, next);
+    }
+}
+
+/* Mirrors the group into the snapshot, if one is kept. Its records
+ * hold IPv4 groups only, MLD listeners report again on the first query. */
+static void
+save_group(engine_t *engine, group_t *group)
+{
+    if (engine->snapshot.records == NULL || MEMBERSHIP_IS_V6(group->addr)) {
+        return;
+    }
+    snapshot_save(&engine->snapshot, &group->snap, group->iface->name, group->addr,
+        group->mode, wheel_pending(&group->timer) ? group->timer.expires : 0,
+        group->sources, group->n_sources);
+}
+
+static void
+release_group(engine_t *engine, group_t *group)
+{
+    engine_timer_cancel(engine, &group->timer);
+    engine_timer_cancel(engine, &group->lmq_timer);
+    engine_timer_cancel(engine, &group->src_timer);
+    snapshot_drop(&engine->snapshot, &group->snap);
+    if (group->iface != NULL) {
+        set_sources(group, 0);
+        STATS_DEC(&group->iface->stats, groups);
+    }
+    membership_remove(&engine->groups, group);
+}
+
+static void
+group_expired_cb(wheel_timer_t *timer, void *arg)
+{
+    group_t *group = group_of_timer(timer);
+    size_t i, n = 0;
+
+    /* Members get to hear the query before their group times out */
+    if (group->paced & PACE_GROUP) {
+        engine_timer_add(arg, timer, timer->expires + igmp_lmqi(&group->iface->params) * 100);
+        return;
+    }
+
+    /* In EXCLUDE mode the group falls back to INCLUDE mode with the
+     * sources still requested, blocked ones go (RFC 3376, section 6.5) */
+    if (group->mode == SOURCES_EXCLUDE) {
+        for (i = 0; i < group->n_sources; i++) {
+            if (group->sources[i].expires != 0) {
+                group->sources[n++] = group->sources[i];
+            }
+        }
+        set_sources(group, n);
+        group->mode = SOURCES_INCLUDE;
+    }
+
+    if (group->n_sources == 0) {
+        release_group(arg, group);
+        return;
+    }
+    save_group(arg, group);
+}
+
+static void
+src_timer_cb(wheel_timer_t *timer, void *arg)
+{
+    group_t *group = group_of_src_timer(timer);
+
+    if (group->paced & PACE_SOURCES) {
+        engine_timer_add(arg, timer, timer->expires + igmp_lmqi(&group->iface->params) * 100);
+        return;
+    }
+
+    set_sources(group, sources_expire(group->sources, group->n_sources, group->mode,
+        engine_now()));
+    if (group->mode == SOURCES_INCLUDE && group->n_sources == 0) {
+        release_group(arg, group);
+        return;
+    }
+    rearm_sources(arg, group);
+    save_group(arg, group);
+}
+
+static void
+lmq_timer_cb(wheel_timer_t *timer, void *arg)
+{
+    group_t *group = group_of_lmq_timer(timer);
+    iface_t *iface = group->iface;
+    uint64_t lmqi = igmp_lmqi(&iface->params) * 100;
+    int pending = 0;
+
+    /* Rounds are spaced from when the previous one actually went out */
+    if (group->paced) {
+        engine_timer_add(arg, timer, timer->expires + lmqi);
+        return;
+    }
+
+    if (group->lmq_left > 0) {
+        if (iface->querier) {
+            send_group_query(iface, group, 0);
+        }
+        pending = (--group->lmq_left > 0);
+    }
+    pending |= send_source_queries(iface, group, 0);
+
+    if (pending) {
+        engine_timer_add(arg, timer, timer->expires + lmqi);
+    }
+}
+
+/* Sends a query the pacer held back. Timers lowered when it was due are
+ * pushed out by the delay, so members still get their Last Member Query
+ * Time to answer. */
+static void
+send_paced(iface_t *iface, const pace_entry_t *entry, uint64_t now)
+{
+    engine_t *engine = iface->engine;
+    uint64_t lmqi, deadline;
+    group_t *group;
+    size_t i;
+
+    group = (iface->params.family == AF_INET6 ?
+        membership_lookup6(&engine->groups, iface->index, &entry->group.v6) :
+        membership_lookup(&engine->groups, iface->index, entry->group.v4));
+    if (group != NULL) {
+        group->paced &= ~entry->kind;
+    }
+    if (!iface->querier) {
+        return;
+    }
+
+    lmqi = igmp_lmqi(&iface->params) * 100;
+    if (entry->kind == PACE_GROUP) {
+        /* A fast leave may have released the group already, the query
+         * is still owed to snooping switches */
+        deadline = now + (group != NULL ? group->lmq_left + 1 : 0) * lmqi;
+        if (group != NULL && wheel_pending(&group->timer) && group->timer.expires < deadline) {
+            engine_timer_add(engine, &group->timer, deadline);
+        }
+        transmit_group_query(iface, &entry->group, entry->stamp);
+    } else if (group != NULL) {
+        for (i = 0; i < group->n_sources; i++) {
+            deadline = now + group->sources[i].retrans * lmqi;
+            if (group->sources[i].retrans > 0 && group->sources[i].expires != 0 &&
+                    group->sources[i].expires < deadline) {
+                group->sources[i].expires = deadline;
+            }
+        }
+        transmit_source_queries(iface, group, entry->stamp);
+        rearm_sources(engine, group);
+    }
+    if (group != NULL) {
+        save_group(engine, group);
+    }
+}
+
+static void
+pace_timer_cb(wheel_timer_t *timer, void *arg)
+{
+    iface_t *iface = arg;
+    pacer_t *pacer = &iface->pacer;
+    pace_entry_t *entry;
+    uint64_t now;
+
+    now = engine_now_us();
+    while ((entry = pacer_peek(pacer)) != NULL && pacer_take(pacer, now)) {
+        STATS_DEC(&iface->stats, paced);
+        stats_observe(&iface->stats.pace_delay, now - entry->queued);
+        send_paced(iface, entry, now / 1000);
+        pacer_pop(pacer);
+    }
+
+    if (pacer->count > 0) {
+        engine_timer_add(iface->engine, timer, now / 1000 + pacer_wait(pacer) / 1000 + 1);
+    }
+}
+
+/* Last member of the any-source membership may have left: Leave Group
+ * message, or TO_IN record in EXCLUDE mode */
+static void
+query_group(iface_t *iface, group_t *group, struct in_addr host, uint64_t now)
+{
+    engine_t *engine = iface->engine;
+    uint64_t lmqi, lmqt;
+    int left;
+
+    /* Only the querier follows up, IGMPv1 has no group-specific queries */
+    if (!iface->querier || iface->params.version < 2 || group->lmq_left > 0) {
+        return;
+    }
+
+    if (engine->fast_leave) {
+        left = group_untrack(group, host, now / 1000, membership_interval(iface) / 1000);
+        if (left > 0) {
+            /* Other members are known to remain, nothing to ask */
+            return;
+        }
+        if (left == 0 && group->n_sources == 0) {
+            /* The last member left, one query lets snooping switches
+             * prune without waiting for the Last Member Query Time */
+            send_group_query(iface, group, engine_now_us());
+            release_group(engine, group);
+            return;
+        }
+    }
+
+    /* Last Member Query Count queries, the first one right away */
+    lmqi = igmp_lmqi(&iface->params) * 100;
+    lmqt = iface->params.lmqc * lmqi;
+    if (group->timer.expires > now + lmqt) {
+        engine_timer_add(engine, &group->timer, now + lmqt);
+    }
+    send_group_query(iface, group, engine_now_us());
+    group->lmq_left = iface->params.lmqc - 1;
+    if (group->lmq_left > 0 && !wheel_pending(&group->lmq_timer)) {
+        engine_timer_add(engine, &group->lmq_timer, now + lmqi);
+    }
+    save_group(engine, group);
+}
+
+/* Group a report is about, NULL if it is not to be tracked */
+static group_t *
+report_group(iface_t *iface, uint32_t ifindex, struct in_addr addr)
+{
+    if (!IN_MULTICAST(ntohl(addr.s_addr)) || IS_LOCAL_GROUP(addr)) {
+        return NULL;
+    }
+
+    return membership_insert(&iface->engine->groups, ifindex, addr);
+}
+
+static group_t *
+report_group6(iface_t *iface, uint32_t ifindex, const struct in6_addr *addr)
+{
+    if (!IN6_IS_ADDR_MULTICAST(addr) || MLD_IS_LOCAL_GROUP(addr)) {
+        return NULL;
+    }
+
+    return membership_insert6(&iface->engine->groups, ifindex, addr);
+}
+
+/* Applies one group record to the group state (RFC 3376, section 6.4).
+ * IGMPv1 and IGMPv2 reports come in as IS_EX({}), leaves as TO_IN({}). */
+static void
+handle_record(iface_t *iface, group_t *group, int type, const uint8_t *sources,
+    uint16_t n_sources, struct in_addr reporter, uint8_t version, uint64_t now)
+{
+    engine_t *engine = iface->engine;
+    sources_times_t times;
+    size_t i, n, n_report;
+    int mode, group_timer, was_exclude, querier, created = 0;
+    uint64_t lmqi;
+    uint32_t src;
+
+    if (group == NULL) {
+        return;
+    }
+    if (group->iface == NULL) {
+        created = 1;
+        group->iface = iface;
+        group->mode = SOURCES_INCLUDE;
+        STATS_INC(&iface->stats, groups);
+
+        /* Reports to groups the host has not joined may never have
+         * reached us, so a leave for an unknown group is taken as the
+         * last member of an any-source membership leaving.  That is
+         * only worth state when our group-specific queries will settle
+         * it, otherwise INCLUDE({}) + TO_IN({}) is no state at all */
+        if (type == IGMP_CHANGE_TO_INCLUDE_MODE && n_sources == 0) {
+            if (!iface->querier || iface->params.version < 2) {
+                release_group(engine, group);
+                return;
+            }
+            group->mode = SOURCES_EXCLUDE;
+            group->untracked = 1;
+            engine_timer_add(engine, &group->timer, now + membership_interval(iface));
+        }
+    }
+
+    /* Sorted host order copy for the merge, bounded like the state */
+    n_report = (n_sources < SOURCES_MAX ? n_sources : SOURCES_MAX);
+    for (i = 0; i < n_report; i++) {
+        memcpy(&src, sources + i * 4, sizeof(src));
+        engine->report[i] = ntohl(src);
+    }
+    n_report = sources_sort(engine->report, engine->report_tmp, n_report);
+
+    /* Source timers are only lowered by the querier, and only IGMPv3
+     * queriers can ask about sources */
+    querier = (iface->querier && iface->params.version == 3);
+    lmqi = igmp_lmqi(&iface->params) * 100;
+    times.gmi = now + membership_interval(iface);
+    times.group = (wheel_pending(&group->timer) ? group->timer.expires : now);
+    times.lmqt = (querier ? now + iface->params.lmqc * lmqi : UINT64_MAX);
+    times.lmqc = (querier ? iface->params.lmqc : 0);
+
+    mode = group->mode;
+    was_exclude = (mode == SOURCES_EXCLUDE);
+    sources_apply(&mode, &group_timer, type, group->sources, group->n_sources,
+        engine->report, n_report, &times, engine->scratch, &n);
+    if (membership_set_sources(&engine->groups, group, engine->scratch, n) != 0) {
+        /* Refused under the memory cap, state nothing would expire goes */
+        if (created || (!wheel_pending(&group->timer) && group->n_sources == 0)) {
+            release_group(engine, group);
+        }
+        return;
+    }
+    set_sources(group, n);
+    group->mode = mode;
+
+    if (type != IGMP_CHANGE_TO_INCLUDE_MODE && type != IGMP_BLOCK_OLD_SOURCES) {
+        group->reporter = reporter;
+        group->version = version;
+        if (engine->fast_leave) {
+            group_track(group, reporter, now / 1000, membership_interval(iface) / 1000);
+        }
+    }
+
+    /* An any-source report answers pending group-specific queries */
+    if (group_timer) {
+        engine_timer_add(engine, &group->timer, times.gmi);
+        group->lmq_left = 0;
+    }
+
+    if (querier && send_source_queries(iface, group, engine_now_us()) &&
+        !wheel_pending(&group->lmq_timer)) {
+        engine_timer_add(engine, &group->lmq_timer, now + lmqi);
+    }
+    rearm_sources(engine, group);
+    save_group(engine, group);
+
+    if (was_exclude && type == IGMP_CHANGE_TO_INCLUDE_MODE) {
+        query_group(iface, group, reporter, now);
+    } else if (group->mode == SOURCES_INCLUDE && group->n_sources == 0) {
+        /* INCLUDE({}) is no state at all */
+        release_group(engine, group);
+    }
+}
+
+static void
+handle_v3_report(iface_t *iface, uint32_t ifindex, igmp_msg_t *msg, uint64_t now)
+{
+    igmp_record_t rec;
+    size_t offset = 0;
+    int i;
+
+    for (i = 0; i < msg->n_records; i++) {
+        if (igmp_next_record(msg, &offset, &rec) != 0) {
+            return;
+        }
+        STATS_INC(&iface->stats, reports[2]);
+        if (rec.type == IGMP_CHANGE_TO_INCLUDE_MODE && rec.n_sources == 0) {
+            STATS_INC(&iface->stats, leaves);
+        }
+
+        handle_record(iface, report_group(iface, ifindex, rec.group), rec.type,
+            rec.sources, rec.n_sources, msg->src, 3, now);
+    }
+}
+
+/* A querier with a lower address is present, stay silent while it is */
+static void
+other_querier(iface_t *iface, const char *addr, int changed, uint64_t now)
+{
+    unsigned timeout;
+
+    if (iface->querier || changed) {
+        logger(LOG_LEVEL_INFO, "Other querier %s present on interface '%s', suspending queries",
+            addr, iface->name);
+    }
+    iface->querier = 0;
+
+    /* Other Querier Present Interval, in milliseconds */
+    timeout = iface->params.robustness * iface->params.interval * 1000 +
+        igmp_max_resp(&iface->params) * 50;
+
+    engine_timer_add(iface->engine, &iface->oqp_timer, now + timeout);
+}
+
+/* Group-specific query from the querier: the group goes away after
+ * Last Member Query Count times its Max Response Time */
+static void
+lower_group_timer(iface_t *iface, group_t *group, unsigned max_resp, uint64_t now)
+{
+    unsigned timeout = iface->params.lmqc * max_resp;
+
+    if (group != NULL && timeout > 0 && group->timer.expires > now + timeout) {
+        engine_timer_add(iface->engine, &group->timer, now + timeout);
+        save_group(iface->engine, group);
+    }
+}
+
+static void
+handle_query(iface_t *iface, uint32_t ifindex, igmp_msg_t *msg, uint64_t now)
+{
+    group_t *group;
+    int changed;
+
+    /* Own queries looped back, queries from address-less proxies and
+     * interfaces without an address of their own take no part */
+    if (iface->addr.s_addr == INADDR_ANY || msg->src.s_addr == INADDR_ANY ||
+        msg->src.s_addr == iface->addr.s_addr) {
+        return;
+    }
+
+    /* The querier with the lowest IP address wins */
+    if (ntohl(msg->src.s_addr) > ntohl(iface->addr.s_addr)) {
+        return;
+    }
+
+    changed = (iface->querier_addr.s_addr != msg->src.s_addr);
+    iface->querier_addr = msg->src;
+    other_querier(iface, inet_ntoa(msg->src), changed, now);
+
+    /* Unless the querier asked routers to suppress timer updates (S flag) */
+    if (msg->group.s_addr == INADDR_ANY ||
+        (msg->len >= IGMP_V3_QUERY_MINLEN && (msg->data[8] & 0x08))) {
+        return;
+    }
+    group = membership_lookup(&iface->engine->groups, ifindex, msg->group);
+    lower_group_timer(iface, group, (msg->len >= IGMP_V3_QUERY_MINLEN ?
+        igmp_decode_code(msg->code) : msg->code) * 100, now);
+}
+
+static void
+handle_query6(iface_t *iface, uint32_t ifindex, mld_msg_t *msg, uint64_t now)
+{
+    char text[INET6_ADDRSTRLEN];
+    group_t *group;
+    int changed;
+
+    if (IN6_IS_ADDR_UNSPECIFIED(&iface->addr6) ||
+        IN6_ARE_ADDR_EQUAL(&msg->src, &iface->addr6)) {
+        return;
+    }
+
+    /* The querier with the lowest IPv6 address wins (RFC 3810, section 7.6.2) */
+    if (memcmp(&msg->src, &iface->addr6, sizeof(msg->src)) > 0) {
+        return;
+    }
+
+    changed = !IN6_ARE_ADDR_EQUAL(&iface->querier_addr6, &msg->src);
+    iface->querier_addr6 = msg->src;
+    other_querier(iface, inet_ntop(AF_INET6, &msg->src, text, sizeof(text)), changed, now);
+
+    if (IN6_IS_ADDR_UNSPECIFIED(&msg->group) || msg->suppress) {
+        return;
+    }
+    group = membership_lookup6(&iface->engine->groups, ifindex, &msg->group);
+    lower_group_timer(iface, group, msg->max_resp, now);
+}
+
+static void
+other_querier_timer_cb(wheel_timer_t *timer, void *arg)
+{
+    iface_t *iface = arg;
+    char text[INET6_ADDRSTRLEN];
+
+    if (iface->params.family == AF_INET6) {
+        inet_ntop(AF_INET6, &iface->querier_addr6, text, sizeof(text));
+    } else {
+        inet_ntop(AF_INET, &iface->querier_addr, text, sizeof(text));
+    }
+    logger(LOG_LEVEL_INFO, "Other querier %s on interface '%s' timed out, resuming queries",
+        text, iface->name);
+    iface->querier = 1;
+    iface->querier_addr = iface->addr;
+    iface->querier_addr6 = iface->addr6;
+
+    /* Query right away, the schedule continues from there */
+    engine_timer_add(iface->engine, &iface->query_timer, engine_now());
+}
+
+static void
+handle_message(iface_t *iface, uint32_t ifindex, igmp_msg_t *msg, uint64_t now)
+{
+    switch (msg->type) {
+    case IGMP_MEMBERSHIP_QUERY:
+        handle_query(iface, ifindex, msg, now);
+        break;
+
+    case IGMP_V1_MEMBERSHIP_REPORT:
+        STATS_INC(&iface->stats, reports[0]);
+        handle_record(iface, report_group(iface, ifindex, msg->group),
+            IGMP_MODE_IS_EXCLUDE, NULL, 0, msg->src, 1, now);
+        break;
+
+    case IGMP_V2_MEMBERSHIP_REPORT:
+        STATS_INC(&iface->stats, reports[1]);
+        handle_record(iface, report_group(iface, ifindex, msg->group),
+            IGMP_MODE_IS_EXCLUDE, NULL, 0, msg->src, 2, now);
+        break;
+
+    case IGMP_V3_MEMBERSHIP_REPORT:
+        handle_v3_report(iface, ifindex, msg, now);
+        break;
+
+    case IGMP_V2_LEAVE_GROUP:
+        STATS_INC(&iface->stats, leaves);
+        handle_record(iface, report_group(iface, ifindex, msg->group),
+            IGMP_CHANGE_TO_INCLUDE_MODE, NULL, 0, msg->src, 2, now);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Source lists of IPv6 groups are not kept, records apply at group
+ * level much as in MLDv1 compatibility mode (RFC 3810, section 8.3.2):
+ * any listener keeps the group, only TO_IN({}) asks whether one is left */
+static void
+handle_mld_v2_report(iface_t *iface, uint32_t ifindex, mld_msg_t *msg,
+    struct in_addr reporter, uint64_t now)
+{
+    mld_record_t rec;
+    size_t offset = 0;
+    int i, type;
+
+    for (i = 0; i < msg->n_records; i++) {
+        if (mld_next_record(msg, &offset, &rec) != 0) {
+            return;
+        }
+        STATS_INC(&iface->stats, reports[2]);
+
+        type = rec.type;
+        if (type == IGMP_BLOCK_OLD_SOURCES) {
+            continue;
+        }
+        if (rec.n_sources > 0 && (type == IGMP_MODE_IS_INCLUDE ||
+                type == IGMP_ALLOW_NEW_SOURCES || type == IGMP_CHANGE_TO_INCLUDE_MODE)) {
+            type = IGMP_MODE_IS_EXCLUDE;
+        } else if (type == IGMP_CHANGE_TO_INCLUDE_MODE) {
+            STATS_INC(&iface->stats, leaves);
+        }
+
+        handle_record(iface, report_group6(iface, ifindex, &rec.group), type,
+            NULL, 0, reporter, 3, now);
+    }
+}
+
+/* MLDv1 and MLDv2 messages map onto their IGMPv2 and IGMPv3 equivalents */
+static void
+handle_mld_message(iface_t *iface, uint32_t ifindex, mld_msg_t *msg, uint64_t now)
+{
+    struct in_addr reporter;
+
+    /* Hosts are tracked for fast leave by a fold of their address */
+    reporter = membership_fold6(&msg->src);
+
+    switch (msg->type) {
+    case MLD_LISTENER_QUERY:
+        handle_query6(iface, ifindex, msg, now);
+        break;
+
+    case MLD_LISTENER_REPORT:
+        STATS_INC(&iface->stats, reports[1]);
+        handle_record(iface, report_group6(iface, ifindex, &msg->group),
+            IGMP_MODE_IS_EXCLUDE, NULL, 0, reporter, 2, now);
+        break;
+
+    case MLD_V2_LISTENER_REPORT:
+        handle_mld_v2_report(iface, ifindex, msg, reporter, now);
+        break;
+
+    case MLD_LISTENER_REDUCTION:
+        STATS_INC(&iface->stats, leaves);
+        handle_record(iface, report_group6(iface, ifindex, &msg->group),
+            IGMP_CHANGE_TO_INCLUDE_MODE, NULL, 0, reporter, 2, now);
+        break;
+
+    default:
+        break;
+    }
+}
+
+typedef struct rx_ctx {
+    iface_t  *iface;
+    uint64_t  now;
+} rx_ctx_t;
+
+static void
+rx_cb(const uint8_t *pkt, size_t len, uint32_t ifindex, uint16_t vlan, void *arg)
+{
+    rx_ctx_t *ctx = arg;
+    igmp_msg_t msg;
+    mld_msg_t msg6;
+
+    if (ifindex == 0) {
+        ifindex = ctx->iface->index;
+    }
+    if (ctx->iface->params.family == AF_INET6) {
+        if (mld_parse(pkt, len, &msg6) == 0) {
+            handle_mld_message(ctx->iface, ifindex, &msg6, ctx->now);
+        }
+        return;
+    }
+
+    if (igmp_parse(pkt, len, &msg) != 0) {
+        return;
+    }
+    handle_message(ctx->iface, ifindex, &msg, ctx->now);
+}
+
+static void
+socket_cb(uint32_t events, void *arg)
+{
+    iface_t *iface = arg;
+    engine_t *engine = iface->engine;
+    rx_ctx_t ctx;
+
+    ctx.iface = iface;
+    ctx.now = engine_now();
+
+    /* One batch per wakeup so one busy interface cannot starve the
+     * others, the level triggered loop comes back for the rest */
+    if (iface->rx.ops->recv(&iface->rx, rx_cb, &ctx) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not receive on interface '%s': %s",
+            iface->name, strerror(errno));
+    }
+
+    tx_flush(&engine->tx);
+}
+
+typedef struct trunk_ctx {
+    trunk_t  *trunk;
+    uint64_t  now;
+} trunk_ctx_t;
+
+static void
+trunk_rx_cb(const uint8_t *pkt, size_t len, uint32_t ifindex, uint16_t vlan, void *arg)
+{
+    trunk_ctx_t *ctx = arg;
+    igmp_msg_t msg;
+    iface_t *iface;
+
+    /* VLANs not served are dropped here rather than in the filter */
+    iface = ctx->trunk->vlans[vlan];
+    if (iface == NULL || igmp_parse(pkt, len, &msg) != 0) {
+        return;
+    }
+    handle_message(iface, iface->index, &msg, ctx->now);
+}
+
+static void
+trunk_cb(uint32_t events, void *arg)
+{
+    trunk_t *trunk = arg;
+    engine_t *engine = trunk->engine;
+    trunk_ctx_t ctx;
+
+    ctx.trunk = trunk;
+    ctx.now = engine_now();
+
+    if (pktio_ring_ops.recv(&trunk->io, trunk_rx_cb, &ctx) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not receive on trunk interface '%s': %s",
+            trunk->name, strerror(errno));
+    }
+
+    tx_flush(&engine->tx);
+}
+
+static void
+timer_cb(uint32_t events, void *arg)
+{
+    engine_t *engine = arg;
+    uint64_t expirations;
+
+    if (read(engine->timerfd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    /* Timers added from callbacks are picked up by the single rearm below,
+     * the one-shot descriptor itself is disarmed by now */
+    engine->armed = 0;
+    wheel_advance(&engine->wheel, engine_now());
+    engine->armed = UINT64_MAX;
+    rearm(engine);
+
+    tx_flush(&engine->tx);
+}
+
+/* Hosts spread their answers over the Max Response Time, so the reports
+ * of the last cycle divided by the target rate give the window needed
+ * to stay under it. Widening takes effect at once, narrowing goes a
+ * quarter of the way per cycle so one quiet cycle does not undo it. */
+static void
+adapt_max_resp(iface_t *iface)
+{
+    engine_t *engine = iface->engine;
+    uint64_t reports, want;
+    unsigned cur, max;
+    int i;
+
+    for (reports = 0, i = 0; i < 3; i++) {
+        reports += STATS_GET(&iface->stats, reports[i]);
+    }
+    want = (reports - iface->reports_seen) * 10;
+    iface->reports_seen = reports;
+
+    /* IGMPv1 has a fixed Max Response Time */
+    if (engine->mrt_target == 0 || !iface->querier || iface->params.version < 2) {
+        return;
+    }
+
+    want = (want + engine->mrt_target - 1) / engine->mrt_target;
+    max = engine->mrt_max;
+    if (max >= iface->params.interval * 10) {
+        max = iface->params.interval * 10 - 1;
+    }
+    if (iface->params.version == 2 && iface->params.family == AF_INET6) {
+        if (max > MLD_V1_MAX_RESP) {
+            max = MLD_V1_MAX_RESP;
+        }
+    } else if (iface->params.version == 2 && max > 255) {
+        max = 255;
+    }
+    cur = iface->params.max_resp;
+    if (want < cur) {
+        want = cur - (cur - want + 3) / 4;
+    }
+    if (want < engine->mrt_min) {
+        want = engine->mrt_min;
+    }
+    if (want > max) {
+        want = max;
+    }
+    if (want == cur) {
+        return;
+    }
+
+    iface->params.max_resp = want;
+    init_templates(iface);
+    logger(LOG_LEVEL_INFO, "Max response time on interface '%s' now %u.%u seconds",
+        iface->name, igmp_max_resp(&iface->params) / 10, igmp_max_resp(&iface->params) % 10);
+}
+
+static void
+query_timer_cb(wheel_timer_t *timer, void *arg)
+{
+    iface_t *iface = arg;
+    uint64_t next, now, period;
+
+    adapt_max_resp(iface);
+
+    /* Stay silent while another querier is present */
+    if (!iface->querier) {
+        return;
+    }
+
+    /* How far behind its deadline this query is served */
+    now = engine_now_us();
+    stats_observe(&iface->stats.lateness, now > timer->expires * 1000 ?
+        now - timer->expires * 1000 : 0);
+
+    send_query(iface);
+
+    /* Startup Query Interval is a quarter of the Query Interval */
+    period = iface->params.interval * 1000;
+    if (iface->startup_left > 0 && --iface->startup_left > 0) {
+        period /= 4;
+    }
+
+    /* Next deadline follows from the previous one, not from when this
+     * one was served, so the schedule does not drift. Queries missed
+     * while suspended are not made up for. */
+    now = engine_now();
+    next = timer->expires + period;
+    if (next <= now) {
+        next = now + period;
+    }
+    engine_timer_add(iface->engine, timer, next);
+}
+
+static int
+resave_group(group_t *group, void *arg)
+{
+    iface_t *iface = arg;
+
+    if (group->iface == iface) {
+        save_group(iface->engine, group);
+    }
+
+    return 0;
+}
+
+/* Takes over a group saved by the previous instance. Sources and timers
+ * that ran out in between expire on the first tick. */
+static int
+restore_cb(const snapshot_entry_t *entry, void *arg)
+{
+    iface_t *iface = arg;
+    engine_t *engine = iface->engine;
+    uint64_t now = engine_now();
+    group_t *group;
+    size_t n;
+
+    group = membership_insert(&engine->groups, iface->index, entry->addr);
+    if (group == NULL || group->iface != NULL) {
+        return -1;
+    }
+    group->iface = iface;
+    group->mode = entry->mode;
+    STATS_INC(&iface->stats, groups);
+
+    n = entry->n_sources;
+    memcpy(engine->scratch, entry->sources, n * sizeof(source_t));
+    n = sources_expire(engine->scratch, n, group->mode, now);
+    if (membership_set_sources(&engine->groups, group, engine->scratch, n) != 0) {
+        release_group(engine, group);
+        return -1;
+    }
+    set_sources(group, n);
+    group->snap = entry->index;
+
+    if (entry->expires != 0) {
+        engine_timer_add(engine, &group->timer, entry->expires > now ? entry->expires : now);
+    }
+    rearm_sources(engine, group);
+
+    return 0;
+}
+
+static void
+start_querier(engine_t *engine, iface_t *iface)
+{
+    uint64_t phase = 0;
+    size_t n;
+
+    /* Saved state is only trusted until the startup queries confirm it */
+    if (engine->snapshot.records != NULL && iface->params.family == AF_INET) {
+        n = snapshot_restore(&engine->snapshot, iface->name, engine_now(), restore_cb, iface);
+        if (n > 0) {
+            logger(LOG_LEVEL_INFO, "Restored %zu groups on interface '%s'", n, iface->name);
+        }
+    }
+
+    /* A handed over querier carries on with its own schedule */
+    if (iface->adopted) {
+        if (engine->snapshot.records != NULL) {
+            membership_purge(&engine->groups, resave_group, iface);
+        }
+        return;
+    }
+
+    wheel_timer_init(&iface->query_timer, query_timer_cb, iface);
+    wheel_timer_init(&iface->oqp_timer, other_querier_timer_cb, iface);
+
+    /* Every querier starts out as the querier (RFC 2236, section 3) and
+     * sends Startup Query Count queries to populate snooping tables */
+    iface->querier = 1;
+    iface->querier_addr = iface->addr;
+    iface->querier_addr6 = iface->addr6;
+    iface->startup_left = iface->params.robustness;
+
+    /* Spread interfaces so their queries do not all go out at once */
+    if (iface->params.jitter > 0) {
+        phase = random() % iface->params.jitter;
+    }
+    engine_timer_add(engine, &iface->query_timer, engine_now() + phase);
+}
+
+/* Hot upgrade. The running instance passes its sockets and state to a
+ * new one connecting on the handover socket, and steps down once the
+ * new one has acknowledged everything. */
+
+typedef struct handover_ctx {
+    handover_buf_t *buf;
+    int             failed;
+} handover_ctx_t;
+
+static int
+send_group(group_t *group, void *arg)
+{
+    handover_ctx_t *ctx = arg;
+    handover_group_t rec;
+    size_t len = group->n_sources * sizeof(source_t);
+
+    if (group->iface == NULL || ctx->failed) {
+        return 0;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    snprintf(rec.ifname, sizeof(rec.ifname), "%s", group->iface->name);
+    rec.ifindex = group->ifindex;
+    rec.addr = group->addr;
+    rec.reporter = group->reporter;
+    rec.version = group->version;
+    rec.mode = group->mode;
+    rec.lmq_left = group->lmq_left;
+    rec.n_hosts = group->n_hosts;
+    rec.untracked = group->untracked;
+    rec.n_sources = group->n_sources;
+    memcpy(rec.hosts, group->hosts, sizeof(rec.hosts));
+    memcpy(rec.host_seen, group->host_seen, sizeof(rec.host_seen));
+    rec.expires = (wheel_pending(&group->timer) ? group->timer.expires : 0);
+    rec.lmq_expires = (wheel_pending(&group->lmq_timer) ? group->lmq_timer.expires : 0);
+
+    if (handover_reserve(ctx->buf, sizeof(rec) + len) != 0 ||
+        handover_put(ctx->buf, &rec, sizeof(rec)) != 0 ||
+        handover_put(ctx->buf, group->sources, len) != 0) {
+        ctx->failed = 1;
+    }
+
+    return 0;
+}
+
+static int
+hand_over(engine_t *engine, int fd)
+{
+    handover_hello_t hello;
+    handover_iface_t rec;
+    handover_ctx_t ctx;
+    iface_t *iface;
+    int fds[HANDOVER_MAXFDS], n_fds;
+
+    if (engine->trunks != NULL) {
+        logger(LOG_LEVEL_ERR, "Trunk interfaces cannot be handed over");
+        return -1;
+    }
+
+    /* Whatever is queued goes out before the sockets change hands */
+    tx_flush(&engine->tx);
+
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = HANDOVER_MAGIC;
+    hello.version = HANDOVER_VERSION;
+    hello.iface_size = sizeof(handover_iface_t);
+    hello.group_size = sizeof(handover_group_t);
+    hello.has_stats = (engine->stats.fd >= 0);
+    hello.has_mrouter = (engine->igmp_mrouter_fd >= 0);
+    n_fds = 0;
+    fds[n_fds++] = engine->handover_fd;
+    if (hello.has_stats) {
+        fds[n_fds++] = engine->stats.fd;
+    }
+    /* Routing interfaces go away with the last descriptor of the socket */
+    if (hello.has_mrouter) {
+        fds[n_fds++] = engine->igmp_mrouter_fd;
+    }
+    if (handover_send(fd, HANDOVER_HELLO, &hello, sizeof(hello), fds, n_fds) != 0) {
+        return -1;
+    }
+
+    for (iface = engine->ifaces; iface != NULL; iface = iface->next) {
+        memset(&rec, 0, sizeof(rec));
+        snprintf(rec.name, sizeof(rec.name), "%s", iface->name);
+        snprintf(rec.backend, sizeof(rec.backend), "%s", iface->rx.ops->name);
+        rec.params = iface->params;
+        rec.ring_block = iface->rx.block;
+        rec.querier = iface->querier;
+        rec.querier_addr = iface->querier_addr;
+        rec.startup_left = iface->startup_left;
+        rec.dynamic = iface->dynamic;
+        rec.vif = iface->vif;
+        rec.query_expires = (wheel_pending(&iface->query_timer) ? iface->query_timer.expires : 0);
+        rec.oqp_expires = (wheel_pending(&iface->oqp_timer) ? iface->oqp_timer.expires : 0);
+        fds[0] = iface->sockfd;
+        fds[1] = iface->rx.fd;
+        n_fds = (iface->rx.fd != iface->sockfd ? 2 : 1);
+        if (handover_send(fd, HANDOVER_IFACE, &rec, sizeof(rec), fds, n_fds) != 0) {
+            return -1;
+        }
+    }
+
+    ctx.buf = malloc(sizeof(*ctx.buf));
+    if (ctx.buf == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate handover buffer: %s", strerror(errno));
+        return -1;
+    }
+    ctx.buf->fd = fd;
+    ctx.buf->type = HANDOVER_GROUPS;
+    ctx.buf->len = 0;
+    ctx.failed = 0;
+    membership_purge(&engine->groups, send_group, &ctx);
+    if (ctx.failed || handover_flush(ctx.buf) != 0 ||
+        handover_send(fd, HANDOVER_END, NULL, 0, NULL, 0) != 0 ||
+        handover_recv(ctx.buf, fds, &n_fds) != 0 || ctx.buf->type != HANDOVER_ACK) {
+        free(ctx.buf);
+        return -1;
+    }
+    free(ctx.buf);
+
+    return 0;
+}
+
+static void
+handover_cb(uint32_t events, void *arg)
+{
+    engine_t *engine = arg;
+    iface_t *iface;
+    int fd;
+
+    fd = handover_accept(engine->handover_fd);
+    if (fd < 0) {
+        return;
+    }
+
+    if (hand_over(engine, fd) != 0) {
+        logger(LOG_LEVEL_ERR, "Handover failed, carrying on");
+        close(fd);
+        return;
+    }
+    close(fd);
+    logger(LOG_LEVEL_INFO, "Handed over to the new process, exiting");
+
+    /* Nothing more may be read or sent, not even from this batch */
+    for (iface = engine->ifaces; iface != NULL; iface = iface->next) {
+        event_del(&engine->loop, &iface->sock_ev);
+    }
+    event_del(&engine->loop, &engine->timer_ev);
+    event_del(&engine->loop, &engine->handover_ev);
+    stats_server_close(&engine->stats);
+    event_loop_stop(&engine->loop);
+}
+
+static iface_t *
+adopt_iface(engine_t *engine, const handover_iface_t *rec, const int *fds, int n_fds)
+{
+    const pktio_ops_t *ops;
+    iface_t *iface;
+
+    ops = pktio_lookup(rec->backend);
+    if (ops == NULL || memchr(rec->name, '\0', sizeof(rec->name)) == NULL ||
+        (ops != &pktio_socket_ops && n_fds < 2)) {
+        logger(LOG_LEVEL_ERR, "Malformed interface in handover");
+        return NULL;
+    }
+
+    iface = aligned_alloc(STATS_CACHELINE, sizeof(*iface));
+    if (iface == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate memory for interface: %s",
+            strerror(errno));
+        return NULL;
+    }
+    if (iface_adopt(iface, rec->name, fds[0], ops, n_fds > 1 ? fds[1] : -1,
+            rec->ring_block) != 0) {
+        free(iface);
+        return NULL;
+    }
+
+    iface->params = rec->params;
+    if (attach_iface(engine, iface) != 0) {
+        iface_close(iface);
+        free(iface);
+        return NULL;
+    }
+
+    iface->adopted = 1;
+    iface->dynamic = rec->dynamic;
+    iface->vif = rec->vif;
+    iface->querier = rec->querier;
+    iface->querier_addr = rec->querier_addr;
+    iface->startup_left = rec->startup_left;
+    wheel_timer_init(&iface->query_timer, query_timer_cb, iface);
+    wheel_timer_init(&iface->oqp_timer, other_querier_timer_cb, iface);
+    if (rec->query_expires != 0) {
+        engine_timer_add(engine, &iface->query_timer, rec->query_expires);
+    }
+    if (rec->oqp_expires != 0) {
+        engine_timer_add(engine, &iface->oqp_timer, rec->oqp_expires);
+    }
+
+    return iface;
+}
+
+static int
+adopt_group(engine_t *engine, const handover_group_t *rec, const source_t *sources)
+{
+    iface_t *iface;
+    group_t *group;
+
+    for (iface = engine->ifaces; iface != NULL; iface = iface->next) {
+        if (strncmp(iface->name, rec->ifname, sizeof(rec->ifname)) == 0) {
+            break;
+        }
+    }
+    if (iface == NULL || rec->n_sources > SOURCES_MAX) {
+        return -1;
+    }
+
+    /* Refused for want of memory, hosts will report it again */
+    group = membership_insert(&engine->groups, rec->ifindex, rec->addr);
+    if (group == NULL || group->iface != NULL) {
+        return 0;
+    }
+    if (membership_set_sources(&engine->groups, group, sources, rec->n_sources) != 0) {
+        membership_remove(&engine->groups, group);
+        return 0;
+    }
+
+    group->iface = iface;
+    STATS_INC(&iface->stats, groups);
+    set_sources(group, rec->n_sources);
+    group->reporter = rec->reporter;
+    group->version = rec->version;
+    group->mode = rec->mode;
+    group->lmq_left = rec->lmq_left;
+    group->n_hosts = (rec->n_hosts < GROUP_HOSTS ? rec->n_hosts : GROUP_HOSTS);
+    group->untracked = rec->untracked;
+    memcpy(group->hosts, rec->hosts, sizeof(group->hosts));
+    memcpy(group->host_seen, rec->host_seen, sizeof(group->host_seen));
+
+    if (rec->expires != 0) {
+        engine_timer_add(engine, &group->timer, rec->expires);
+    }
+    if (rec->lmq_expires != 0) {
+        engine_timer_add(engine, &group->lmq_timer, rec->lmq_expires);
+    }
+    rearm_sources(engine, group);
+
+    return 0;
+}
+
+static int
+take_over(engine_t *engine, int fd)
+{
+    const handover_hello_t *hello;
+    const handover_iface_t *rec;
+    const handover_group_t *group;
+    const source_t *sources;
+    handover_buf_t *buf;
+    int fds[HANDOVER_MAXFDS], n_fds;
+
+    buf = malloc(sizeof(*buf));
+    if (buf == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate handover buffer: %s", strerror(errno));
+        return -1;
+    }
+    buf->fd = fd;
+
+    if (handover_recv(buf, fds, &n_fds) != 0) {
+        goto fail;
+    }
+    hello = handover_get(buf, sizeof(*hello));
+    if (buf->type != HANDOVER_HELLO || hello == NULL || hello->magic != HANDOVER_MAGIC ||
+        hello->version != HANDOVER_VERSION ||
+        hello->iface_size != sizeof(handover_iface_t) ||
+        hello->group_size != sizeof(handover_group_t) ||
+        n_fds != 1 + !!hello->has_stats + !!hello->has_mrouter) {
+        logger(LOG_LEVEL_ERR, "Running instance speaks an incompatible handover protocol");
+        goto fail_fds;
+    }
+    engine->handover_fd = fds[0];
+    if (hello->has_stats) {
+        stats_server_adopt(&engine->stats, fds[1]);
+    }
+    if (hello->has_mrouter) {
+        engine->igmp_mrouter_fd = fds[n_fds - 1];
+    }
+
+    for (;;) {
+        if (handover_recv(buf, fds, &n_fds) != 0) {
+            goto fail;
+        }
+
+        switch (buf->type) {
+        case HANDOVER_IFACE:
+            rec = handover_get(buf, sizeof(*rec));
+            if (rec == NULL || n_fds < 1 || adopt_iface(engine, rec, fds, n_fds) == NULL) {
+                goto fail_fds;
+            }
+            break;
+
+        case HANDOVER_GROUPS:
+            while ((group = handover_get(buf, sizeof(*group))) != NULL) {
+                sources = handover_get(buf, group->n_sources * sizeof(source_t));
+                if (sources == NULL || adopt_group(engine, group, sources) != 0) {
+                    logger(LOG_LEVEL_ERR, "Malformed group in handover");
+                    goto fail;
+                }
+            }
+            break;
+
+        case HANDOVER_END:
+            if (handover_send(fd, HANDOVER_ACK, NULL, 0, NULL, 0) != 0) {
+                goto fail;
+            }
+            free(buf);
+            return 0;
+
+        default:
+            logger(LOG_LEVEL_ERR, "Unexpected handover message %u", buf->type);
+            goto fail_fds;
+        }
+    }
+
+fail_fds:
+    while (n_fds > 0) {
+        close(fds[--n_fds]);
+    }
+fail:
+    free(buf);
+    return -1;
+}
+
+/* Takes over from an instance listening on the path, or listens there
+ * for the next upgrade. Returns 1 after a takeover. */
+int
+engine_set_handover(engine_t *engine, const char *path)
+{
+    int fd, ret;
+
+    fd = handover_connect(path);
+    if (fd >= 0) {
+        ret = take_over(engine, fd);
+        close(fd);
+        if (ret != 0) {
+            return -1;
+        }
+        logger(LOG_LEVEL_INFO, "Took over from the running instance");
+        return 1;
+    }
+    if (errno != ENOENT && errno != ECONNREFUSED) {
+        return -1;
+    }
+
+    engine->handover_fd = handover_listen(path);
+
+    return (engine->handover_fd >= 0 ? 0 : -1);
+}
+
+void
+engine_dump_filters(engine_t *engine, FILE *stream)
+{
+    engine_t *shard;
+    iface_t *iface;
+    trunk_t *trunk;
+    unsigned i;
+
+    for (i = 0; i < engine->n_shards; i++) {
+        shard = shard_of(engine, i);
+        for (iface = shard->ifaces; iface != NULL; iface = iface->next) {
+            if (iface->trunk == NULL && iface->params.family == AF_INET) {
+                fprintf(stream, "Interface %s:\n", iface->name);
+                filter_dump(&iface->filter, stream);
+            }
+        }
+        for (trunk = shard->trunks; trunk != NULL; trunk = trunk->next) {
+            fprintf(stream, "Trunk %s:\n", trunk->name);
+            filter_dump(&trunk->filter, stream);
+        }
+    }
+}
+
+static void
+pin(pthread_t thread, unsigned id)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    int err;
+
+    CPU_ZERO(&set);
+    CPU_SET(id % (cpus > 0 ? cpus : 1), &set);
+    err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err != 0) {
+        logger(LOG_LEVEL_INFO, "Could not pin thread of shard %u: %s", id, strerror(err));
+    }
+}
+
+static void *
+shard_main(void *arg)
+{
+    engine_t *engine = arg;
+
+    if (engine_run(engine) != 0) {
+        logger(LOG_LEVEL_ERR, "Worker %u stopped", engine->id);
+    }
+
+    return NULL;
+}
+
+/* Threads do not survive daemonize(), so workers only start here */
+static int
+start_shards(engine_t *engine)
+{
+    engine_t *shard;
+    unsigned i;
+    int err;
+
+    pin(pthread_self(), 0);
+    for (i = 1; i < engine->n_shards; i++) {
+        shard = engine->shards[i];
+        err = pthread_create(&shard->thread, NULL, shard_main, shard);
+        if (err != 0) {
+            logger(LOG_LEVEL_ERR, "Could not start worker thread: %s", strerror(err));
+            return -1;
+        }
+        shard->started = 1;
+        pin(shard->thread, i);
+    }
+    logger(LOG_LEVEL_INFO, "Running %u worker threads", engine->n_shards - 1);
+
+    return 0;
+}
+
+int
+engine_run(engine_t *engine)
+{
+    iface_t *iface;
+    trunk_t *trunk;
+
+    if (event_loop_init(&engine->loop) != 0) {
+        return -1;
+    }
+
+    /* One timer descriptor drives the whole wheel */
+    engine->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (engine->timerfd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not create engine timer: %s", strerror(errno));
+        return -1;
+    }
+    if (event_add(&engine->loop, &engine->timer_ev, engine->timerfd, EPOLLIN,
+            timer_cb, engine) != 0) {
+        return -1;
+    }
+    wheel_advance(&engine->wheel, engine_now());
+
+    for (iface = engine->ifaces; iface != NULL; iface = iface->next) {
+        start_querier(engine, iface);
+        if (iface->rx.ops != NULL && event_add(&engine->loop, &iface->sock_ev,
+                iface->rx.fd, EPOLLIN, socket_cb, iface) != 0) {
+            return -1;
+        }
+    }
+    for (trunk = engine->trunks; trunk != NULL; trunk = trunk->next) {
+        if (event_add(&engine->loop, &trunk->ev, trunk->io.fd, EPOLLIN, trunk_cb, trunk) != 0) {
+            return -1;
+        }
+    }
+
+    if (engine->stats.fd >= 0 && stats_server_start(&engine->stats, engine) != 0) {
+        return -1;
+    }
+    if (engine->handover_fd >= 0 && event_add(&engine->loop, &engine->handover_ev,
+            engine->handover_fd, EPOLLIN, handover_cb, engine) != 0) {
+        return -1;
+    }
+    if (engine->wakefd >= 0 && event_add(&engine->loop, &engine->wake_ev,
+            engine->wakefd, EPOLLIN, wake_cb, engine) != 0) {
+        return -1;
+    }
+    engine->running = 1;
+
+    /* Discovered interfaces come and go with their links, as seen by
+     * the main thread */
+    if (engine->n_include > 0 && engine->id == 0) {
+        if (netlink_open(&engine->nl) != 0 ||
+            event_add(&engine->loop, &engine->nl_ev, engine->nl.fd, EPOLLIN,
+                netlink_cb, engine) != 0 ||
+            netlink_dump_links(&engine->nl) != 0) {
+            return -1;
+        }
+    }
+
+    if (engine->n_shards > 1 && start_shards(engine) != 0) {
+        return -1;
+    }
+
+    rearm(engine);
+
+    return event_loop_run(&engine->loop);
+}
+
+/* Running without the event loop, for a driver that owns the clock
+ * and feeds packets through its own backend: start once, then poll
+ * whenever packets are pending or the next timer is due */
+void
+engine_start(engine_t *engine)
+{
+    iface_t *iface;
+
+    wheel_advance(&engine->wheel, engine_now());
+    for (iface = engine->ifaces; iface != NULL; iface = iface->next) {
+        start_querier(engine, iface);
+    }
+    engine->running = 1;
+}
+
+void
+engine_poll(engine_t *engine)
+{
+    iface_t *iface;
+
+    for (iface = engine->ifaces; iface != NULL; iface = iface->next) {
+        socket_cb(EPOLLIN, iface);
+    }
+    wheel_advance(&engine->wheel, engine_now());
+    tx_flush(&engine->tx);
+}
+
+uint64_t
+engine_next_timer(const engine_t *engine)
+{
+    return wheel_next(&engine->wheel);
+}
+
+void
+engine_close(engine_t *engine)
+{
+    shard_msg_t msg;
+    engine_t *shard;
+    iface_t *iface;
+    trunk_t *trunk;
+    unsigned i;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.cmd = SHARD_STOP;
+    for (i = 1; i < engine->n_shards; i++) {
+        shard = engine->shards[i];
+        if (shard == NULL) {
+            continue;
+        }
+        if (shard->started) {
+            while (shard_post(&shard->inbox, shard->wakefd, &msg) != 0) {
+                sched_yield();
+            }
+            pthread_join(shard->thread, NULL);
+        }
+        while (shard->n_held > 0) {
+            free(shard->held[--shard->n_held].buf);
+        }
+        engine_close(shard);
+        spsc_free(&shard->inbox);
+        spsc_free(&shard->outbox);
+        free(shard);
+    }
+    free(engine->shards);
+    engine->shards = NULL;
+    engine->n_shards = 1;
+    if (engine->wakefd >= 0) {
+        close(engine->wakefd);
+        engine->wakefd = -1;
+    }
+    if (engine->mrouter_fd >= 0) {
+        close(engine->mrouter_fd);
+        engine->mrouter_fd = -1;
+    }
+    if (engine->igmp_mrouter_fd >= 0) {
+        close(engine->igmp_mrouter_fd);
+        engine->igmp_mrouter_fd = -1;
+    }
+
+    while (engine->ifaces != NULL) {
+        iface = engine->ifaces;
+        engine->ifaces = iface->next;
+        iface_close(iface);
+        pacer_free(&iface->pacer);
+        free(iface);
+    }
+    while (engine->trunks != NULL) {
+        trunk = engine->trunks;
+        engine->trunks = trunk->next;
+        trunk_close(trunk);
+        free(trunk);
+    }
+
+    if (engine->timerfd >= 0) {
+        close(engine->timerfd);
+        engine->timerfd = -1;
+    }
+    stats_server_close(&engine->stats);
+    snapshot_close(&engine->snapshot);
+    if (engine->handover_fd >= 0) {
+        close(engine->handover_fd);
+        engine->handover_fd = -1;
+    }
+    netlink_close(&engine->nl);
+    membership_free(&engine->groups);
+    event_loop_close(&engine->loop);
+    free(engine->rxbufs);
+    engine->rxbufs = NULL;
+}
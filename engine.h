@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include <pthread.h>
+#include <stdio.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include "event.h"
+#include "iface.h"
+#include "igmp.h"
+#include "membership.h"
+#include "netlink.h"
+#include "pktio.h"
+#include "snapshot.h"
+#include "sources.h"
+#include "spsc.h"
+#include "stats.h"
+#include "trunk.h"
+#include "tx.h"
+#include "wheel.h"
+
+/* Default group-specific query budget, per interface */
+#define ENGINE_PACE_RATE  1000  /* Queries per second */
+#define ENGINE_PACE_BURST 100
+
+/* Default bounds of the adaptive Max Response Time, tenths of a second */
+#define ENGINE_MRT_MIN 10
+#define ENGINE_MRT_MAX 250
+
+/* Default cap on membership state */
+#define ENGINE_MEMORY_DEFAULT (16 * 1024 * 1024)
+
+/* Worker threads, and messages queued between them and the main thread */
+#define ENGINE_SHARDS_MAX 64
+#define ENGINE_QUEUE      4096
+#define ENGINE_RETRY      10    /* Milliseconds before posting again to a full queue */
+
+typedef enum shard_cmd {
+    SHARD_LINK,                 /* Interface event, for the owning shard */
+    SHARD_STATS,                /* Counter dump request, and its answer */
+    SHARD_STOP,
+} shard_cmd_t;
+
+typedef struct shard_msg {
+    shard_cmd_t cmd;
+    int         event;          /* Interface event */
+    unsigned    ifindex;
+    unsigned    flags;
+    char        name[IF_NAMESIZE];
+    void       *client;         /* Stats client waiting for the dump */
+    char       *buf;            /* Rendered counters, freed by the receiver */
+    size_t      len;
+    size_t      mem_used;
+    size_t      mem_limit;
+    uint64_t    refused;
+} shard_msg_t;
+
+typedef struct engine {
+    event_loop_t        loop;
+    iface_t            *ifaces;
+    trunk_t            *trunks;
+    igmp_params_t       params;
+    struct sockaddr_in  dst;
+    membership_t        groups;
+    timer_wheel_t       wheel;
+    int                 timerfd;
+    event_t             timer_ev;
+    uint64_t            armed;
+    tx_batch_t          tx;
+    const pktio_ops_t  *rx_ops;
+    uint8_t           (*rxbufs)[PKTIO_FRAMESIZE];
+    stats_server_t      stats;
+    int                 running;
+    int                 fast_leave;
+    int                 mld;        /* MLD version served next to IGMP, 0 for none */
+    int                 mrouter_fd; /* Passes on MLDv1 reports for any group */
+    int                 igmp_mrouter_fd;    /* Same for IGMPv1 and IGMPv2 reports */
+    unsigned            pace_rate;
+    unsigned            pace_burst;
+    unsigned            mrt_target;     /* Peak reports per second, 0 keeps max_resp */
+    unsigned            mrt_min;
+    unsigned            mrt_max;
+    snapshot_t          snapshot;
+    int                 handover_fd;
+    event_t             handover_ev;
+    netlink_t           nl;
+    event_t             nl_ev;
+    char              **include;    /* Interface discovery patterns */
+    int                 n_include;
+    char              **exclude;
+    int                 n_exclude;
+    struct engine     **shards;     /* All engines by shard, on the main one */
+    unsigned            n_shards;
+    unsigned            id;         /* Shard number, the main thread is 0 */
+    struct engine      *main;
+    pthread_t           thread;
+    int                 started;
+    spsc_t              inbox;      /* Main thread to worker */
+    spsc_t              outbox;     /* Worker to main thread */
+    int                 wakefd;     /* Messages waiting in a queue */
+    event_t             wake_ev;
+    shard_msg_t         held[STATS_MAX_CLIENTS];    /* Stats answers the outbox had no room for */
+    int                 n_held;
+    wheel_timer_t       held_timer;
+    uint32_t            report[SOURCES_MAX];    /* Source set scratch space */
+    uint32_t            report_tmp[SOURCES_MAX];
+    source_t            scratch[SOURCES_MAX];
+} engine_t;
+
+uint64_t engine_now(void);
+
+uint64_t engine_now_us(void);
+
+void engine_set_clock(uint64_t (*now_us)(void));
+
+void engine_timer_add(engine_t *engine, wheel_timer_t *timer, uint64_t expires);
+
+void engine_timer_cancel(engine_t *engine, wheel_timer_t *timer);
+
+int engine_init(engine_t *engine, const igmp_params_t *params, size_t memory);
+
+int engine_set_backend(engine_t *engine, const char *name);
+
+void engine_set_fast_leave(engine_t *engine, int fast_leave);
+
+void engine_set_mld(engine_t *engine, int version);
+
+void engine_set_mrouter(engine_t *engine);
+
+void engine_set_pacing(engine_t *engine, unsigned rate, unsigned burst);
+
+void engine_set_adaptive(engine_t *engine, unsigned target, unsigned min, unsigned max);
+
+int engine_set_stats(engine_t *engine, const char *path);
+
+int engine_set_snapshot(engine_t *engine, const char *path);
+
+int engine_set_handover(engine_t *engine, const char *path);
+
+void engine_set_discovery(engine_t *engine, char **include, int n_include,
+    char **exclude, int n_exclude);
+
+int engine_set_threads(engine_t *engine, unsigned n);
+
+int engine_add_iface(engine_t *engine, const char *name, int version);
+
+int engine_add_virtual_iface(engine_t *engine, const char *name, unsigned index,
+    struct in_addr addr, const pktio_ops_t *ops);
+
+int engine_add_trunk(engine_t *engine, const char *name, const uint16_t *vlans, int n_vlans);
+
+int engine_request_stats(engine_t *engine, void *client);
+
+void engine_dump_filters(engine_t *engine, FILE *stream);
+
+int engine_run(engine_t *engine);
+
+void engine_start(engine_t *engine);
+
+void engine_poll(engine_t *engine);
+
+uint64_t engine_next_timer(const engine_t *engine);
+
+void engine_close(engine_t *engine);
+
+#endif /* __ENGINE_H__ */
@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "logging.h"
+
+#define EVENT_BATCH 64
+
+int
+event_loop_init(event_loop_t *loop)
+{
+    loop->running = 0;
+    loop->pending = NULL;
+    loop->n_pending = 0;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not create event loop: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+event_loop_close(event_loop_t *loop)
+{
+    if (loop->epfd >= 0) {
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+}
+
+int
+event_add(event_loop_t *loop, event_t *ev, int fd, uint32_t events,
+    event_cb_t cb, void *arg)
+{
+    struct epoll_event epev;
+
+    ev->fd = fd;
+    ev->cb = cb;
+    ev->arg = arg;
+
+    memset(&epev, 0, sizeof(epev));
+    epev.events = events;
+    epev.data.ptr = ev;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &epev) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not add descriptor %d to event loop: %s",
+            fd, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+event_del(event_loop_t *loop, event_t *ev)
+{
+    int i;
+
+    /* The owner may be freed right after, drop events already fetched
+     * for it so the dispatch loop never touches the registration again */
+    for (i = 0; i < loop->n_pending; i++) {
+        if (loop->pending[i].data.ptr == ev) {
+            loop->pending[i].data.ptr = NULL;
+        }
+    }
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ev->fd, NULL) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not remove descriptor %d from event loop: %s",
+            ev->fd, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+event_loop_run(event_loop_t *loop)
+{
+    struct epoll_event events[EVENT_BATCH];
+    event_t *ev;
+    int i, n;
+
+    loop->running = 1;
+    while (loop->running) {
+        n = epoll_wait(loop->epfd, events, EVENT_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            logger(LOG_LEVEL_ERR, "Could not wait for events: %s", strerror(errno));
+            return -1;
+        }
+
+        loop->pending = events;
+        loop->n_pending = n;
+        for (i = 0; i < n; i++) {
+            ev = events[i].data.ptr;
+            if (ev != NULL) {
+                ev->cb(events[i].events, ev->arg);
+            }
+        }
+        loop->pending = NULL;
+        loop->n_pending = 0;
+    }
+
+    return 0;
+}
+
+void
+event_loop_stop(event_loop_t *loop)
+{
+    loop->running = 0;
+}
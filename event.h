@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include <stdint.h>
+
+struct epoll_event;
+
+typedef void (*event_cb_t)(uint32_t events, void *arg);
+
+/* Registration record, embedded in the owner's own structure */
+typedef struct event {
+    int         fd;
+    event_cb_t  cb;
+    void       *arg;
+} event_t;
+
+typedef struct event_loop {
+    int                 epfd;
+    int                 running;
+    struct epoll_event *pending;    /* Rest of the batch being dispatched */
+    int                 n_pending;
+} event_loop_t;
+
+int event_loop_init(event_loop_t *loop);
+
+void event_loop_close(event_loop_t *loop);
+
+int event_add(event_loop_t *loop, event_t *ev, int fd, uint32_t events,
+    event_cb_t cb, void *arg);
+
+int event_del(event_loop_t *loop, event_t *ev);
+
+int event_loop_run(event_loop_t *loop);
+
+void event_loop_stop(event_loop_t *loop);
+
+#endif /* __EVENT_H__ */
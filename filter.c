@@ -0,0 +1,210 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+
+#include "filter.h"
+#include "igmp.h"
+#include "logging.h"
+
+/* IGMP message types the engine acts on, everything else is dropped */
+static const uint8_t accepted_types[] = {
+    IGMP_MEMBERSHIP_QUERY,
+    IGMP_V1_MEMBERSHIP_REPORT,
+    IGMP_V2_MEMBERSHIP_REPORT,
+    IGMP_V2_LEAVE_GROUP,
+    IGMP_V3_MEMBERSHIP_REPORT,
+};
+
+#define N_TYPES (sizeof(accepted_types) / sizeof(accepted_types[0]))
+
+/* Instructions of the IP part below, up to and including the final drop */
+#define IP_LEN(own) (6 + ((own).s_addr != INADDR_ANY ? 2 : 0) + N_TYPES)
+
+/* Checks from the IP header on, which starts at the given offset */
+static struct sock_filter *
+build_ip(struct sock_filter *insn, struct in_addr own, uint32_t base)
+{
+    unsigned i;
+
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, base + 9);
+    *insn++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_IGMP, 0,
+        (own.s_addr != INADDR_ANY ? 2 : 0) + N_TYPES + 3);
+
+    /* Our own queries looped back are recognised by their source address */
+    if (own.s_addr != INADDR_ANY) {
+        *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, base + 12);
+        *insn++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+            ntohl(own.s_addr), N_TYPES + 3, 0);
+    }
+
+    /* IGMP type byte, after an IP header of variable length */
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, base);
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_IND, base);
+    for (i = 0; i < N_TYPES; i++) {
+        *insn++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+            accepted_types[i], N_TYPES - 1 - i, (i == N_TYPES - 1 ? 1 : 0));
+    }
+
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+
+    return insn;
+}
+
+void
+filter_build(filter_t *filter, struct in_addr own)
+{
+    /* Raw IP and cooked packet sockets both see the packet from the IP
+     * header on, the latter needs the protocol checked too */
+    filter->len = build_ip(filter->insns, own, 0) - filter->insns;
+}
+
+/* A trunk socket sees whole frames of every protocol, both directions.
+ * Only tagged IPv4 frames coming in are of interest, the kernel has
+ * moved the tag out of the frame and points at the IP header. */
+void
+filter_build_trunk(filter_t *filter, struct in_addr own)
+{
+    struct sock_filter *insn = filter->insns;
+    unsigned drop = IP_LEN(own) - 1;    /* From the end of the checks below */
+
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+    *insn++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING,
+        drop + 4, 0);
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL);
+    *insn++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, drop + 2);
+    *insn++ = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+        SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT);
+    *insn++ = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, drop, 0);
+
+    filter->len = build_ip(insn, own, SKF_NET_OFF) - filter->insns;
+}
+
+void
+filter_build_drop(filter_t *filter)
+{
+    filter->insns[0] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+    filter->len = 1;
+}
+
+int
+filter_attach(int sockfd, const filter_t *filter)
+{
+    struct sock_fprog prog;
+
+    prog.len = filter->len;
+    prog.filter = (struct sock_filter*)filter->insns;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Ancillary data and offsets from the network header, as tcpdump -d */
+static const char *
+ancillary(uint32_t k)
+{
+    switch (k) {
+    case SKF_AD_OFF + SKF_AD_PROTOCOL:
+        return "proto";
+    case SKF_AD_OFF + SKF_AD_PKTTYPE:
+        return "type";
+    case SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT:
+        return "vlan_avail";
+    default:
+        return NULL;
+    }
+}
+
+static const char *
+offset(uint32_t k, char *buf, size_t size)
+{
+    if (k >= (uint32_t)SKF_NET_OFF && k < (uint32_t)SKF_AD_OFF) {
+        snprintf(buf, size, "net + %u", k - (uint32_t)SKF_NET_OFF);
+    } else {
+        snprintf(buf, size, "%u", k);
+    }
+
+    return buf;
+}
+
+void
+filter_dump(const filter_t *filter, FILE *stream)
+{
+    const struct sock_filter *insn;
+    char buf[32];
+    unsigned i;
+
+    /* Same notation as tcpdump -d */
+    for (i = 0; i < filter->len; i++) {
+        insn = &filter->insns[i];
+        fprintf(stream, "(%03u) ", i);
+
+        switch (insn->code) {
+        case BPF_LD | BPF_W | BPF_ABS:
+            if (ancillary(insn->k) != NULL) {
+                fprintf(stream, "ld       #%s\n", ancillary(insn->k));
+            } else {
+                fprintf(stream, "ld       [%s]\n", offset(insn->k, buf, sizeof(buf)));
+            }
+            break;
+
+        case BPF_LD | BPF_H | BPF_ABS:
+            fprintf(stream, "ldh      [%s]\n", offset(insn->k, buf, sizeof(buf)));
+            break;
+
+        case BPF_LD | BPF_B | BPF_ABS:
+            fprintf(stream, "ldb      [%s]\n", offset(insn->k, buf, sizeof(buf)));
+            break;
+
+        case BPF_LD | BPF_B | BPF_IND:
+            fprintf(stream, "ldb      [x + %s]\n", offset(insn->k, buf, sizeof(buf)));
+            break;
+
+        case BPF_LDX | BPF_B | BPF_MSH:
+            fprintf(stream, "ldxb     4*([%s]&0xf)\n", offset(insn->k, buf, sizeof(buf)));
+            break;
+
+        case BPF_JMP | BPF_JEQ | BPF_K:
+            fprintf(stream, "jeq      #0x%-14x jt %u\tjf %u\n", insn->k,
+                i + 1 + insn->jt, i + 1 + insn->jf);
+            break;
+
+        case BPF_RET | BPF_K:
+            fprintf(stream, "ret      #%u\n", insn->k);
+            break;
+
+        default:
+            fprintf(stream, "0x%04x   %u %u 0x%x\n", insn->code, insn->jt, insn->jf, insn->k);
+            break;
+        }
+    }
+}
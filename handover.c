@@ -0,0 +1,284 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "handover.h"
+#include "logging.h"
+
+static int
+set_address(struct sockaddr_un *sun, const char *path)
+{
+    if (strlen(path) >= sizeof(sun->sun_path)) {
+        logger(LOG_LEVEL_ERR, "Handover socket path '%s' too long", path);
+        return -1;
+    }
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    snprintf(sun->sun_path, sizeof(sun->sun_path), "%s", path);
+
+    return 0;
+}
+
+/* Neither side may hang on a peer that went away */
+static int
+set_timeouts(int fd)
+{
+    struct timeval tv = { HANDOVER_TIMEOUT, 0 };
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not set handover timeouts: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+handover_listen(const char *path)
+{
+    struct sockaddr_un sun;
+    int fd;
+
+    if (set_address(&sun, path) != 0) {
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not create handover socket: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Nobody answered on it, so whatever is there is stale */
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0 || listen(fd, 1) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not listen on handover socket '%s': %s",
+            path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Returns -1 with errno ENOENT or ECONNREFUSED, without logging, when no
+ * instance is running */
+int
+handover_connect(const char *path)
+{
+    struct sockaddr_un sun;
+    int fd;
+
+    if (set_address(&sun, path) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not create handover socket: %s", strerror(errno));
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0) {
+        if (errno != ENOENT && errno != ECONNREFUSED) {
+            logger(LOG_LEVEL_ERR, "Could not connect to handover socket '%s': %s",
+                path, strerror(errno));
+        }
+        close(fd);
+        return -1;
+    }
+    if (set_timeouts(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int
+handover_accept(int listenfd)
+{
+    int fd;
+
+    fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            logger(LOG_LEVEL_ERR, "Could not accept handover connection: %s", strerror(errno));
+        }
+        return -1;
+    }
+    if (set_timeouts(fd) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int
+handover_send(int fd, uint32_t type, const void *data, size_t len, const int *fds, int n_fds)
+{
+    char control[CMSG_SPACE(HANDOVER_MAXFDS * sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov[2];
+
+    iov[0].iov_base = &type;
+    iov[0].iov_len = sizeof(type);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (n_fds > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+    }
+
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)(sizeof(type) + len)) {
+        logger(LOG_LEVEL_ERR, "Could not send handover message: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Receives the next message into the buffer, and the descriptors that
+ * came with it */
+int
+handover_recv(handover_buf_t *buf, int *fds, int *n_fds)
+{
+    char control[CMSG_SPACE(HANDOVER_MAXFDS * sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov[2];
+    ssize_t n;
+
+    iov[0].iov_base = &buf->type;
+    iov[0].iov_len = sizeof(buf->type);
+    iov[1].iov_base = buf->data;
+    iov[1].iov_len = sizeof(buf->data);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *n_fds = 0;
+    n = recvmsg(buf->fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < (ssize_t)sizeof(buf->type)) {
+        logger(LOG_LEVEL_ERR, "Could not receive handover message: %s",
+            n < 0 ? strerror(errno) : "connection closed");
+        return -1;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            *n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), *n_fds * sizeof(int));
+        }
+    }
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        logger(LOG_LEVEL_ERR, "Truncated handover message");
+        while (*n_fds > 0) {
+            close(fds[--*n_fds]);
+        }
+        return -1;
+    }
+
+    buf->len = n - sizeof(buf->type);
+    buf->off = 0;
+
+    return 0;
+}
+
+/* Makes room for a record that must not be split across messages,
+ * sending what is there first if it does not fit */
+int
+handover_reserve(handover_buf_t *buf, size_t len)
+{
+    if (buf->len + len > sizeof(buf->data) && handover_flush(buf) != 0) {
+        return -1;
+    }
+
+    return (len <= sizeof(buf->data) ? 0 : -1);
+}
+
+int
+handover_put(handover_buf_t *buf, const void *data, size_t len)
+{
+    if (handover_reserve(buf, len) != 0) {
+        return -1;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+
+    return 0;
+}
+
+int
+handover_flush(handover_buf_t *buf)
+{
+    if (buf->len == 0) {
+        return 0;
+    }
+    if (handover_send(buf->fd, buf->type, buf->data, buf->len, NULL, 0) != 0) {
+        return -1;
+    }
+    buf->len = 0;
+
+    return 0;
+}
+
+const void *
+handover_get(handover_buf_t *buf, size_t len)
+{
+    const void *ptr;
+
+    if (buf->len - buf->off < len) {
+        return NULL;
+    }
+    ptr = buf->data + buf->off;
+    buf->off += len;
+
+    return ptr;
+}
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HANDOVER_H__
+#define __HANDOVER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include "igmp.h"
+#include "membership.h"
+
+#define HANDOVER_MAGIC   0x48514749u    /* "IGQH" */
+#define HANDOVER_VERSION 2
+#define HANDOVER_MSGSIZE 65536
+#define HANDOVER_TIMEOUT 5              /* Seconds either side waits for the other */
+#define HANDOVER_MAXFDS  3              /* Descriptors attached to any one message */
+
+/* Message types, each message is one SOCK_SEQPACKET datagram */
+#define HANDOVER_HELLO  1               /* Handover, stats and routing sockets attached */
+#define HANDOVER_IFACE  2               /* Raw and packet sockets attached */
+#define HANDOVER_GROUPS 3
+#define HANDOVER_END    4
+#define HANDOVER_ACK    5               /* From the new process, old one exits */
+
+typedef struct handover_hello {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t iface_size;                /* Record sizes, catch layout changes */
+    uint16_t group_size;
+    uint16_t has_stats;
+    uint16_t has_mrouter;
+} handover_hello_t;
+
+/* Querier instance, timers as absolute CLOCK_MONOTONIC milliseconds */
+typedef struct handover_iface {
+    char           name[IF_NAMESIZE];
+    char           backend[16];
+    igmp_params_t  params;
+    uint32_t       ring_block;          /* Next ring block to read */
+    int32_t        querier;
+    struct in_addr querier_addr;
+    uint32_t       startup_left;
+    int32_t        dynamic;
+    int32_t        vif;                 /* Multicast routing interface, -1 for none */
+    uint64_t       query_expires;
+    uint64_t       oqp_expires;
+} handover_iface_t;
+
+/* Group state, followed by n_sources source_t records */
+typedef struct handover_group {
+    char           ifname[IF_NAMESIZE];
+    uint32_t       ifindex;
+    struct in_addr addr;
+    struct in_addr reporter;
+    uint8_t        version;
+    uint8_t        mode;
+    uint8_t        lmq_left;
+    uint8_t        n_hosts;
+    uint8_t        untracked;
+    uint16_t       n_sources;
+    struct in_addr hosts[GROUP_HOSTS];
+    uint32_t       host_seen[GROUP_HOSTS];
+    uint64_t       expires;             /* 0 if stopped */
+    uint64_t       lmq_expires;
+} handover_group_t;
+
+/* Message under construction, or the one last received */
+typedef struct handover_buf {
+    int      fd;
+    uint32_t type;
+    size_t   len;
+    size_t   off;
+    uint8_t  data[HANDOVER_MSGSIZE];
+} handover_buf_t;
+
+int handover_listen(const char *path);
+
+int handover_connect(const char *path);
+
+int handover_accept(int listenfd);
+
+int handover_send(int fd, uint32_t type, const void *data, size_t len, const int *fds, int n_fds);
+
+int handover_recv(handover_buf_t *buf, int *fds, int *n_fds);
+
+int handover_reserve(handover_buf_t *buf, size_t len);
+
+int handover_put(handover_buf_t *buf, const void *data, size_t len);
+
+int handover_flush(handover_buf_t *buf);
+
+const void *handover_get(handover_buf_t *buf, size_t len);
+
+#endif /* __HANDOVER_H__ */
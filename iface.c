@@ -0,0 +1,308 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "iface.h"
+#include "logging.h"
+
+static int
+open_rx(iface_t *iface, const pktio_ops_t *rx_ops)
+{
+    filter_build(&iface->filter, iface->addr);
+
+    iface->rx.ops = rx_ops;
+    if (rx_ops->open(&iface->rx, iface) != 0) {
+        iface->rx.ops = NULL;
+        if (iface->sockfd >= 0) {
+            close(iface->sockfd);
+            iface->sockfd = -1;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Primary address, used as query source and for querier election */
+int
+iface_primary_addr(iface_t *iface, struct in_addr *addr)
+{
+    struct ifreq ifr;
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", iface->name);
+    ifr.ifr_addr.sa_family = AF_INET;
+    if (ioctl(iface->sockfd, SIOCGIFADDR, &ifr) < 0) {
+        addr->s_addr = INADDR_ANY;
+        return -1;
+    }
+    *addr = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr;
+
+    return 0;
+}
+
+/* Link-local address, the source of MLD queries and used for election.
+ * Fails with EADDRNOTAVAIL when the interface has none. */
+int
+iface_link_local(iface_t *iface, struct in6_addr *addr)
+{
+    struct ifaddrs *ifap, *ifa;
+    int ret = -1;
+
+    memset(addr, 0, sizeof(*addr));
+    if (getifaddrs(&ifap) != 0) {
+        return -1;
+    }
+    for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET6 &&
+            strcmp(ifa->ifa_name, iface->name) == 0 &&
+            IN6_IS_ADDR_LINKLOCAL(&((struct sockaddr_in6*)ifa->ifa_addr)->sin6_addr)) {
+            *addr = ((struct sockaddr_in6*)ifa->ifa_addr)->sin6_addr;
+            ret = 0;
+            break;
+        }
+    }
+    freeifaddrs(ifap);
+    if (ret != 0) {
+        errno = EADDRNOTAVAIL;
+    }
+
+    return ret;
+}
+
+int
+iface_open(iface_t *iface, const char *name, const pktio_ops_t *rx_ops)
+{
+    /* IP Router Alert option (RFC 2113), required for IGMPv2 and IGMPv3 */
+    static const uint8_t router_alert[4] = { 0x94, 0x04, 0x00, 0x00 };
+    struct ip_mreqn mreqn;
+    int flags, on = 1;
+
+    memset(iface, 0, sizeof(*iface));
+    iface->sockfd = -1;
+    iface->tx_head = -1;
+    iface->vif = -1;
+
+    /* Without a name the socket is left unbound, as in single-socket mode */
+    if (name == NULL) {
+        snprintf(iface->name, sizeof(iface->name), "*");
+    } else {
+        snprintf(iface->name, sizeof(iface->name), "%s", name);
+        iface->index = if_nametoindex(name);
+        if (iface->index == 0) {
+            logger(LOG_LEVEL_ERR, "Unknown interface '%s': %s", name, strerror(errno));
+            return -1;
+        }
+    }
+
+    iface->sockfd = socket(PF_INET, SOCK_RAW, IPPROTO_IGMP);
+    if (iface->sockfd == -1) {
+        logger(LOG_LEVEL_ERR, "Could not open raw socket: %s", strerror(errno));
+        return -1;
+    }
+
+    flags = fcntl(iface->sockfd, F_GETFL, 0);
+    if (flags < 0 || fcntl(iface->sockfd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+        fcntl(iface->sockfd, F_SETFD, FD_CLOEXEC) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not set socket flags for interface '%s': %s",
+            iface->name, strerror(errno));
+        goto fail;
+    }
+
+    if (setsockopt(iface->sockfd, IPPROTO_IP, IP_OPTIONS, router_alert, sizeof(router_alert)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not set router alert option for interface '%s': %s",
+            iface->name, strerror(errno));
+        goto fail;
+    }
+
+    /* Receiving interface of reports, also needed on the unbound socket */
+    if (setsockopt(iface->sockfd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not enable packet info for interface '%s': %s",
+            iface->name, strerror(errno));
+        goto fail;
+    }
+
+    if (name == NULL) {
+        return open_rx(iface, rx_ops);
+    }
+
+    if (setsockopt(iface->sockfd, SOL_SOCKET, SO_BINDTODEVICE, name, strlen(name) + 1) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not bind socket to interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    memset(&mreqn, 0, sizeof(mreqn));
+    mreqn.imr_ifindex = iface->index;
+    if (setsockopt(iface->sockfd, IPPROTO_IP, IP_MULTICAST_IF, &mreqn, sizeof(mreqn)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not set multicast interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    if (iface_primary_addr(iface, &iface->addr) != 0) {
+        logger(LOG_LEVEL_INFO, "No IPv4 address on interface '%s', querier election disabled",
+            name);
+    }
+
+    return open_rx(iface, rx_ops);
+
+fail:
+    close(iface->sockfd);
+    iface->sockfd = -1;
+    return -1;
+}
+
+/* MLD instance of an interface. Queries are sent whole, IPv6 header and
+ * checksum included, as the stack recomputes the checksum of anything
+ * sent on an ICMPv6 socket. Reports come in on an ICMPv6 socket. */
+int
+iface_open6(iface_t *iface, const char *name)
+{
+    int off = 0;
+
+    memset(iface, 0, sizeof(*iface));
+    iface->sockfd = -1;
+    iface->tx_head = -1;
+    iface->vif = -1;
+
+    snprintf(iface->name, sizeof(iface->name), "%s", name);
+    iface->index = if_nametoindex(name);
+    if (iface->index == 0) {
+        logger(LOG_LEVEL_ERR, "Unknown interface '%s': %s", name, strerror(errno));
+        return -1;
+    }
+
+    iface->sockfd = socket(AF_INET6, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_RAW);
+    if (iface->sockfd == -1) {
+        logger(LOG_LEVEL_ERR, "Could not open raw IPv6 socket: %s", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(iface->sockfd, SOL_SOCKET, SO_BINDTODEVICE, name, strlen(name) + 1) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not bind socket to interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    /* Own queries would only come back to be ignored */
+    if (setsockopt(iface->sockfd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &off, sizeof(off)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not disable multicast loop on interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    if (iface_link_local(iface, &iface->addr6) != 0) {
+        logger(LOG_LEVEL_INFO, "No IPv6 link-local address on interface '%s', "
+            "querier election disabled", name);
+    }
+
+    iface->rx.ops = &pktio_socket6_ops;
+    if (pktio_socket6_ops.open(&iface->rx, iface) != 0) {
+        iface->rx.ops = NULL;
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    close(iface->sockfd);
+    iface->sockfd = -1;
+    return -1;
+}
+
+/* Interface of a backend that sends and receives without sockets, as
+ * the simulated segment does */
+int
+iface_open_virtual(iface_t *iface, const char *name, unsigned index, struct in_addr addr,
+    const pktio_ops_t *rx_ops)
+{
+    memset(iface, 0, sizeof(*iface));
+    iface->sockfd = -1;
+    iface->tx_head = -1;
+    iface->vif = -1;
+
+    snprintf(iface->name, sizeof(iface->name), "%s", name);
+    iface->index = index;
+    iface->addr = addr;
+
+    return open_rx(iface, rx_ops);
+}
+
+/* Takes over the sockets of an interface from another process. The
+ * descriptors are the caller's again on failure. */
+int
+iface_adopt(iface_t *iface, const char *name, int sockfd, const pktio_ops_t *rx_ops,
+    int rxfd, unsigned block)
+{
+    memset(iface, 0, sizeof(*iface));
+    iface->sockfd = sockfd;
+    iface->tx_head = -1;
+    iface->vif = -1;
+
+    snprintf(iface->name, sizeof(iface->name), "%s", name);
+    if (strcmp(name, "*") != 0) {
+        iface->index = if_nametoindex(name);
+        if (iface->index == 0) {
+            logger(LOG_LEVEL_ERR, "Unknown interface '%s': %s", name, strerror(errno));
+            return -1;
+        }
+        iface_primary_addr(iface, &iface->addr);
+    }
+    filter_build(&iface->filter, iface->addr);
+
+    iface->rx.ops = rx_ops;
+    iface->rx.fd = rxfd;
+    iface->rx.block = block;
+    if (rx_ops->adopt(&iface->rx, iface) != 0) {
+        iface->rx.ops = NULL;
+        iface->sockfd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+iface_close(iface_t *iface)
+{
+    if (iface->rx.ops != NULL) {
+        iface->rx.ops->close(&iface->rx);
+        iface->rx.ops = NULL;
+    }
+    if (iface->sockfd >= 0) {
+        close(iface->sockfd);
+        iface->sockfd = -1;
+    }
+}
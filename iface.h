@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IFACE_H__
+#define __IFACE_H__
+
+#include <net/if.h>
+
+#include "event.h"
+#include "filter.h"
+#include "igmp.h"
+#include "mld.h"
+#include "pacer.h"
+#include "pktio.h"
+#include "stats.h"
+#include "wheel.h"
+
+/* Ethernet header, 802.1Q tag and IPv4 header with Router Alert */
+#define IFACE_FRAMELEN (14 + 4 + 24)
+
+struct engine;
+struct trunk;
+
+typedef struct iface {
+    struct iface  *next;
+    struct engine *engine;
+    char           name[IF_NAMESIZE];
+    unsigned int   index;
+    struct in_addr addr;
+    struct in6_addr addr6;      /* Link-local address of MLD instances */
+    filter_t       filter;
+    igmp_params_t  params;
+    union {
+        igmp_template_t igmp;
+        mld_template_t  mld;
+    } general, specific;        /* General and group-specific query */
+    int            sockfd;
+    int            vif;         /* Multicast routing interface, -1 for none */
+    pktio_t        rx;
+    event_t        sock_ev;
+    struct iface  *tx_dirty;    /* Transmit batch linkage */
+    int            tx_head;
+    int            tx_tail;
+    wheel_timer_t  query_timer;
+    unsigned       startup_left;
+    int            querier;
+    struct in_addr querier_addr;
+    struct in6_addr querier_addr6;
+    wheel_timer_t  oqp_timer;   /* Other Querier Present */
+    pacer_t        pacer;       /* Group-specific query budget */
+    wheel_timer_t  pace_timer;
+    uint64_t       reports_seen; /* Reports counted up to the last query */
+    int            dynamic;     /* Discovered, follows link state */
+    int            adopted;     /* Handed over by a previous instance */
+    struct trunk  *trunk;       /* VLAN served through a trunk socket */
+    unsigned       vlan;
+    uint8_t        frame[IFACE_FRAMELEN]; /* Header template of trunk frames */
+    stats_t        stats;
+} iface_t;
+
+int iface_open(iface_t *iface, const char *name, const pktio_ops_t *rx_ops);
+
+int iface_open6(iface_t *iface, const char *name);
+
+int iface_primary_addr(iface_t *iface, struct in_addr *addr);
+
+int iface_link_local(iface_t *iface, struct in6_addr *addr);
+
+int iface_open_virtual(iface_t *iface, const char *name, unsigned index, struct in_addr addr,
+    const pktio_ops_t *rx_ops);
+
+int iface_adopt(iface_t *iface, const char *name, int sockfd, const pktio_ops_t *rx_ops,
+    int rxfd, unsigned block);
+
+void iface_close(iface_t *iface);
+
+#endif /* __IFACE_H__ */
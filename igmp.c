@@ -0,0 +1,436 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/ip.h>
+#include <linux/mroute.h>
+#include <sys/socket.h>
+
+#include "filter.h"
+#include "igmp.h"
+#include "logging.h"
+#include "mld.h"
+
+#define IGMP_V3_REPORT_HDRLEN 8
+#define IGMP_V3_RECORD_HDRLEN 8
+
+/* Checksums are summed in host order and stored without swapping, which
+ * yields the correct network order result on any host (RFC 1071) */
+
+static inline uint16_t
+load16(const uint8_t *p)
+{
+    uint16_t word;
+
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+static inline uint32_t
+fold16(uint64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+
+    return sum;
+}
+
+uint16_t
+cksum(const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint32_t cksum = 0;
+    uint16_t odd = 0;
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        cksum += load16(p + i);
+    }
+    /* A trailing byte is padded with a zero byte, as it is on the wire */
+    if (len % 2) {
+        memcpy(&odd, p + len - 1, 1);
+        cksum += odd;
+    }
+    cksum = (cksum >> 16) + (cksum & 0xFFFF);
+    cksum = cksum + (cksum >> 16);
+
+    return (~cksum & 0xFFFF);
+}
+
+#define ADDC(sum, word) do { (sum) += (word); (sum) += ((sum) < (word)); } while (0)
+
+uint32_t
+cksum_partial(const void *buf, size_t len, uint32_t sum)
+{
+    const uint8_t *p = buf;
+    uint64_t acc = sum;
+    uint64_t w0, w1, w2, w3;
+    uint32_t w32;
+    uint16_t w16 = 0;
+
+    /* 64 bits at a time with end-around carry, four independent loads
+     * per round to keep the pipeline busy on long source lists */
+    for (; len >= 32; p += 32, len -= 32) {
+        memcpy(&w0, p, 8);
+        memcpy(&w1, p + 8, 8);
+        memcpy(&w2, p + 16, 8);
+        memcpy(&w3, p + 24, 8);
+        ADDC(acc, w0);
+        ADDC(acc, w1);
+        ADDC(acc, w2);
+        ADDC(acc, w3);
+    }
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&w0, p, 8);
+        ADDC(acc, w0);
+    }
+    if (len >= 4) {
+        memcpy(&w32, p, 4);
+        ADDC(acc, (uint64_t)w32);
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        ADDC(acc, (uint64_t)load16(p));
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        memcpy(&w16, p, 1);
+        ADDC(acc, (uint64_t)w16);
+    }
+
+    return fold16(acc);
+}
+
+uint16_t
+cksum_finish(uint32_t sum)
+{
+    return (~fold16(sum) & 0xFFFF);
+}
+
+uint16_t
+cksum_update(uint16_t cksum, const void *old, const void *new, size_t len)
+{
+    const uint8_t *o = old, *n = new;
+    uint32_t sum = ~cksum & 0xFFFF;
+    size_t i;
+
+    /* HC' = ~(~HC + ~m + m'), RFC 1624 equation 3 */
+    for (i = 0; i < len; i += 2) {
+        sum += ~load16(o + i) & 0xFFFF;
+        sum += load16(n + i);
+    }
+
+    return (~fold16(sum) & 0xFFFF);
+}
+
+uint8_t
+igmp_encode_code(unsigned value)
+{
+    unsigned exp;
+
+    /* Floating point format of RFC 3376, section 4.1.1, rounding down */
+    if (value < 128) {
+        return value;
+    }
+    if (value > IGMP_CODE_MAX) {
+        return 0xFF;
+    }
+    for (exp = 0; (value >> (exp + 3)) > 0x1F; exp++);
+
+    return 0x80 | (exp << 4) | ((value >> (exp + 3)) & 0x0F);
+}
+
+unsigned
+igmp_decode_code(uint8_t code)
+{
+    if (code < 128) {
+        return code;
+    }
+
+    return ((code & 0x0F) | 0x10) << (((code >> 4) & 0x07) + 3);
+}
+
+unsigned
+igmp_max_resp(const igmp_params_t *params)
+{
+    if (params->family == AF_INET6) {
+        return mld_max_resp(params);
+    }
+
+    switch (params->version) {
+    case 1:
+        /* Fixed at 10 seconds */
+        return IGMP_QUERY_RESPONSE_INTERVAL;
+
+    case 2:
+        return (params->max_resp > 255 ? 255 : params->max_resp);
+
+    default:
+        return igmp_decode_code(igmp_encode_code(params->max_resp));
+    }
+}
+
+/* Last Member Query Interval as carried in group-specific queries */
+unsigned
+igmp_lmqi(const igmp_params_t *params)
+{
+    igmp_params_t tparams = *params;
+
+    tparams.max_resp = params->lmqi;
+    return igmp_max_resp(&tparams);
+}
+
+size_t
+igmp_build_query(uint8_t *buf, const igmp_params_t *params, struct in_addr group)
+{
+    struct igmp *igmp = (struct igmp*)buf;
+    size_t len = IGMP_MINLEN;
+
+    igmp->igmp_type = IGMP_MEMBERSHIP_QUERY;
+    igmp->igmp_cksum = 0;
+    igmp->igmp_group = group;
+
+    switch (params->version) {
+    case 1:
+        igmp->igmp_code = 0;
+        break;
+
+    case 2:
+        igmp->igmp_code = igmp_max_resp(params);
+        break;
+
+    default:
+        igmp->igmp_code = igmp_encode_code(params->max_resp);
+        /* Resv, S flag and QRV, then QQIC and an empty source list */
+        buf[8] = (params->robustness <= IGMP_QRV_MAX ? params->robustness : 0);
+        buf[9] = igmp_encode_code(params->interval);
+        buf[10] = 0;
+        buf[11] = 0;
+        len = IGMP_V3_QUERY_MINLEN;
+        break;
+    }
+
+    igmp->igmp_cksum = cksum(buf, len);
+
+    return len;
+}
+
+void
+igmp_template_init(igmp_template_t *tpl, const igmp_params_t *params, int specific)
+{
+    struct in_addr any = { INADDR_ANY };
+    igmp_params_t tparams = *params;
+
+    /* Group-specific queries use the Last Member Query Interval */
+    if (specific) {
+        tparams.max_resp = params->lmqi;
+    }
+    tpl->len = igmp_build_query(tpl->data, &tparams, any);
+}
+
+size_t
+igmp_template_build(const igmp_template_t *tpl, uint8_t *buf, struct in_addr group,
+    int suppress, const uint8_t *sources, uint16_t n_sources)
+{
+    uint16_t ck, nsrc;
+
+    memcpy(buf, tpl->data, tpl->len);
+    memcpy(&ck, buf + 2, sizeof(ck));
+
+    memcpy(buf + 4, &group, sizeof(group));
+    ck = cksum_update(ck, tpl->data + 4, buf + 4, sizeof(group));
+
+    if (tpl->len < IGMP_V3_QUERY_MINLEN) {
+        memcpy(buf + 2, &ck, sizeof(ck));
+        return tpl->len;
+    }
+
+    /* S flag shares a word with QRV, source count is a word of its own */
+    if (suppress) {
+        buf[8] |= 0x08;
+    }
+    nsrc = htons(n_sources);
+    memcpy(buf + 10, &nsrc, sizeof(nsrc));
+    ck = cksum_update(ck, tpl->data + 8, buf + 8, 4);
+
+    if (n_sources > 0) {
+        memcpy(buf + IGMP_V3_QUERY_MINLEN, sources, n_sources * 4);
+        ck = cksum_finish(cksum_partial(sources, n_sources * 4, ~ck & 0xFFFF));
+    }
+    memcpy(buf + 2, &ck, sizeof(ck));
+
+    return tpl->len + n_sources * 4;
+}
+
+int
+igmp_parse(const uint8_t *buf, size_t len, igmp_msg_t *msg)
+{
+    const struct ip *ip = (const struct ip*)buf;
+    size_t hlen, tlen;
+
+    if (len < sizeof(struct ip) || ip->ip_v != 4 || ip->ip_p != IPPROTO_IGMP) {
+        return -1;
+    }
+
+    hlen = ip->ip_hl << 2;
+    tlen = ntohs(ip->ip_len);
+    /* Some platforms hand out raw IP packets with a host order length */
+    if (tlen > len || tlen < hlen + IGMP_MINLEN) {
+        tlen = len;
+    }
+    if (hlen < sizeof(struct ip) || tlen < hlen + IGMP_MINLEN) {
+        return -1;
+    }
+
+    msg->data = buf + hlen;
+    msg->len = tlen - hlen;
+    if (cksum_finish(cksum_partial(msg->data, msg->len, 0)) != 0) {
+        return -1;
+    }
+
+    msg->src = ip->ip_src;
+    msg->dst = ip->ip_dst;
+    msg->type = msg->data[0];
+    msg->code = msg->data[1];
+    msg->n_records = 0;
+
+    if (msg->type == IGMP_V3_MEMBERSHIP_REPORT) {
+        msg->group.s_addr = INADDR_ANY;
+        msg->n_records = (msg->data[6] << 8) | msg->data[7];
+    } else {
+        memcpy(&msg->group, msg->data + 4, sizeof(msg->group));
+    }
+
+    return 0;
+}
+
+int
+igmp_next_record(const igmp_msg_t *msg, size_t *offset, igmp_record_t *rec)
+{
+    const uint8_t *p;
+    size_t reclen;
+
+    if (*offset == 0) {
+        *offset = IGMP_V3_REPORT_HDRLEN;
+    }
+    if (*offset + IGMP_V3_RECORD_HDRLEN > msg->len) {
+        return -1;
+    }
+
+    p = msg->data + *offset;
+    rec->type = p[0];
+    rec->n_sources = (p[2] << 8) | p[3];
+    memcpy(&rec->group, p + 4, sizeof(rec->group));
+    rec->sources = p + IGMP_V3_RECORD_HDRLEN;
+
+    /* Auxiliary data length is given in 32-bit words */
+    reclen = IGMP_V3_RECORD_HDRLEN + rec->n_sources * 4 + p[1] * 4;
+    if (*offset + reclen > msg->len) {
+        return -1;
+    }
+    *offset += reclen;
+
+    return 0;
+}
+
+/* Multicast routing socket, without which the stack drops reports to
+ * groups the host has not joined. It reads nothing itself, reports
+ * carrying Router Alert go to the sockets asking for them instead. */
+int
+igmp_mrouter_open(void)
+{
+    filter_t drop;
+    int fd, on = 1;
+
+    fd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_IGMP);
+    if (fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not open IGMP socket: %s", strerror(errno));
+        return -1;
+    }
+
+    filter_build_drop(&drop);
+    if (filter_attach(fd, &drop) != 0) {
+        logger(LOG_LEVEL_ERR, "Could not attach packet filter to IGMP socket: %s",
+            strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (setsockopt(fd, IPPROTO_IP, MRT_INIT, &on, sizeof(on)) < 0) {
+        if (errno == EADDRINUSE) {
+            logger(LOG_LEVEL_INFO, "Multicast routing already active, IGMP reports pass through");
+        } else {
+            logger(LOG_LEVEL_INFO, "Could not enable multicast routing, IGMPv1 and IGMPv2 "
+                "reports are only seen for groups joined locally: %s", strerror(errno));
+        }
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Makes an interface a multicast routing one, so its reports are passed
+ * on. Returns the virtual interface number taken, or -1. */
+int
+igmp_mrouter_add(int fd, unsigned ifindex)
+{
+    struct vifctl vif;
+
+    memset(&vif, 0, sizeof(vif));
+    vif.vifc_flags = VIFF_USE_IFINDEX;
+    vif.vifc_threshold = 1;
+    vif.vifc_lcl_ifindex = ifindex;
+    /* Numbers are shared with any other instance, the kernel hands out none */
+    for (vif.vifc_vifi = 0; vif.vifc_vifi < MAXVIFS; vif.vifc_vifi++) {
+        if (setsockopt(fd, IPPROTO_IP, MRT_ADD_VIF, &vif, sizeof(vif)) == 0) {
+            return vif.vifc_vifi;
+        }
+        if (errno != EADDRINUSE) {
+            break;
+        }
+    }
+
+    return -1;
+}
+
+void
+igmp_mrouter_del(int fd, int vifi)
+{
+    struct vifctl vif;
+
+    memset(&vif, 0, sizeof(vif));
+    vif.vifc_vifi = vifi;
+    if (setsockopt(fd, IPPROTO_IP, MRT_DEL_VIF, &vif, sizeof(vif)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not remove multicast routing interface %d: %s",
+            vifi, strerror(errno));
+    }
+}
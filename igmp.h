@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IGMP_H__
+#define __IGMP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <netinet/igmp.h>
+
+/* For compatibility with e.g. OS X 10.8 */
+#ifndef IGMP_MEMBERSHIP_QUERY
+#define IGMP_MEMBERSHIP_QUERY IGMP_HOST_MEMBERSHIP_QUERY
+#endif
+
+#ifndef IGMP_V3_MEMBERSHIP_REPORT
+#define IGMP_V3_MEMBERSHIP_REPORT 0x22
+#endif
+
+#define IGMP_V3_QUERY_MINLEN 12
+
+/* Sources fitting a query in a 1500 byte frame, with Router Alert */
+#define IGMP_V3_QUERY_MAXSRC ((1500 - 24 - IGMP_V3_QUERY_MINLEN) / 4)
+
+/* Protocol defaults (RFC 2236, section 8 and RFC 3376, section 8) */
+#define IGMP_ROBUSTNESS              2
+#define IGMP_QUERY_RESPONSE_INTERVAL 100 /* tenths of a second */
+#define IGMP_LAST_MEMBER_INTERVAL    10  /* tenths of a second */
+
+/* Largest value representable in a Max Resp Code or QQIC field */
+#define IGMP_CODE_MAX 31744
+#define IGMP_QRV_MAX  7
+
+/* IGMPv3 group record types (RFC 3376, section 4.2.12) */
+#define IGMP_MODE_IS_INCLUDE        1
+#define IGMP_MODE_IS_EXCLUDE        2
+#define IGMP_CHANGE_TO_INCLUDE_MODE 3
+#define IGMP_CHANGE_TO_EXCLUDE_MODE 4
+#define IGMP_ALLOW_NEW_SOURCES      5
+#define IGMP_BLOCK_OLD_SOURCES      6
+
+/* Query parameters of a querier instance */
+typedef struct igmp_params {
+    int      family;     /* AF_INET for IGMP, AF_INET6 for MLD */
+    int      version;    /* 1, 2 or 3 */
+    unsigned max_resp;   /* Query Response Interval, tenths of a second */
+    unsigned robustness; /* Robustness Variable */
+    unsigned interval;   /* Query Interval, seconds */
+    unsigned lmqi;       /* Last Member Query Interval, tenths of a second */
+    unsigned lmqc;       /* Last Member Query Count */
+    unsigned jitter;     /* Maximum query phase offset, milliseconds */
+} igmp_params_t;
+
+/* Prebuilt query, patched per packet with incremental checksum updates */
+typedef struct igmp_template {
+    uint8_t data[IGMP_V3_QUERY_MINLEN];
+    size_t  len;
+} igmp_template_t;
+
+/* Parsed IGMP message, pointing into the receive buffer */
+typedef struct igmp_msg {
+    uint8_t         type;
+    uint8_t         code;
+    struct in_addr  src;
+    struct in_addr  dst;
+    struct in_addr  group;
+    const uint8_t  *data;
+    size_t          len;
+    uint16_t        n_records;
+} igmp_msg_t;
+
+/* IGMPv3 group record, sources are left in network byte order */
+typedef struct igmp_record {
+    uint8_t         type;
+    uint16_t        n_sources;
+    struct in_addr  group;
+    const uint8_t  *sources;
+} igmp_record_t;
+
+uint16_t cksum(const void *buf, size_t len);
+
+uint32_t cksum_partial(const void *buf, size_t len, uint32_t sum);
+
+uint16_t cksum_finish(uint32_t sum);
+
+uint16_t cksum_update(uint16_t cksum, const void *old, const void *new, size_t len);
+
+uint8_t igmp_encode_code(unsigned value);
+
+unsigned igmp_decode_code(uint8_t code);
+
+unsigned igmp_max_resp(const igmp_params_t *params);
+
+unsigned igmp_lmqi(const igmp_params_t *params);
+
+size_t igmp_build_query(uint8_t *buf, const igmp_params_t *params, struct in_addr group);
+
+void igmp_template_init(igmp_template_t *tpl, const igmp_params_t *params, int specific);
+
+size_t igmp_template_build(const igmp_template_t *tpl, uint8_t *buf, struct in_addr group,
+    int suppress, const uint8_t *sources, uint16_t n_sources);
+
+int igmp_parse(const uint8_t *buf, size_t len, igmp_msg_t *msg);
+
+int igmp_next_record(const igmp_msg_t *msg, size_t *offset, igmp_record_t *rec);
+
+int igmp_mrouter_open(void);
+
+int igmp_mrouter_add(int fd, unsigned ifindex);
+
+void igmp_mrouter_del(int fd, int vifi);
+
+#endif /* __IGMP_H__ */
@@ -33,53 +33,157 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "daemon.h"
+#include "engine.h"
+#include "igmp.h"
 #include "logging.h"
 
 #define VERSION "0.2.0"
 
-/* For compatibility with e.g. OS X 10.8 */
-#ifndef IGMP_MEMBERSHIP_QUERY
-#define IGMP_MEMBERSHIP_QUERY IGMP_HOST_MEMBERSHIP_QUERY
-#endif
-
 typedef struct igmpqd_options {
     int   debug;
+    int   dump_filter;
     int   daemonize;
     int   help;
     int   use_syslog;
     int   version;
     long  interval;
+    long  query_version;
+    long  max_resp;
+    int   max_resp_set;
+    long  robustness;
+    long  jitter;
+    long  lmqi;
+    long  memory;
+    long  threads;
+    long  pace_rate;
+    long  pace_burst;
+    long  mrt_target;
+    long  mrt_min;
+    long  mrt_max;
+    long  mld;
+    int   fast_leave;
     char *username;
     char *groupname;
     char *pidfile;
+    char *backend;
+    char *stats_path;
+    char *snapshot_path;
+    char *handover_path;
+    char **ifnames;
+    int   n_ifnames;
+    char **include;
+    int   n_include;
+    char **exclude;
+    int   n_exclude;
+    char **trunks;
+    int   n_trunks;
 } igmpqd_options_t;
 
 void
 usage(char *command)
 {
-    printf("usage: %s [-dfhlv] [-m MGROUP] [-u USER] [-s INTERVAL] [-p PIDFILE]\n",
+    printf("usage: %s [-dDfFhlv] [-i IFACE[,VERSION]]... [-u USER] [-s INTERVAL] [-p PIDFILE]\n"
+        "       [-Q VERSION] [-m VERSION] [-r MAXRESP] [-A PPS[,MIN[,MAX]]] [-R ROBUSTNESS] [-L LMQI] [-j JITTER] [-b socket|ring]\n"
+        "       [-S STATSSOCKET] [-M KBYTES] [-P RATE[,BURST]] [-w SNAPSHOT] [-H HANDOVER] [-t THREADS]\n"
+        "       [-I PATTERN]... [-X PATTERN]... [-T PARENT:VLANS]...\n",
         command);
 }
 
 int
-parse_command_line(int argc, char **argv, igmpqd_options_t *options)
+parse_number(const char *arg, long min, long max, long *value)
 {
     char *endptr = NULL;
+
+    errno = 0;
+    *value = strtol(arg, &endptr, 10);
+    if (*arg == '\0' || *endptr != '\0' || errno != 0 || *value < min || *value > max) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Comma separated VLAN IDs and ranges, as in 100-199,300 */
+int
+parse_vlans(char *arg, uint16_t *vlans, int *n_vlans)
+{
+    char *item, *sep, *save = NULL;
+    long first, last;
+
+    *n_vlans = 0;
+    for (item = strtok_r(arg, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        sep = strchr(item, '-');
+        if (sep != NULL) {
+            *sep++ = '\0';
+        }
+        if (parse_number(item, 1, TRUNK_VLANS - 2, &first) != 0 ||
+            parse_number(sep != NULL ? sep : item, first, TRUNK_VLANS - 2, &last) != 0) {
+            return -1;
+        }
+        while (first <= last && *n_vlans < TRUNK_VLANS) {
+            vlans[(*n_vlans)++] = first++;
+        }
+    }
+
+    return (*n_vlans > 0 ? 0 : -1);
+}
+
+int
+parse_command_line(int argc, char **argv, igmpqd_options_t *options)
+{
+    char *sep, *max;
     int c;
 
-    while ((c = getopt(argc, argv, "dfg:hlp:s:u:v")) != -1) {
+    while ((c = getopt(argc, argv, "A:b:dDfFg:hH:i:I:j:lL:m:M:p:P:Q:r:R:s:S:t:T:u:vw:X:")) != -1) {
         switch (c) {
+        case 'A':
+            /* Target peak report rate, then bounds in tenths of a second */
+            sep = strchr(optarg, ',');
+            if (sep != NULL) {
+                *sep++ = '\0';
+                max = strchr(sep, ',');
+                if (max != NULL) {
+                    *max++ = '\0';
+                    if (parse_number(max, 1, IGMP_CODE_MAX, &options->mrt_max) != 0) {
+                        fprintf(stderr, "Error: Invalid max response time bound '%s'\n", max);
+                        return -1;
+                    }
+                }
+                if (parse_number(sep, 1, IGMP_CODE_MAX, &options->mrt_min) != 0) {
+                    fprintf(stderr, "Error: Invalid max response time bound '%s'\n", sep);
+                    return -1;
+                }
+            }
+            if (parse_number(optarg, 1, INT_MAX, &options->mrt_target) != 0) {
+                fprintf(stderr, "Error: Invalid report rate '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'b':
+            options->backend = optarg;
+            break;
+
         case 'd':
             options->debug = 1;
             break;
 
+        case 'D':
+            options->dump_filter = 1;
+            break;
+
         case 'f':
             options->daemonize = 0;
             break;
 
+        case 'F':
+            options->fast_leave = 1;
+            break;
+
         case 'g':
             options->groupname = optarg;
             break;
@@ -88,25 +192,116 @@ parse_command_line(int argc, char **argv, igmpqd_options_t *options)
             options->help = 1;
             break;
 
+        case 'H':
+            options->handover_path = optarg;
+            break;
+
+        case 'i':
+            options->ifnames[options->n_ifnames++] = optarg;
+            break;
+
+        case 'I':
+            options->include[options->n_include++] = optarg;
+            break;
+
+        case 'j':
+            if (parse_number(optarg, 0, INT_MAX, &options->jitter) != 0) {
+                fprintf(stderr, "Error: Invalid jitter '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
         case 'l':
             options->use_syslog = 1;
             break;
 
+        case 'L':
+            if (parse_number(optarg, 1, IGMP_CODE_MAX, &options->lmqi) != 0) {
+                fprintf(stderr, "Error: Invalid last member query interval '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'm':
+            if (parse_number(optarg, 1, 2, &options->mld) != 0) {
+                fprintf(stderr, "Error: Invalid MLD version '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'M':
+            if (parse_number(optarg, 64, 16 * 1024 * 1024, &options->memory) != 0) {
+                fprintf(stderr, "Error: Invalid memory limit '%s'\n", optarg);
+                return -1;
+            }
+            options->memory *= 1024;
+            break;
+
         case 'p':
             options->pidfile = optarg;
             break;
 
+        case 'P':
+            /* Rate 0 turns pacing off */
+            sep = strchr(optarg, ',');
+            if (sep != NULL) {
+                *sep++ = '\0';
+                if (parse_number(sep, 1, INT_MAX, &options->pace_burst) != 0) {
+                    fprintf(stderr, "Error: Invalid query burst '%s'\n", sep);
+                    return -1;
+                }
+            }
+            if (parse_number(optarg, 0, INT_MAX, &options->pace_rate) != 0) {
+                fprintf(stderr, "Error: Invalid query rate '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'Q':
+            if (parse_number(optarg, 1, 3, &options->query_version) != 0) {
+                fprintf(stderr, "Error: Invalid IGMP version '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'r':
+            if (parse_number(optarg, 1, IGMP_CODE_MAX, &options->max_resp) != 0) {
+                fprintf(stderr, "Error: Invalid max response time '%s'\n", optarg);
+                return -1;
+            }
+            options->max_resp_set = 1;
+            break;
+
+        case 'R':
+            if (parse_number(optarg, 1, IGMP_QRV_MAX, &options->robustness) != 0) {
+                fprintf(stderr, "Error: Invalid robustness '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
         case 's':
-            errno = 0;
-            options->interval = strtol(optarg, &endptr, 10);
-            if (*endptr != '\0' || options->interval <= 0 ||
-                (errno == ERANGE && (options->interval == LONG_MAX || options->interval == LONG_MIN)) ||
-                (errno != 0 && options->interval == 0)) {
+            /* Keeps the millisecond timer arithmetic from overflowing */
+            if (parse_number(optarg, 1, INT_MAX / 1000 / IGMP_QRV_MAX, &options->interval) != 0) {
                 fprintf(stderr, "Error: Invalid interval '%s'\n", optarg);
                 return -1;
             }
             break;
 
+        case 'S':
+            options->stats_path = optarg;
+            break;
+
+        case 't':
+            if (parse_number(optarg, 1, ENGINE_SHARDS_MAX, &options->threads) != 0) {
+                fprintf(stderr, "Error: Invalid number of threads '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'T':
+            options->trunks[options->n_trunks++] = optarg;
+            break;
+
         case 'u':
             options->username = optarg;
             break;
@@ -115,6 +310,14 @@ parse_command_line(int argc, char **argv, igmpqd_options_t *options)
             options->version = 1;
             break;
 
+        case 'w':
+            options->snapshot_path = optarg;
+            break;
+
+        case 'X':
+            options->exclude[options->n_exclude++] = optarg;
+            break;
+
         default:
             usage(argv[0]);
             return -1;
@@ -128,36 +331,58 @@ parse_command_line(int argc, char **argv, igmpqd_options_t *options)
         return -1;
     }
 
-    return 0;
-}
-
-uint16_t
-cksum(void *buf, size_t len)
-{
-    uint32_t cksum = 0;
-    int i;
-    int short_len = len / 2;
-
-    for (i = 0; i < short_len; i++) {
-        cksum += ((uint16_t*)buf)[i];
+    /* IGMPv3 queries carry the interval in QQIC (RFC 3376, section 4.1.7) */
+    if (options->query_version == 3 && options->interval > IGMP_CODE_MAX) {
+        fprintf(stderr, "Error: IGMPv3 query interval is at most %d seconds\n", IGMP_CODE_MAX);
+        return -1;
+    }
+    /* So do MLDv2 queries (RFC 3810, section 5.1.9) */
+    if (options->mld == 2 && options->interval > IGMP_CODE_MAX) {
+        fprintf(stderr, "Error: MLDv2 query interval is at most %d seconds\n", IGMP_CODE_MAX);
+        return -1;
+    }
+    /* Hosts must be able to respond within the query interval, the
+     * default shrinks to fit a short one */
+    if (options->max_resp >= options->interval * 10) {
+        if (options->max_resp_set) {
+            fprintf(stderr, "Error: Max response time must be shorter than the interval\n");
+            return -1;
+        }
+        options->max_resp = options->interval * 10 - 1;
+    }
+    if (options->mrt_min > options->mrt_max) {
+        fprintf(stderr, "Error: Max response time bounds are reversed\n");
+        return -1;
+    }
+    /* Snapshot and handover state belong to a single engine */
+    if (options->threads > 1 && (options->snapshot_path != NULL ||
+            options->handover_path != NULL)) {
+        fprintf(stderr, "Error: Snapshots and handover need a single thread\n");
+        return -1;
+    }
+    /* MLD runs on named and discovered interfaces, not on trunks */
+    if (options->mld != 0 && options->handover_path != NULL) {
+        fprintf(stderr, "Error: Handover does not carry MLD state\n");
+        return -1;
     }
-    if (len % 2) {
-        cksum += ((uint8_t*)buf)[len - 1];
+    if (options->mld != 0 && options->n_ifnames == 0 && options->n_include == 0) {
+        fprintf(stderr, "Error: MLD needs an interface or pattern\n");
+        return -1;
     }
-    cksum = (cksum >> 16) + (cksum & 0xFFFF);
-    cksum = cksum + (cksum >> 16);
 
-    return (~cksum & 0xFFFF);
+    return 0;
 }
 
 int
 main(int argc, char **argv)
 {
-    struct igmp igmp;
-    struct in_addr mgroup, allhosts;
-    struct sockaddr_in dst;
     igmpqd_options_t *options;
-    int sockfd;
+    igmp_params_t params;
+    engine_t engine;
+    long version;
+    uint16_t vlans[TRUNK_VLANS];
+    char *sep;
+    int i, took_over, n_vlans;
 
     /* Parse command line options */
     options = malloc(sizeof(igmpqd_options_t));
@@ -167,7 +392,26 @@ main(int argc, char **argv)
     }
     memset(options, 0, sizeof(*options));
     options->interval = 60; /* seconds */
+    options->query_version = 1;
+    options->max_resp = IGMP_QUERY_RESPONSE_INTERVAL;
+    options->robustness = IGMP_ROBUSTNESS;
+    options->lmqi = IGMP_LAST_MEMBER_INTERVAL;
+    options->memory = ENGINE_MEMORY_DEFAULT;
+    options->threads = 1;
+    options->pace_rate = ENGINE_PACE_RATE;
+    options->pace_burst = ENGINE_PACE_BURST;
+    options->mrt_min = ENGINE_MRT_MIN;
+    options->mrt_max = ENGINE_MRT_MAX;
     options->daemonize = 1;
+    options->ifnames = calloc(argc, sizeof(char*));
+    options->include = calloc(argc, sizeof(char*));
+    options->exclude = calloc(argc, sizeof(char*));
+    options->trunks = calloc(argc, sizeof(char*));
+    if (options->ifnames == NULL || options->include == NULL || options->exclude == NULL ||
+        options->trunks == NULL) {
+        perror("Error: Could not allocate memory for interface names");
+        exit(EXIT_FAILURE);
+    }
     if (parse_command_line(argc, argv, options) != 0) {
         exit(EXIT_FAILURE);
     }
@@ -182,44 +426,133 @@ main(int argc, char **argv)
         exit(EXIT_SUCCESS);
     }
 
+    /* Query phase jitter */
+    srandom(time(NULL) ^ getpid());
+
     /* Initialize logging */
     init_logger(options->use_syslog);
-
-    /* Create socket */
-    sockfd = socket(PF_INET, SOCK_RAW, IPPROTO_IGMP);
-    if (sockfd == -1) {
-        logger(LOG_LEVEL_ERR, "Could not open raw socket: %s", strerror(errno));
+    /* Default query parameters, per-interface version may override */
+    params.family = AF_INET;
+    params.version = options->query_version;
+    params.max_resp = options->max_resp;
+    params.robustness = options->robustness;
+    params.interval = options->interval;
+    params.lmqi = options->lmqi;
+    params.lmqc = options->robustness;
+    params.jitter = options->jitter;
+    /* Every thread gets an equal share of the memory cap */
+    if (engine_init(&engine, &params, options->memory / options->threads) != 0) {
         goto fail;
     }
 
-    /* Drop privileges */
-    if (drop_privileges(options->username, options->groupname) != 0) {
-        goto fail;
+    engine_set_fast_leave(&engine, options->fast_leave);
+    engine_set_mld(&engine, options->mld);
+    engine_set_pacing(&engine, options->pace_rate, options->pace_burst);
+    engine_set_adaptive(&engine, options->mrt_target, options->mrt_min, options->mrt_max);
+
+    if (options->backend != NULL) {
+        if (engine_set_backend(&engine, options->backend) != 0) {
+            goto fail;
+        }
     }
 
-    /* Multicast groups */
-    mgroup.s_addr = inet_addr("0.0.0.0");
-    if (mgroup.s_addr == INADDR_NONE) {
-        logger(LOG_LEVEL_ERR, "Invalid multicast group '0.0.0.0'");
+    /* Interfaces matching the patterns are picked up once running */
+    engine_set_discovery(&engine, options->include, options->n_include,
+        options->exclude, options->n_exclude);
+
+    /* Worker threads, each serving its own share of the interfaces */
+    if (engine_set_threads(&engine, options->threads) != 0) {
         goto fail;
     }
-    allhosts.s_addr = inet_addr("224.0.0.1");
-    if (allhosts.s_addr == INADDR_NONE) {
-        logger(LOG_LEVEL_ERR, "Invalid multicast group '224.0.0.1'");
-        goto fail;
+
+    /* Take the sockets of a running instance, or wait for the next one */
+    took_over = 0;
+    if (options->handover_path != NULL) {
+        took_over = engine_set_handover(&engine, options->handover_path);
+        if (took_over < 0) {
+            goto fail;
+        }
+    }
+
+    /* A handed over routing socket came along with the rest */
+    if (!took_over) {
+        engine_set_mrouter(&engine);
+    }
+
+    /* Create sockets, one per interface or a single unbound one,
+     * unless adopted along with their state */
+    if (!took_over &&options->n_ifnames == 0 && options->n_include == 0 &&
+        options->n_trunks == 0) {
+        if (engine_add_iface(&engine, NULL, 0) != 0) {
+            goto fail;
+        }
+    }
+    for (i = 0; i < options->n_ifnames && !took_over; i++) {
+        version = 0;
+        sep = strchr(options->ifnames[i], ',');
+        if (sep != NULL) {
+            *sep++ = '\0';
+            if (parse_number(sep, 1, 3, &version) != 0) {
+                logger(LOG_LEVEL_ERR, "Invalid IGMP version '%s' for interface '%s'",
+                    sep, options->ifnames[i]);
+                goto fail;
+            }
+            if (version == 3 && options->interval > IGMP_CODE_MAX) {
+                logger(LOG_LEVEL_ERR, "IGMPv3 query interval is at most %d seconds, "
+                    "interface '%s' asks for IGMPv3", IGMP_CODE_MAX, options->ifnames[i]);
+                goto fail;
+            }
+        }
+        if (engine_add_iface(&engine, options->ifnames[i], version) != 0) {
+            goto fail;
+        }
+    }
+    for (i = 0; i < options->n_trunks && !took_over; i++) {
+        sep = strchr(options->trunks[i], ':');
+        if (sep != NULL) {
+            *sep++ = '\0';
+        }
+        if (sep == NULL || parse_vlans(sep, vlans, &n_vlans) != 0) {
+            logger(LOG_LEVEL_ERR, "Invalid VLAN list for trunk interface '%s'",
+                options->trunks[i]);
+            goto fail;
+        }
+        if (engine_add_trunk(&engine, options->trunks[i], vlans, n_vlans) != 0) {
+            goto fail;
+        }
     }
 
-    /* IGMPv1 query */
-    igmp.igmp_type = IGMP_MEMBERSHIP_QUERY;
-    igmp.igmp_code = 0;
-    igmp.igmp_cksum = 0;
-    igmp.igmp_group = mgroup;
-    igmp.igmp_cksum = cksum(&igmp, sizeof(igmp));
+    /* Show the generated packet filters only */
+    if (options->dump_filter) {
+        engine_dump_filters(&engine, stdout);
+        engine_close(&engine);
+        free(options->ifnames);
+        free(options->include);
+        free(options->exclude);
+        free(options->trunks);
+        free(options);
+        exit(EXIT_SUCCESS);
+    }
+
+    /* Statistics socket, created while still privileged */
+    if (options->stats_path != NULL) {
+        if (engine_set_stats(&engine, options->stats_path) != 0) {
+            goto fail;
+        }
+    }
 
-    /* Destination */
-    dst.sin_family = AF_INET;
-    dst.sin_port = htons(0);
-    dst.sin_addr = allhosts;
+    /* Membership snapshot, restored as each interface starts */
+    if (options->snapshot_path != NULL) {
+        if (engine_set_snapshot(&engine, options->snapshot_path) != 0) {
+            goto fail;
+        }
+    }
+
+    /* Drop privileges */
+    if (drop_privileges(options->username, options->groupname,
+            options->n_include > 0) != 0) {
+        goto fail;
+    }
 
     /* Daemonize */
     if (options->daemonize) {
@@ -228,18 +561,32 @@ main(int argc, char **argv)
         }
     }
 
+    /* Hand log output over to the writer thread */
+    if (start_logger() != 0) {
+        goto fail;
+    }
+
     /* Transmit loop */
-    while (1) {
-        if (sendto(sockfd, &igmp, sizeof(igmp), 0, (struct sockaddr*)&dst, sizeof(dst)) == -1) {
-            logger(LOG_LEVEL_ERR, "Could not send IGMP query: %s", strerror(errno));
-        }
-        sleep(options->interval);
+    if (engine_run(&engine) != 0) {
+        goto fail;
     }
 
+    engine_close(&engine);
+    close_logger();
+    free(options->ifnames);
+    free(options->include);
+    free(options->exclude);
+    free(options->trunks);
     free(options);
     exit(EXIT_SUCCESS);
 
 fail:
+    engine_close(&engine);
+    close_logger();
+    free(options->ifnames);
+    free(options->include);
+    free(options->exclude);
+    free(options->trunks);
     free(options);
     exit(EXIT_FAILURE);
 }
@@ -23,52 +23,267 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "logging.h"
 
+/* Preformatted record. The sequence number tells whose turn the slot is:
+ * equal to the ring position when free for a producer, one past it when
+ * filled and ready for the writer. */
+typedef struct log_record {
+    uint64_t    seq;
+    log_level_t level;
+    char        msg[LOG_MSG_SIZE];
+} log_record_t;
+
 static int use_syslog = 0;
+static int started = 0;
+static int stopping = 0;
+static int waiting = 0;
+static int wakefd = -1;
+static pthread_t writer;
+
+static log_record_t ring[LOG_RING_SIZE];
+static uint64_t head = 0;               /* Next position to claim */
+static uint64_t tail = 0;               /* Next position to drain, writer only */
+
+static uint64_t suppressed = 0;         /* Since last reported */
+static uint64_t suppressed_total = 0;
+static uint64_t window = 0;             /* Rate limit window, in seconds */
+static uint64_t window_count = 0;
 
 void
 init_logger(int syslog)
 {
+    uint64_t i;
+
+    for (i = 0; i < LOG_RING_SIZE; i++) {
+        ring[i].seq = i;
+    }
+
     if (syslog) {
         use_syslog = syslog;
         openlog("igmpqd", LOG_PID, LOG_DAEMON);
     }
 }
 
-void
-logger(log_level_t level, const char *fmt, ...)
+static void
+output(log_level_t level, const char *msg)
 {
-    va_list args1, args2;
-    int priority;
-    FILE *stream;
-
     switch (level) {
     case LOG_LEVEL_INFO:
-        priority = LOG_INFO;
-        stream = stdout;
+        fprintf(stdout, "%s\n", msg);
+        fflush(stdout);
+        if (use_syslog) {
+            syslog(LOG_INFO, "%s", msg);
+        }
         break;
 
     case LOG_LEVEL_ERR:
-        priority = LOG_ERR;
-        stream = stderr;
-        fprintf(stream, "Error: ");
+        fprintf(stderr, "Error: %s\n", msg);
+        if (use_syslog) {
+            syslog(LOG_ERR, "%s", msg);
+        }
         break;
     }
+}
+
+static void
+drain(void)
+{
+    log_record_t *rec;
+    uint64_t n;
+    char msg[64];
 
-    va_start(args1, fmt);
-    va_copy(args2, args1);
+    for (;;) {
+        rec = &ring[tail & (LOG_RING_SIZE - 1)];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            break;
+        }
+        output(rec->level, rec->msg);
+        __atomic_store_n(&rec->seq, tail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        tail++;
+    }
 
-    vfprintf(stream, fmt, args1);
-    fprintf(stream, "\n");
-    if (use_syslog) {
-        vsyslog(priority, fmt, args2);
+    n = __atomic_exchange_n(&suppressed, 0, __ATOMIC_RELAXED);
+    if (n > 0) {
+        snprintf(msg, sizeof(msg), "%llu messages suppressed", (unsigned long long)n);
+        output(LOG_LEVEL_ERR, msg);
     }
+}
+
+static int
+ring_empty(void)
+{
+    log_record_t *rec = &ring[tail & (LOG_RING_SIZE - 1)];
+
+    return __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != tail + 1 &&
+        __atomic_load_n(&suppressed, __ATOMIC_RELAXED) == 0;
+}
+
+static void *
+writer_main(void *arg)
+{
+    uint64_t value;
+
+    for (;;) {
+        drain();
+        if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        /* Announce the nap before the last look at the ring, producers
+         * publish before looking at the flag, so one of us sees the other */
+        __atomic_store_n(&waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!ring_empty()) {
+            __atomic_store_n(&waiting, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (read(wakefd, &value, sizeof(value)) < 0 && errno != EINTR) {
+            break;
+        }
+    }
+
+    drain();
+    return NULL;
+}
+
+int
+start_logger(void)
+{
+    int err;
+
+    /* Must run after daemonize(), threads do not survive fork() */
+    wakefd = eventfd(0, EFD_CLOEXEC);
+    if (wakefd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not create logging event: %s", strerror(errno));
+        return -1;
+    }
+
+    err = pthread_create(&writer, NULL, writer_main, NULL);
+    if (err != 0) {
+        logger(LOG_LEVEL_ERR, "Could not start logging thread: %s", strerror(err));
+        close(wakefd);
+        wakefd = -1;
+        return -1;
+    }
+    __atomic_store_n(&started, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
 
-    va_end(args1);
-    va_end(args2);
+void
+close_logger(void)
+{
+    uint64_t value = 1;
+
+    if (!started) {
+        return;
+    }
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    if (write(wakefd, &value, sizeof(value)) < 0) {
+        /* Writer stays parked, nothing more to do about it */
+    }
+    pthread_join(writer, NULL);
+    started = 0;
+    close(wakefd);
+    wakefd = -1;
+}
+
+uint64_t
+logger_suppressed(void)
+{
+    return __atomic_load_n(&suppressed_total, __ATOMIC_RELAXED);
+}
+
+static void
+suppress(void)
+{
+    __atomic_fetch_add(&suppressed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&suppressed_total, 1, __ATOMIC_RELAXED);
+}
+
+/* Fixed window limit, a burst at a window edge may get twice the rate */
+static int
+rate_limited(void)
+{
+    struct timespec ts;
+    uint64_t now, cur;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = ts.tv_sec;
+    cur = __atomic_load_n(&window, __ATOMIC_RELAXED);
+    if (cur != now && __atomic_compare_exchange_n(&window, &cur, now, 0,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&window_count, 0, __ATOMIC_RELAXED);
+    }
+
+    return __atomic_fetch_add(&window_count, 1, __ATOMIC_RELAXED) >= LOG_RATE_LIMIT;
+}
+
+/* Never blocks once the writer runs: the message is formatted once into a
+ * ring slot, or counted as suppressed when the ring is full or the rate
+ * limit is exceeded */
+void
+logger(log_level_t level, const char *fmt, ...)
+{
+    log_record_t *rec;
+    uint64_t pos, seq, value = 1;
+    char msg[LOG_MSG_SIZE];
+    va_list args;
+
+    if (!__atomic_load_n(&started, __ATOMIC_ACQUIRE)) {
+        /* Still in the foreground, write straight through */
+        va_start(args, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, args);
+        va_end(args);
+        output(level, msg);
+        return;
+    }
+
+    if (rate_limited()) {
+        suppress();
+        return;
+    }
+
+    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    for (;;) {
+        rec = &ring[pos & (LOG_RING_SIZE - 1)];
+        seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, 1,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if ((int64_t)(seq - pos) < 0) {
+            suppress();
+            return;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->level = level;
+    va_start(args, fmt);
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+    va_end(args);
+    __atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&waiting, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&waiting, 0, __ATOMIC_RELAXED)) {
+        if (write(wakefd, &value, sizeof(value)) < 0) {
+            /* Counter saturated, the writer is awake anyway */
+        }
+    }
 }
@@ -26,6 +26,12 @@
 #ifndef __LOGGING_H__
 #define __LOGGING_H__
 
+#include <stdint.h>
+
+#define LOG_RING_SIZE  256     /* Records, a power of two */
+#define LOG_MSG_SIZE   240
+#define LOG_RATE_LIMIT 100     /* Records per second */
+
 typedef enum log_level {
         LOG_LEVEL_ERR,
         LOG_LEVEL_INFO,
@@ -33,6 +39,13 @@ typedef enum log_level {
 
 void init_logger(int use_syslog);
 
-void logger(log_level_t level, const char *fmt, ...);
+int start_logger(void);
+
+void close_logger(void);
+
+uint64_t logger_suppressed(void);
+
+void logger(log_level_t level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
 
 #endif /* __LOGGING_H__ */
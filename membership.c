@@ -0,0 +1,392 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "membership.h"
+
+/* At most three quarters of the slots are ever in use */
+#define LOAD_LIMIT(mask) (((mask) + 1) / 4 * 3)
+
+static inline size_t
+hash(uint32_t ifindex, struct in_addr addr)
+{
+    uint64_t k = ((uint64_t)ifindex << 32) | addr.s_addr;
+
+    /* 64-bit finalizer from MurmurHash3 */
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+
+    return (size_t)k;
+}
+
+/* Logs when the cap is first hit, and again after memory was freed */
+static void
+refuse(membership_t *table)
+{
+    table->refused++;
+    if (!table->full) {
+        table->full = 1;
+        logger(LOG_LEVEL_ERR, "Membership memory cap of %zu bytes reached, refusing new state",
+            table->arena.size);
+    }
+}
+
+static source_t *
+alloc_sources(membership_t *table, int class)
+{
+    source_t *block;
+    int c;
+
+    block = pool_get(&table->sources[class]);
+    if (block != NULL) {
+        return block;
+    }
+
+    /* Arena used up, break up a larger free block instead */
+    for (c = class + 1; c < SOURCES_CLASSES && table->sources[c].free == NULL; c++);
+    if (c == SOURCES_CLASSES) {
+        return NULL;
+    }
+    block = pool_get(&table->sources[c]);
+    while (c > class) {
+        c--;
+        pool_put(&table->sources[c], block + (SOURCES_MIN << c));
+    }
+
+    return block;
+}
+
+static void
+free_sources(membership_t *table, group_t *group)
+{
+    int class = 0;
+
+    if (group->sources == NULL) {
+        return;
+    }
+    while ((SOURCES_MIN << class) < group->max_sources) {
+        class++;
+    }
+    pool_put(&table->sources[class], group->sources);
+    group->sources = NULL;
+    group->max_sources = 0;
+    table->full = 0;
+}
+
+int
+membership_init(membership_t *table, size_t memory, wheel_cb_t expire_cb,
+    wheel_cb_t lmq_cb, wheel_cb_t src_cb, void *arg)
+{
+    size_t size = 16;
+    int i;
+
+    memset(table, 0, sizeof(*table));
+    table->expire_cb = expire_cb;
+    table->lmq_cb = lmq_cb;
+    table->src_cb = src_cb;
+    table->expire_arg = arg;
+
+    if (arena_init(&table->arena, memory) != 0) {
+        return -1;
+    }
+
+    /* The index never grows, so size it for as many groups as could fit */
+    while (LOAD_LIMIT(size - 1) < memory / sizeof(group_t)) {
+        size <<= 1;
+    }
+    table->slots = arena_alloc(&table->arena, size * sizeof(membership_slot_t));
+    if (table->slots == NULL) {
+        logger(LOG_LEVEL_ERR, "Membership memory cap of %zu bytes is too small", memory);
+        arena_free(&table->arena);
+        return -1;
+    }
+    table->mask = size - 1;
+
+    pool_init(&table->groups, &table->arena, sizeof(group_t));
+    for (i = 0; i < SOURCES_CLASSES; i++) {
+        pool_init(&table->sources[i], &table->arena, (SOURCES_MIN << i) * sizeof(source_t));
+    }
+
+    return 0;
+}
+
+void
+membership_free(membership_t *table)
+{
+    arena_free(&table->arena);
+    table->slots = NULL;
+    table->mask = 0;
+    table->count = 0;
+}
+
+static membership_slot_t *
+find_slot(membership_t *table, uint32_t ifindex, struct in_addr addr,
+    const struct in6_addr *addr6)
+{
+    membership_slot_t *slot;
+    size_t i;
+
+    /* Only folded keys need a look at the record to be told apart */
+    for (i = hash(ifindex, addr) & table->mask; ; i = (i + 1) & table->mask) {
+        slot = &table->slots[i];
+        if (slot->addr.s_addr == INADDR_ANY ||
+            (slot->addr.s_addr == addr.s_addr && slot->ifindex == ifindex &&
+             (addr6 == NULL || IN6_ARE_ADDR_EQUAL(&slot->group->addr6, addr6)))) {
+            return slot;
+        }
+    }
+}
+
+static group_t *
+insert(membership_t *table, uint32_t ifindex, struct in_addr addr,
+    const struct in6_addr *addr6)
+{
+    membership_slot_t *slot;
+    group_t *group;
+
+    slot = find_slot(table, ifindex, addr, addr6);
+    if (slot->group != NULL) {
+        return slot->group;
+    }
+
+    if (table->count + 1 > LOAD_LIMIT(table->mask)) {
+        refuse(table);
+        return NULL;
+    }
+
+    /* Existing memberships are never evicted for new ones */
+    group = pool_get(&table->groups);
+    if (group == NULL) {
+        refuse(table);
+        return NULL;
+    }
+
+    memset(group, 0, sizeof(*group));
+    group->addr = addr;
+    group->ifindex = ifindex;
+    group->iface = NULL;
+    if (addr6 != NULL) {
+        group->addr6 = *addr6;
+    }
+    wheel_timer_init(&group->timer, table->expire_cb, table->expire_arg);
+    wheel_timer_init(&group->lmq_timer, table->lmq_cb, table->expire_arg);
+    wheel_timer_init(&group->src_timer, table->src_cb, table->expire_arg);
+
+    slot->addr = addr;
+    slot->ifindex = ifindex;
+    slot->group = group;
+    table->count++;
+
+    return group;
+}
+
+group_t *
+membership_lookup(membership_t *table, uint32_t ifindex, struct in_addr addr)
+{
+    return find_slot(table, ifindex, addr, NULL)->group;
+}
+
+group_t *
+membership_insert(membership_t *table, uint32_t ifindex, struct in_addr addr)
+{
+    return insert(table, ifindex, addr, NULL);
+}
+
+struct in_addr
+membership_fold6(const struct in6_addr *addr)
+{
+    struct in_addr key;
+    uint32_t words[4];
+    uint64_t k;
+
+    memcpy(words, addr, sizeof(words));
+    k = ((uint64_t)(words[0] ^ words[2]) << 32) | (words[1] ^ words[3]);
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    key.s_addr = htonl(0xF0000000 | (k & 0x0FFFFFFF));
+
+    return key;
+}
+
+group_t *
+membership_lookup6(membership_t *table, uint32_t ifindex, const struct in6_addr *addr)
+{
+    return find_slot(table, ifindex, membership_fold6(addr), addr)->group;
+}
+
+group_t *
+membership_insert6(membership_t *table, uint32_t ifindex, const struct in6_addr *addr)
+{
+    return insert(table, ifindex, membership_fold6(addr), addr);
+}
+
+void
+membership_remove(membership_t *table, group_t *group)
+{
+    membership_slot_t *slot;
+    size_t i, j, home;
+
+    slot = find_slot(table, group->ifindex, group->addr,
+        MEMBERSHIP_IS_V6(group->addr) ? &group->addr6 : NULL);
+    if (slot->group != group) {
+        return;
+    }
+
+    /* Backward shift deletion, keeps probe sequences intact without tombstones */
+    i = slot - table->slots;
+    for (j = (i + 1) & table->mask; table->slots[j].addr.s_addr != INADDR_ANY;
+         j = (j + 1) & table->mask) {
+        home = hash(table->slots[j].ifindex, table->slots[j].addr) & table->mask;
+        /* Move j into the hole at i unless its home slot lies cyclically in (i, j] */
+        if (((j - home) & table->mask) >= ((j - i) & table->mask)) {
+            table->slots[i] = table->slots[j];
+            i = j;
+        }
+    }
+    memset(&table->slots[i], 0, sizeof(membership_slot_t));
+    table->count--;
+
+    free_sources(table, group);
+    pool_put(&table->groups, group);
+    table->full = 0;
+}
+
+/* Replaces the source list of a group, moving it to the size class that
+ * fits. On refusal the group keeps its current list. */
+int
+membership_set_sources(membership_t *table, group_t *group, const source_t *src, size_t n)
+{
+    source_t *block;
+    int class = 0;
+
+    while ((SOURCES_MIN << class) < n) {
+        class++;
+    }
+
+    /* Shrink only once a quarter full, so lists near a boundary do not bounce */
+    if (n > 0 && (n > group->max_sources ||
+            (group->max_sources > SOURCES_MIN && n <= group->max_sources / 4))) {
+        if (class >= SOURCES_CLASSES) {
+            refuse(table);
+            return -1;
+        }
+        block = alloc_sources(table, class);
+        if (block == NULL) {
+            refuse(table);
+            return -1;
+        }
+        free_sources(table, group);
+        group->sources = block;
+        group->max_sources = SOURCES_MIN << class;
+    }
+
+    memcpy(group->sources, src, n * sizeof(*src));
+
+    return 0;
+}
+
+/* Forgets members not heard from within the timeout */
+static void
+prune_hosts(group_t *group, uint32_t now, uint32_t timeout)
+{
+    int i = 0;
+
+    while (i < group->n_hosts) {
+        if (now - group->host_seen[i] > timeout) {
+            group->n_hosts--;
+            group->hosts[i] = group->hosts[group->n_hosts];
+            group->host_seen[i] = group->host_seen[group->n_hosts];
+        } else {
+            i++;
+        }
+    }
+}
+
+void
+group_track(group_t *group, struct in_addr host, uint32_t now, uint32_t timeout)
+{
+    int i;
+
+    for (i = 0; i < group->n_hosts; i++) {
+        if (group->hosts[i].s_addr == host.s_addr) {
+            group->host_seen[i] = now;
+            return;
+        }
+    }
+
+    prune_hosts(group, now, timeout);
+    if (group->n_hosts == GROUP_HOSTS) {
+        group->untracked = 1;
+        return;
+    }
+    group->hosts[group->n_hosts] = host;
+    group->host_seen[group->n_hosts] = now;
+    group->n_hosts++;
+}
+
+/* Returns the number of members left, or -1 if that is not known */
+int
+group_untrack(group_t *group, struct in_addr host, uint32_t now, uint32_t timeout)
+{
+    int i;
+
+    for (i = 0; i < group->n_hosts; i++) {
+        if (group->hosts[i].s_addr == host.s_addr) {
+            group->n_hosts--;
+            group->hosts[i] = group->hosts[group->n_hosts];
+            group->host_seen[i] = group->host_seen[group->n_hosts];
+            break;
+        }
+    }
+    prune_hosts(group, now, timeout);
+
+    return (group->untracked ? -1 : group->n_hosts);
+}
+
+/* Removes every group the callback matches. Backward shifts only move
+ * records into the slot just emptied or later, so rechecking that slot
+ * before moving on visits each record at least once. */
+void
+membership_purge(membership_t *table, int (*match)(group_t *group, void *arg), void *arg)
+{
+    size_t i = 0;
+    group_t *group;
+
+    while (i <= table->mask) {
+        group = table->slots[i].group;
+        if (table->slots[i].addr.s_addr != INADDR_ANY && match(group, arg)) {
+            membership_remove(table, group);
+            continue;
+        }
+        i++;
+    }
+}
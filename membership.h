@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MEMBERSHIP_H__
+#define __MEMBERSHIP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "pool.h"
+#include "sources.h"
+#include "wheel.h"
+
+#define GROUP_HOSTS 4           /* Members tracked per group for fast leave */
+
+/* Source arrays come in power of two size classes, SOURCES_MIN up to SOURCES_MAX */
+#define SOURCES_MIN     4
+#define SOURCES_CLASSES 9
+
+/* IPv6 groups are indexed by a fold of their address into 240.0.0.0/4,
+ * where no IPv4 group lives, and told apart by the full address */
+#define MEMBERSHIP_IS_V6(addr) ((ntohl((addr).s_addr) >> 28) == 0xF)
+
+struct iface;
+
+/* Group address of either family */
+typedef union group_addr {
+    struct in_addr  v4;
+    struct in6_addr v6;
+} group_addr_t;
+
+typedef struct group {
+    struct in_addr addr;      /* Index key */
+    uint32_t       ifindex;
+    struct in_addr reporter;
+    uint8_t        version;   /* IGMP version of the last report */
+    struct iface  *iface;     /* Receiving interface, NULL until reported */
+    wheel_timer_t  timer;     /* Group Membership Interval */
+    wheel_timer_t  lmq_timer; /* Last member queries */
+    uint8_t        lmq_left;
+    uint8_t        paced;     /* PACE_* queries waiting in the pacer */
+    uint32_t       snap;      /* Snapshot record, 0 if none */
+    uint8_t        n_hosts;   /* Explicitly tracked members */
+    uint8_t        untracked; /* More members than could be tracked */
+    struct in_addr hosts[GROUP_HOSTS];
+    uint32_t       host_seen[GROUP_HOSTS]; /* Seconds */
+    uint8_t        mode;      /* SOURCES_INCLUDE or SOURCES_EXCLUDE */
+    uint16_t       n_sources;
+    uint16_t       max_sources;
+    source_t      *sources;   /* Sorted by address */
+    wheel_timer_t  src_timer; /* Earliest source timer */
+    struct in6_addr addr6;    /* IPv6 groups only */
+} group_t;
+
+#define group_of_timer(t) ((group_t*)((char*)(t) - offsetof(group_t, timer)))
+#define group_of_lmq_timer(t) ((group_t*)((char*)(t) - offsetof(group_t, lmq_timer)))
+#define group_of_src_timer(t) ((group_t*)((char*)(t) - offsetof(group_t, src_timer)))
+
+/* Index slot, a zero group address marks an empty slot. Keys are kept
+ * inline so probing never touches the group records themselves, short
+ * of a matching IPv6 key. */
+typedef struct membership_slot {
+    struct in_addr addr;
+    uint32_t       ifindex;
+    group_t       *group;
+} membership_slot_t;
+
+/* Open addressing hash table with linear probing, keyed by (ifindex, group).
+ * The index, group records and source arrays all live in one arena of
+ * fixed size, past which new state is refused. */
+typedef struct membership {
+    membership_slot_t *slots;
+    size_t             mask;
+    size_t             count;
+    arena_t            arena;
+    pool_t             groups;
+    pool_t             sources[SOURCES_CLASSES];
+    uint64_t           refused;     /* Records refused for want of memory */
+    int                full;
+    wheel_cb_t         expire_cb;
+    wheel_cb_t         lmq_cb;
+    wheel_cb_t         src_cb;
+    void              *expire_arg;
+} membership_t;
+
+int membership_init(membership_t *table, size_t memory, wheel_cb_t expire_cb,
+    wheel_cb_t lmq_cb, wheel_cb_t src_cb, void *arg);
+
+void membership_free(membership_t *table);
+
+group_t *membership_lookup(membership_t *table, uint32_t ifindex, struct in_addr addr);
+
+group_t *membership_insert(membership_t *table, uint32_t ifindex, struct in_addr addr);
+
+struct in_addr membership_fold6(const struct in6_addr *addr);
+
+group_t *membership_lookup6(membership_t *table, uint32_t ifindex, const struct in6_addr *addr);
+
+group_t *membership_insert6(membership_t *table, uint32_t ifindex, const struct in6_addr *addr);
+
+void membership_remove(membership_t *table, group_t *group);
+
+int membership_set_sources(membership_t *table, group_t *group, const source_t *src, size_t n);
+
+void group_track(group_t *group, struct in_addr host, uint32_t now, uint32_t timeout);
+
+int group_untrack(group_t *group, struct in_addr host, uint32_t now, uint32_t timeout);
+
+void membership_purge(membership_t *table, int (*match)(group_t *group, void *arg), void *arg);
+
+#endif /* __MEMBERSHIP_H__ */
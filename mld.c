@@ -0,0 +1,316 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+#include <linux/mroute6.h>
+#include <sys/socket.h>
+
+#include "logging.h"
+#include "mld.h"
+
+#define MLD_V2_REPORT_HDRLEN 8
+#define MLD_V2_RECORD_HDRLEN 20
+
+/* Largest value representable in a Maximum Response Code */
+#define MLD_CODE_MAX (0x1FFF << 10)
+
+const struct in6_addr mld_all_nodes = {
+    { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 } }
+};
+
+/* Sum of the pseudo-header (RFC 8200, section 8.1) and the message */
+static uint32_t
+pseudo_sum(const uint8_t *addrs, const uint8_t *data, size_t len)
+{
+    uint32_t tail[2];
+
+    tail[0] = htonl(len);
+    tail[1] = htonl(IPPROTO_ICMPV6);
+
+    return cksum_partial(data, len, cksum_partial(tail, sizeof(tail),
+        cksum_partial(addrs, 32, 0)));
+}
+
+uint16_t
+mld_encode_code(unsigned value)
+{
+    unsigned exp;
+
+    /* Floating point format of RFC 3810, section 5.1.3, rounding down */
+    if (value < 32768) {
+        return value;
+    }
+    if (value > MLD_CODE_MAX) {
+        return 0xFFFF;
+    }
+    for (exp = 0; (value >> (exp + 3)) > 0x1FFF; exp++);
+
+    return 0x8000 | (exp << 12) | ((value >> (exp + 3)) & 0x0FFF);
+}
+
+unsigned
+mld_decode_code(uint16_t code)
+{
+    if (code < 32768) {
+        return code;
+    }
+
+    return ((code & 0x0FFF) | 0x1000) << (((code >> 12) & 0x07) + 3);
+}
+
+/* Max Response Time as carried in queries, tenths of a second */
+unsigned
+mld_max_resp(const igmp_params_t *params)
+{
+    if (params->version < 3) {
+        return (params->max_resp > MLD_V1_MAX_RESP ? MLD_V1_MAX_RESP : params->max_resp);
+    }
+
+    return mld_decode_code(mld_encode_code(params->max_resp * 100)) / 100;
+}
+
+void
+mld_template_init(mld_template_t *tpl, const igmp_params_t *params,
+    const struct in6_addr *src, int specific)
+{
+    uint8_t *ip6 = tpl->data, *mld = tpl->data + MLD_HDRLEN;
+    unsigned ms;
+    size_t len;
+    uint16_t code, ck;
+
+    memset(tpl->data, 0, sizeof(tpl->data));
+    len = (params->version >= 3 ? MLD_V2_QUERY_MINLEN : MLD_V1_QUERY_LEN);
+
+    /* Link-local source, hop limit 1, to all nodes unless patched per group */
+    ip6[0] = 0x60;
+    ip6[4] = (8 + len) >> 8;
+    ip6[5] = (8 + len) & 0xFF;
+    ip6[6] = IPPROTO_HOPOPTS;
+    ip6[7] = 1;
+    memcpy(ip6 + 8, src, sizeof(*src));
+    if (!specific) {
+        memcpy(ip6 + 24, &mld_all_nodes, sizeof(mld_all_nodes));
+    }
+
+    /* Router Alert for MLD (RFC 2711), padded out with a PadN option */
+    ip6[40] = IPPROTO_ICMPV6;
+    ip6[42] = 0x05;
+    ip6[43] = 2;
+    ip6[46] = 0x01;
+
+    /* Group-specific queries use the Last Member Query Interval */
+    ms = (specific ? params->lmqi : params->max_resp) * 100;
+    if (params->version >= 3) {
+        code = htons(mld_encode_code(ms));
+        /* Resv, S flag and QRV, then QQIC and an empty source list */
+        mld[24] = (params->robustness <= IGMP_QRV_MAX ? params->robustness : 0);
+        mld[25] = igmp_encode_code(params->interval);
+    } else {
+        code = htons(ms > 0xFFFF ? 0xFFFF : ms);
+    }
+    mld[0] = MLD_LISTENER_QUERY;
+    memcpy(mld + 4, &code, sizeof(code));
+
+    ck = cksum_finish(pseudo_sum(ip6 + 8, mld, len));
+    memcpy(mld + 2, &ck, sizeof(ck));
+    tpl->len = MLD_HDRLEN + len;
+}
+
+size_t
+mld_template_build(const mld_template_t *tpl, uint8_t *buf, const struct in6_addr *group)
+{
+    uint8_t *mld = buf + MLD_HDRLEN;
+    uint16_t ck;
+
+    memcpy(buf, tpl->data, tpl->len);
+    memcpy(&ck, mld + 2, sizeof(ck));
+
+    /* The group is both the destination and the queried address, each
+     * a word by word update of the precomputed checksum */
+    memcpy(buf + 24, group, sizeof(*group));
+    ck = cksum_update(ck, tpl->data + 24, buf + 24, sizeof(*group));
+    memcpy(mld + 8, group, sizeof(*group));
+    ck = cksum_update(ck, tpl->data + MLD_HDRLEN + 8, mld + 8, sizeof(*group));
+    memcpy(mld + 2, &ck, sizeof(ck));
+
+    return tpl->len;
+}
+
+int
+mld_parse(const uint8_t *buf, size_t len, mld_msg_t *msg)
+{
+    const struct ip6_hdr *ip6 = (const struct ip6_hdr*)buf;
+    size_t off = sizeof(*ip6);
+    uint16_t code;
+    uint8_t next;
+
+    if (len < sizeof(*ip6) || (buf[0] >> 4) != 6 ||
+        sizeof(*ip6) + ntohs(ip6->ip6_plen) > len) {
+        return -1;
+    }
+    len = sizeof(*ip6) + ntohs(ip6->ip6_plen);
+
+    /* MLD messages never cross a router (RFC 3810, section 5) */
+    if (ip6->ip6_hlim != 1) {
+        return -1;
+    }
+
+    /* The Hop-by-Hop header is only there on packets seen whole */
+    next = ip6->ip6_nxt;
+    if (next == IPPROTO_HOPOPTS) {
+        if (off + 8 > len) {
+            return -1;
+        }
+        next = buf[off];
+        off += (buf[off + 1] + 1) * 8;
+    }
+    if (next != IPPROTO_ICMPV6 || off + MLD_V2_REPORT_HDRLEN > len) {
+        return -1;
+    }
+
+    msg->data = buf + off;
+    msg->len = len - off;
+    if (cksum_finish(pseudo_sum(buf + 8, msg->data, msg->len)) != 0) {
+        return -1;
+    }
+
+    memcpy(&msg->src, &ip6->ip6_src, sizeof(msg->src));
+    memcpy(&msg->dst, &ip6->ip6_dst, sizeof(msg->dst));
+    msg->type = msg->data[0];
+    msg->max_resp = 0;
+    msg->suppress = 0;
+    msg->n_records = 0;
+    memset(&msg->group, 0, sizeof(msg->group));
+
+    /* Only reports sent while the address is tentative may come from
+     * the unspecified address, everything else is link-local */
+    if (!IN6_IS_ADDR_LINKLOCAL(&msg->src) &&
+        !(msg->type == MLD_V2_LISTENER_REPORT && IN6_IS_ADDR_UNSPECIFIED(&msg->src))) {
+        return -1;
+    }
+
+    switch (msg->type) {
+    case MLD_LISTENER_QUERY:
+        if (msg->len >= MLD_V2_QUERY_MINLEN) {
+            memcpy(&code, msg->data + 4, sizeof(code));
+            msg->max_resp = mld_decode_code(ntohs(code));
+            msg->suppress = (msg->data[24] & 0x08) != 0;
+        } else if (msg->len == MLD_V1_QUERY_LEN) {
+            msg->max_resp = (msg->data[4] << 8) | msg->data[5];
+        } else {
+            return -1;
+        }
+        memcpy(&msg->group, msg->data + 8, sizeof(msg->group));
+        break;
+
+    case MLD_LISTENER_REPORT:
+    case MLD_LISTENER_REDUCTION:
+        if (msg->len < MLD_V1_QUERY_LEN) {
+            return -1;
+        }
+        memcpy(&msg->group, msg->data + 8, sizeof(msg->group));
+        break;
+
+    case MLD_V2_LISTENER_REPORT:
+        msg->n_records = (msg->data[6] << 8) | msg->data[7];
+        break;
+
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+mld_next_record(const mld_msg_t *msg, size_t *offset, mld_record_t *rec)
+{
+    const uint8_t *p;
+    size_t reclen;
+
+    if (*offset == 0) {
+        *offset = MLD_V2_REPORT_HDRLEN;
+    }
+    if (*offset + MLD_V2_RECORD_HDRLEN > msg->len) {
+        return -1;
+    }
+
+    p = msg->data + *offset;
+    rec->type = p[0];
+    rec->n_sources = (p[2] << 8) | p[3];
+    memcpy(&rec->group, p + 4, sizeof(rec->group));
+    rec->sources = p + MLD_V2_RECORD_HDRLEN;
+
+    /* Auxiliary data length is given in 32-bit words */
+    reclen = MLD_V2_RECORD_HDRLEN + rec->n_sources * 16 + p[1] * 4;
+    if (*offset + reclen > msg->len) {
+        return -1;
+    }
+    *offset += reclen;
+
+    return 0;
+}
+
+/* The stack only passes MLDv1 reports to a raw socket for groups the
+ * host joined itself, unless a multicast router socket is open in the
+ * namespace. This one takes no messages of its own and adds no
+ * interfaces, so nothing is forwarded. */
+int
+mld_mrouter_open(void)
+{
+    struct icmp6_filter filter;
+    int fd, on = 1;
+
+    fd = socket(AF_INET6, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMPV6);
+    if (fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not open ICMPv6 socket: %s", strerror(errno));
+        return -1;
+    }
+
+    ICMP6_FILTER_SETBLOCKALL(&filter);
+    if (setsockopt(fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not set ICMPv6 filter: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (setsockopt(fd, IPPROTO_IPV6, MRT6_INIT, &on, sizeof(on)) < 0) {
+        if (errno == EADDRINUSE) {
+            logger(LOG_LEVEL_INFO, "Multicast routing already active, MLD reports pass through");
+        } else {
+            logger(LOG_LEVEL_INFO, "Could not enable multicast routing, MLDv1 reports are only "
+                "seen for groups joined locally: %s", strerror(errno));
+        }
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
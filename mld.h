@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MLD_H__
+#define __MLD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+
+#include "igmp.h"
+
+#ifndef MLD_V2_LISTENER_REPORT
+#define MLD_V2_LISTENER_REPORT 143
+#endif
+
+#define MLD_V1_QUERY_LEN    24
+#define MLD_V2_QUERY_MINLEN 28
+
+/* IPv6 header and a Hop-by-Hop header carrying Router Alert */
+#define MLD_HDRLEN (40 + 8)
+
+/* Whole query packet, as sent on the header including socket */
+#define MLD_TEMPLATE_MAXLEN (MLD_HDRLEN + MLD_V2_QUERY_MINLEN)
+
+/* Largest Maximum Response Delay of MLDv1, tenths of a second */
+#define MLD_V1_MAX_RESP 655
+
+/* MLDv1 and MLDv2 run as versions 2 and 3 of the querier, the IGMP
+ * versions they map to (RFC 3810, section 8) */
+#define MLD_VERSION(version) ((version) - 1)
+
+/* Link-local and smaller scopes are never reported or tracked */
+#define MLD_IS_LOCAL_GROUP(addr) (((addr)->s6_addr[1] & 0x0F) <= 2)
+
+/* Prebuilt query packet, IPv6 header included. The ICMPv6 checksum is
+ * complete over the pseudo-header, so group-specific queries only patch
+ * in the group address where it appears. */
+typedef struct mld_template {
+    uint8_t data[MLD_TEMPLATE_MAXLEN];
+    size_t  len;
+} mld_template_t;
+
+/* Parsed MLD message, pointing into the receive buffer */
+typedef struct mld_msg {
+    uint8_t          type;
+    struct in6_addr  src;
+    struct in6_addr  dst;
+    struct in6_addr  group;
+    unsigned         max_resp;      /* Queries, milliseconds */
+    int              suppress;      /* Queries, S flag */
+    const uint8_t   *data;
+    size_t           len;
+    uint16_t         n_records;
+} mld_msg_t;
+
+/* MLDv2 multicast address record */
+typedef struct mld_record {
+    uint8_t          type;
+    uint16_t         n_sources;
+    struct in6_addr  group;
+    const uint8_t   *sources;
+} mld_record_t;
+
+extern const struct in6_addr mld_all_nodes;
+
+uint16_t mld_encode_code(unsigned value);
+
+unsigned mld_decode_code(uint16_t code);
+
+unsigned mld_max_resp(const igmp_params_t *params);
+
+void mld_template_init(mld_template_t *tpl, const igmp_params_t *params,
+    const struct in6_addr *src, int specific);
+
+size_t mld_template_build(const mld_template_t *tpl, uint8_t *buf, const struct in6_addr *group);
+
+int mld_parse(const uint8_t *buf, size_t len, mld_msg_t *msg);
+
+int mld_next_record(const mld_msg_t *msg, size_t *offset, mld_record_t *rec);
+
+int mld_mrouter_open(void);
+
+#endif /* __MLD_H__ */
@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "logging.h"
+#include "netlink.h"
+
+int
+netlink_open(netlink_t *nl)
+{
+    struct sockaddr_nl snl;
+
+    nl->seq = 0;
+    nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl->fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not open netlink socket: %s", strerror(errno));
+        return -1;
+    }
+
+    memset(&snl, 0, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+    snl.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (bind(nl->fd, (struct sockaddr*)&snl, sizeof(snl)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not subscribe to netlink events: %s", strerror(errno));
+        close(nl->fd);
+        nl->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+netlink_dump_links(netlink_t *nl)
+{
+    struct {
+        struct nlmsghdr  hdr;
+        struct ifinfomsg ifi;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+    req.hdr.nlmsg_type = RTM_GETLINK;
+    req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.hdr.nlmsg_seq = ++nl->seq;
+    req.ifi.ifi_family = AF_UNSPEC;
+
+    if (send(nl->fd, &req, req.hdr.nlmsg_len, 0) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not request interface list: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+parse_link(struct nlmsghdr *hdr, netlink_cb_t cb, void *arg)
+{
+    struct ifinfomsg *ifi = NLMSG_DATA(hdr);
+    struct rtattr *rta;
+    char name[IF_NAMESIZE] = "";
+    int len;
+
+    len = IFLA_PAYLOAD(hdr);
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME) {
+            snprintf(name, sizeof(name), "%s", (char*)RTA_DATA(rta));
+        }
+    }
+
+    cb(hdr->nlmsg_type == RTM_DELLINK ? NETLINK_UNLINK : NETLINK_LINK,
+        ifi->ifi_index, name, ifi->ifi_flags, arg);
+}
+
+int
+netlink_recv(netlink_t *nl, netlink_cb_t cb, void *arg)
+{
+    uint8_t buf[NETLINK_BUFSIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct nlmsghdr *hdr;
+    struct ifaddrmsg *ifa;
+    ssize_t len;
+
+    for (;;) {
+        len = recv(nl->fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == ENOBUFS) {
+                /* Receive queue overrun, some events are gone for good */
+                cb(NETLINK_RESYNC, 0, NULL, 0, arg);
+                continue;
+            }
+            return -1;
+        }
+
+        for (hdr = (struct nlmsghdr*)buf; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len)) {
+            switch (hdr->nlmsg_type) {
+            case RTM_NEWLINK:
+            case RTM_DELLINK:
+                if (hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+                    parse_link(hdr, cb, arg);
+                }
+                break;
+
+            case RTM_NEWADDR:
+            case RTM_DELADDR:
+                if (hdr->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+                    ifa = NLMSG_DATA(hdr);
+                    cb(NETLINK_ADDR, ifa->ifa_index, NULL, 0, arg);
+                }
+                break;
+
+            default:
+                /* NLMSG_DONE and errors of the dump request */
+                break;
+            }
+        }
+    }
+}
+
+void
+netlink_close(netlink_t *nl)
+{
+    if (nl->fd >= 0) {
+        close(nl->fd);
+        nl->fd = -1;
+    }
+}
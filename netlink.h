@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __NETLINK_H__
+#define __NETLINK_H__
+
+#include <stdint.h>
+
+#define NETLINK_BUFSIZE 16384
+
+typedef enum netlink_event {
+        NETLINK_RESYNC,         /* Events were lost, state must be rechecked */
+        NETLINK_LINK,           /* Link added or changed */
+        NETLINK_UNLINK,         /* Link removed */
+        NETLINK_ADDR,           /* IPv4 address added or removed */
+} netlink_event_t;
+
+typedef void (*netlink_cb_t)(netlink_event_t event, unsigned ifindex,
+    const char *name, unsigned flags, void *arg);
+
+/* Route netlink listener for link and IPv4 address changes */
+typedef struct netlink {
+    int      fd;
+    uint32_t seq;
+} netlink_t;
+
+int netlink_open(netlink_t *nl);
+
+int netlink_dump_links(netlink_t *nl);
+
+int netlink_recv(netlink_t *nl, netlink_cb_t cb, void *arg);
+
+void netlink_close(netlink_t *nl);
+
+#endif /* __NETLINK_H__ */
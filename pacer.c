@@ -0,0 +1,150 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "pacer.h"
+
+#define TOKEN 1000000
+
+int
+pacer_init(pacer_t *pacer, unsigned rate, unsigned burst, uint64_t now)
+{
+    memset(pacer, 0, sizeof(*pacer));
+    if (rate == 0) {
+        return 0;
+    }
+
+    /* The queue comes with the first deferred query, most of thousands
+     * of trunk VLANs never need one */
+    pacer->rate = rate;
+    pacer->burst = (int64_t)(burst > 0 ? burst : 1) * TOKEN;
+    pacer->tokens = pacer->burst;
+    pacer->last = now;
+
+    return 0;
+}
+
+void
+pacer_free(pacer_t *pacer)
+{
+    free(pacer->queue);
+    pacer->queue = NULL;
+    pacer->count = 0;
+}
+
+static void
+refill(pacer_t *pacer, uint64_t now)
+{
+    uint64_t elapsed;
+
+    if (now <= pacer->last) {
+        return;
+    }
+    elapsed = now - pacer->last;
+    pacer->last = now;
+
+    /* Long idle periods only ever fill the bucket, keep clear of overflow */
+    if (elapsed >= (uint64_t)(pacer->burst - pacer->tokens) / pacer->rate + 1) {
+        pacer->tokens = pacer->burst;
+    } else {
+        pacer->tokens += elapsed * pacer->rate;
+        if (pacer->tokens > pacer->burst) {
+            pacer->tokens = pacer->burst;
+        }
+    }
+}
+
+/* Takes one query worth of tokens, if that much has built up */
+int
+pacer_take(pacer_t *pacer, uint64_t now)
+{
+    if (pacer->rate == 0) {
+        return 1;
+    }
+    refill(pacer, now);
+    if (pacer->tokens < TOKEN) {
+        return 0;
+    }
+    pacer->tokens -= TOKEN;
+
+    return 1;
+}
+
+/* Books packets beyond the first of one round, they go out together and
+ * later queries wait for the debt instead */
+void
+pacer_charge(pacer_t *pacer, unsigned n)
+{
+    if (pacer->rate != 0) {
+        pacer->tokens -= (int64_t)n * TOKEN;
+    }
+}
+
+/* Microseconds until the next token, as of the last refill */
+uint64_t
+pacer_wait(const pacer_t *pacer)
+{
+    if (pacer->tokens >= TOKEN) {
+        return 0;
+    }
+
+    return (TOKEN - pacer->tokens + pacer->rate - 1) / pacer->rate;
+}
+
+int
+pacer_push(pacer_t *pacer, const pace_entry_t *entry)
+{
+    if (pacer->count == PACER_QUEUE) {
+        return -1;
+    }
+    if (pacer->queue == NULL) {
+        pacer->queue = malloc(PACER_QUEUE * sizeof(*pacer->queue));
+        if (pacer->queue == NULL) {
+            logger(LOG_LEVEL_ERR, "Could not allocate query pacing queue: %s",
+                strerror(errno));
+            return -1;
+        }
+    }
+    pacer->queue[(pacer->head + pacer->count++) % PACER_QUEUE] = *entry;
+
+    return 0;
+}
+
+pace_entry_t *
+pacer_peek(pacer_t *pacer)
+{
+    return (pacer->count > 0 ? &pacer->queue[pacer->head] : NULL);
+}
+
+void
+pacer_pop(pacer_t *pacer)
+{
+    pacer->head = (pacer->head + 1) % PACER_QUEUE;
+    pacer->count--;
+}
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "membership.h"
+
+/* Queries held back per interface before new ones are dropped */
+#define PACER_QUEUE 4096
+
+/* What a deferred entry owes its group */
+#define PACE_GROUP   0x01       /* Group-specific query */
+#define PACE_SOURCES 0x02       /* Round of group-and-source-specific queries */
+
+typedef struct pace_entry {
+    group_addr_t group;
+    uint8_t      kind;
+    uint64_t     queued;        /* When it was deferred, microseconds */
+    uint64_t     stamp;         /* Triggering event, carried to the transmit batch */
+} pace_entry_t;
+
+/* Token bucket of queries per second, with a queue for the overflow.
+ * Tokens are kept in millionths of a query so that refills per
+ * microsecond stay integral. */
+typedef struct pacer {
+    uint64_t      rate;         /* 0 leaves queries unpaced */
+    int64_t       tokens;       /* May go negative after multi-packet rounds */
+    int64_t       burst;
+    uint64_t      last;         /* Last refill, microseconds */
+    pace_entry_t *queue;
+    unsigned      head;
+    unsigned      count;
+} pacer_t;
+
+int pacer_init(pacer_t *pacer, unsigned rate, unsigned burst, uint64_t now);
+
+void pacer_free(pacer_t *pacer);
+
+int pacer_take(pacer_t *pacer, uint64_t now);
+
+void pacer_charge(pacer_t *pacer, unsigned n);
+
+uint64_t pacer_wait(const pacer_t *pacer);
+
+int pacer_push(pacer_t *pacer, const pace_entry_t *entry);
+
+pace_entry_t *pacer_peek(pacer_t *pacer);
+
+void pacer_pop(pacer_t *pacer);
+
+#endif /* __PACER_H__ */
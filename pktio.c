@@ -0,0 +1,309 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip6.h>
+#include <sys/socket.h>
+
+#include "iface.h"
+#include "logging.h"
+#include "pktio.h"
+
+static const pktio_ops_t *backends[] = {
+    &pktio_socket_ops,
+    &pktio_ring_ops,
+};
+
+const pktio_ops_t *
+pktio_lookup(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcmp(backends[i]->name, name) == 0) {
+            return backends[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Queries go out on the interface's raw socket whatever receives */
+int
+pktio_sendmmsg(pktio_t *io, int fd, struct mmsghdr *msgs, unsigned n)
+{
+    return sendmmsg(fd, msgs, n, 0);
+}
+
+/* Raw socket backend, receives on the interface's own IGMP socket */
+
+static int
+socket_open(pktio_t *io, iface_t *iface)
+{
+    /* Leaves go to All Routers and IGMPv3 reports to All IGMPv3 Routers,
+     * the stack only hands a raw socket groups the host has joined */
+    static const in_addr_t routers[] = { 0xE0000002, 0xE0000016 };
+    struct ip_mreqn mreqn;
+    unsigned i;
+    int on = 1;
+
+    io->fd = iface->sockfd;
+
+    if (filter_attach(io->fd, &iface->filter) != 0) {
+        logger(LOG_LEVEL_ERR, "Could not attach packet filter for interface '%s': %s",
+            iface->name, strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(routers) / sizeof(routers[0]) && iface->index != 0; i++) {
+        memset(&mreqn, 0, sizeof(mreqn));
+        mreqn.imr_multiaddr.s_addr = htonl(routers[i]);
+        mreqn.imr_ifindex = iface->index;
+        if (setsockopt(io->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreqn, sizeof(mreqn)) < 0) {
+            logger(LOG_LEVEL_INFO, "Could not join router groups on interface '%s': %s",
+                iface->name, strerror(errno));
+            break;
+        }
+    }
+
+    /* Reports to other groups are only seen through multicast routing,
+     * which passes those carrying Router Alert to the sockets asking */
+    if (setsockopt(io->fd, IPPROTO_IP, IP_ROUTER_ALERT, &on, sizeof(on)) < 0) {
+        logger(LOG_LEVEL_INFO, "Could not receive router alert packets on interface '%s': %s",
+            iface->name, strerror(errno));
+    }
+
+    return 0;
+}
+
+static int
+socket_adopt(pktio_t *io, iface_t *iface)
+{
+    /* Filter and memberships came along with the socket */
+    io->fd = iface->sockfd;
+
+    return 0;
+}
+
+static int
+socket_recv(pktio_t *io, pktio_cb_t cb, void *arg)
+{
+    char control[PKTIO_BATCH][CMSG_SPACE(sizeof(struct in_pktinfo))];
+    struct mmsghdr msgs[PKTIO_BATCH];
+    struct iovec iovs[PKTIO_BATCH];
+    struct in_pktinfo *pktinfo;
+    struct cmsghdr *cmsg;
+    uint32_t ifindex;
+    int i, n;
+
+    for (i = 0; i < PKTIO_BATCH; i++) {
+        iovs[i].iov_base = io->bufs[i];
+        iovs[i].iov_len = PKTIO_FRAMESIZE;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+
+    n = recvmmsg(io->fd, msgs, PKTIO_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1);
+    }
+
+    for (i = 0; i < n; i++) {
+        ifindex = 0;
+        for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                pktinfo = (struct in_pktinfo*)CMSG_DATA(cmsg);
+                ifindex = pktinfo->ipi_ifindex;
+            }
+        }
+        cb(io->bufs[i], msgs[i].msg_len, ifindex, 0, arg);
+    }
+
+    return n;
+}
+
+static void
+socket_close(pktio_t *io)
+{
+    /* The descriptor belongs to the interface */
+    io->fd = -1;
+}
+
+const pktio_ops_t pktio_socket_ops = {
+    .name  = "socket",
+    .open  = socket_open,
+    .adopt = socket_adopt,
+    .recv  = socket_recv,
+    .send  = pktio_sendmmsg,
+    .close = socket_close,
+};
+
+/* ICMPv6 backend of MLD instances. The stack strips the IPv6 header, so
+ * one is put back in front of each message from the sender address and
+ * ancillary data, for the parser to see what went over the wire. */
+
+static int
+socket6_open(pktio_t *io, iface_t *iface)
+{
+    /* Done messages go to All Routers, MLDv2 reports to All MLDv2 Routers */
+    static const struct in6_addr routers[] = {
+        { { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02 } } },
+        { { { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x16 } } },
+    };
+    struct icmp6_filter filter;
+    struct ipv6_mreq mreq;
+    unsigned i;
+    int on = 1;
+
+    io->fd = socket(AF_INET6, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMPV6);
+    if (io->fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not open ICMPv6 socket for interface '%s': %s",
+            iface->name, strerror(errno));
+        return -1;
+    }
+
+    ICMP6_FILTER_SETBLOCKALL(&filter);
+    ICMP6_FILTER_SETPASS(MLD_LISTENER_QUERY, &filter);
+    ICMP6_FILTER_SETPASS(MLD_LISTENER_REPORT, &filter);
+    ICMP6_FILTER_SETPASS(MLD_LISTENER_REDUCTION, &filter);
+    ICMP6_FILTER_SETPASS(MLD_V2_LISTENER_REPORT, &filter);
+
+    if (setsockopt(io->fd, SOL_SOCKET, SO_BINDTODEVICE, iface->name,
+            strlen(iface->name) + 1) < 0 ||
+        setsockopt(io->fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) < 0 ||
+        setsockopt(io->fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on)) < 0 ||
+        setsockopt(io->fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not set up ICMPv6 socket for interface '%s': %s",
+            iface->name, strerror(errno));
+        close(io->fd);
+        io->fd = -1;
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(routers) / sizeof(routers[0]); i++) {
+        mreq.ipv6mr_multiaddr = routers[i];
+        mreq.ipv6mr_interface = iface->index;
+        if (setsockopt(io->fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) < 0) {
+            logger(LOG_LEVEL_INFO, "Could not join router groups on interface '%s': %s",
+                iface->name, strerror(errno));
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int
+socket6_adopt(pktio_t *io, iface_t *iface)
+{
+    /* MLD instances are not handed over */
+    return -1;
+}
+
+static int
+socket6_recv(pktio_t *io, pktio_cb_t cb, void *arg)
+{
+    char control[PKTIO_BATCH][CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(int))];
+    struct sockaddr_in6 from[PKTIO_BATCH];
+    struct mmsghdr msgs[PKTIO_BATCH];
+    struct iovec iovs[PKTIO_BATCH];
+    struct in6_pktinfo *pktinfo;
+    struct ip6_hdr *ip6;
+    struct cmsghdr *cmsg;
+    uint32_t ifindex;
+    int i, n, hlim;
+
+    for (i = 0; i < PKTIO_BATCH; i++) {
+        iovs[i].iov_base = io->bufs[i] + sizeof(struct ip6_hdr);
+        iovs[i].iov_len = PKTIO_FRAMESIZE - sizeof(struct ip6_hdr);
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_name = &from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+
+    n = recvmmsg(io->fd, msgs, PKTIO_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1);
+    }
+
+    for (i = 0; i < n; i++) {
+        ip6 = (struct ip6_hdr*)io->bufs[i];
+        memset(ip6, 0, sizeof(*ip6));
+        ip6->ip6_vfc = 0x60;
+        ip6->ip6_plen = htons(msgs[i].msg_len);
+        ip6->ip6_nxt = IPPROTO_ICMPV6;
+        ip6->ip6_src = from[i].sin6_addr;
+
+        ifindex = 0;
+        for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level != IPPROTO_IPV6) {
+                continue;
+            }
+            if (cmsg->cmsg_type == IPV6_PKTINFO) {
+                pktinfo = (struct in6_pktinfo*)CMSG_DATA(cmsg);
+                ip6->ip6_dst = pktinfo->ipi6_addr;
+                ifindex = pktinfo->ipi6_ifindex;
+            } else if (cmsg->cmsg_type == IPV6_HOPLIMIT) {
+                memcpy(&hlim, CMSG_DATA(cmsg), sizeof(hlim));
+                ip6->ip6_hlim = hlim;
+            }
+        }
+        cb(io->bufs[i], sizeof(*ip6) + msgs[i].msg_len, ifindex, 0, arg);
+    }
+
+    return n;
+}
+
+static void
+socket6_close(pktio_t *io)
+{
+    if (io->fd >= 0) {
+        close(io->fd);
+        io->fd = -1;
+    }
+}
+
+const pktio_ops_t pktio_socket6_ops = {
+    .name  = "socket6",
+    .open  = socket6_open,
+    .adopt = socket6_adopt,
+    .recv  = socket6_recv,
+    .send  = pktio_sendmmsg,
+    .close = socket6_close,
+};
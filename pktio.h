@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PKTIO_H__
+#define __PKTIO_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "filter.h"
+
+#define PKTIO_BATCH     32
+#define PKTIO_FRAMESIZE 9216
+
+/* TPACKET_V3 ring geometry, blocks are retired after at most 10 ms */
+#define PKTIO_RING_BLOCKSIZE (1 << 16)
+#define PKTIO_RING_BLOCKS    16
+#define PKTIO_RING_FRAMESIZE 2048
+#define PKTIO_RING_TIMEOUT   10
+
+struct iface;
+struct mmsghdr;
+
+typedef struct pktio pktio_t;
+
+/* Called for every received IP packet, pkt points at the IP header.
+ * The VLAN is that of a tagged frame seen on a trunk, 0 otherwise. */
+typedef void (*pktio_cb_t)(const uint8_t *pkt, size_t len, uint32_t ifindex, uint16_t vlan,
+    void *arg);
+
+typedef struct pktio_ops {
+    const char *name;
+    int       (*open)(pktio_t *io, struct iface *iface);
+    int       (*adopt)(pktio_t *io, struct iface *iface);  /* Set up around a handed over fd */
+    int       (*recv)(pktio_t *io, pktio_cb_t cb, void *arg);
+    int       (*send)(pktio_t *io, int fd, struct mmsghdr *msgs, unsigned n); /* As sendmmsg() */
+    void      (*close)(pktio_t *io);
+} pktio_ops_t;
+
+/* Receive side of an interface */
+struct pktio {
+    const pktio_ops_t *ops;
+    int                fd;
+    uint8_t          (*bufs)[PKTIO_FRAMESIZE];
+
+    /* Ring backend */
+    uint8_t           *map;
+    size_t             map_len;
+    unsigned           block;
+
+    /* Backends without a descriptor of their own */
+    void              *priv;
+};
+
+extern const pktio_ops_t pktio_socket_ops;
+extern const pktio_ops_t pktio_ring_ops;
+extern const pktio_ops_t pktio_socket6_ops;
+
+const pktio_ops_t *pktio_lookup(const char *name);
+
+int pktio_sendmmsg(pktio_t *io, int fd, struct mmsghdr *msgs, unsigned n);
+
+int pktio_ring_open(pktio_t *io, const char *name, unsigned ifindex, int type, int protocol,
+    const filter_t *filter);
+
+int pktio_ring_allmulti(pktio_t *io, const char *name, unsigned ifindex);
+
+#endif /* __PKTIO_H__ */
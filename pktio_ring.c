@@ -0,0 +1,243 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "iface.h"
+#include "logging.h"
+#include "pktio.h"
+
+/* AF_PACKET TPACKET_V3 backend. The kernel fills blocks of packets in a
+ * ring shared with us, which are then parsed in place a block at a time.
+ * Queries are still sent on the raw socket, which gets a drop-all filter
+ * so reports are not queued twice. */
+
+/* Sets up a receive ring on a new packet socket of the given type and
+ * protocol, filtered from the start. Interface index 0 receives on all
+ * interfaces, as the unbound socket. */
+int
+pktio_ring_open(pktio_t *io, const char *name, unsigned ifindex, int type, int protocol,
+    const filter_t *filter)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    int version = TPACKET_V3;
+
+    io->map = NULL;
+    io->block = 0;
+
+    io->fd = socket(AF_PACKET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, htons(protocol));
+    if (io->fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not open packet socket for interface '%s': %s",
+            name, strerror(errno));
+        return -1;
+    }
+
+    /* Filter before binding so nothing unfiltered lands in the ring */
+    if (filter_attach(io->fd, filter) != 0) {
+        logger(LOG_LEVEL_ERR, "Could not attach packet filter for interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    if (setsockopt(io->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not select TPACKET_V3 for interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = PKTIO_RING_BLOCKSIZE;
+    req.tp_block_nr = PKTIO_RING_BLOCKS;
+    req.tp_frame_size = PKTIO_RING_FRAMESIZE;
+    req.tp_frame_nr = PKTIO_RING_BLOCKSIZE / PKTIO_RING_FRAMESIZE * PKTIO_RING_BLOCKS;
+    req.tp_retire_blk_tov = PKTIO_RING_TIMEOUT;
+    if (setsockopt(io->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not set up receive ring for interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    io->map_len = (size_t)PKTIO_RING_BLOCKSIZE * PKTIO_RING_BLOCKS;
+    io->map = mmap(NULL, io->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, io->fd, 0);
+    if (io->map == MAP_FAILED) {
+        io->map = NULL;
+        logger(LOG_LEVEL_ERR, "Could not map receive ring for interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(protocol);
+    sll.sll_ifindex = ifindex;
+    if (bind(io->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not bind packet socket to interface '%s': %s",
+            name, strerror(errno));
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    if (io->map != NULL) {
+        munmap(io->map, io->map_len);
+        io->map = NULL;
+    }
+    close(io->fd);
+    io->fd = -1;
+    return -1;
+}
+
+/* Lifts the device's multicast filter, which would otherwise drop the
+ * reports to groups the host has not joined. The membership goes with
+ * the socket. */
+int
+pktio_ring_allmulti(pktio_t *io, const char *name, unsigned ifindex)
+{
+    struct packet_mreq mreq;
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = ifindex;
+    mreq.mr_type = PACKET_MR_ALLMULTI;
+    if (setsockopt(io->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not receive all multicast on interface '%s': %s",
+            name, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static void ring_close(pktio_t *io);
+
+static int
+ring_open(pktio_t *io, iface_t *iface)
+{
+    filter_t drop;
+
+    /* Cooked packets start at the IP header, as on the raw socket */
+    if (pktio_ring_open(io, iface->name, iface->index, SOCK_DGRAM, ETH_P_IP,
+            &iface->filter) != 0) {
+        return -1;
+    }
+    if (iface->index != 0 && pktio_ring_allmulti(io, iface->name, iface->index) != 0) {
+        ring_close(io);
+        return -1;
+    }
+
+    filter_build_drop(&drop);
+    if (filter_attach(iface->sockfd, &drop) != 0) {
+        logger(LOG_LEVEL_ERR, "Could not attach packet filter for interface '%s': %s",
+            iface->name, strerror(errno));
+        ring_close(io);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The ring lives on with the socket, it only needs mapping again */
+static int
+ring_adopt(pktio_t *io, iface_t *iface)
+{
+    io->map_len = (size_t)PKTIO_RING_BLOCKSIZE * PKTIO_RING_BLOCKS;
+    io->map = mmap(NULL, io->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, io->fd, 0);
+    if (io->map == MAP_FAILED) {
+        io->map = NULL;
+        logger(LOG_LEVEL_ERR, "Could not map receive ring for interface '%s': %s",
+            iface->name, strerror(errno));
+        return -1;
+    }
+    io->block %= PKTIO_RING_BLOCKS;
+
+    return 0;
+}
+
+static int
+ring_recv(pktio_t *io, pktio_cb_t cb, void *arg)
+{
+    struct tpacket_block_desc *desc;
+    struct tpacket3_hdr *hdr;
+    struct sockaddr_ll *sll;
+    uint32_t i, n_pkts;
+    uint16_t vlan;
+    int count = 0, blocks;
+
+    /* A bounded number of blocks per wakeup, like the socket batch */
+    for (blocks = 0; blocks < PKTIO_RING_BLOCKS; blocks++) {
+        desc = (struct tpacket_block_desc*)(io->map + (size_t)io->block * PKTIO_RING_BLOCKSIZE);
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+            break;
+        }
+
+        n_pkts = desc->hdr.bh1.num_pkts;
+        hdr = (struct tpacket3_hdr*)((uint8_t*)desc + desc->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < n_pkts; i++) {
+            sll = (struct sockaddr_ll*)((uint8_t*)hdr + TPACKET_ALIGN(sizeof(*hdr)));
+            /* The kernel has taken the tag off the frame by now */
+            vlan = (hdr->tp_status & TP_STATUS_VLAN_VALID ? hdr->hv1.tp_vlan_tci & 0x0FFF : 0);
+            cb((uint8_t*)hdr + hdr->tp_net, hdr->tp_snaplen - (hdr->tp_net - hdr->tp_mac),
+                sll->sll_ifindex, vlan, arg);
+            hdr = (struct tpacket3_hdr*)((uint8_t*)hdr + hdr->tp_next_offset);
+        }
+        count += n_pkts;
+
+        /* Hand the block back to the kernel */
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        io->block = (io->block + 1) % PKTIO_RING_BLOCKS;
+    }
+
+    return count;
+}
+
+static void
+ring_close(pktio_t *io)
+{
+    if (io->map != NULL) {
+        munmap(io->map, io->map_len);
+        io->map = NULL;
+    }
+    if (io->fd >= 0) {
+        close(io->fd);
+        io->fd = -1;
+    }
+}
+
+const pktio_ops_t pktio_ring_ops = {
+    .name  = "ring",
+    .open  = ring_open,
+    .adopt = ring_adopt,
+    .recv  = ring_recv,
+    .send  = pktio_sendmmsg,
+    .close = ring_close,
+};
@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "logging.h"
+#include "pool.h"
+
+int
+arena_init(arena_t *arena, size_t size)
+{
+    arena->used = 0;
+    arena->size = size;
+
+    /* Pages are only backed once touched, so the cap costs nothing up front */
+    arena->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena->base == MAP_FAILED) {
+        logger(LOG_LEVEL_ERR, "Could not map %zu byte memory arena: %s", size, strerror(errno));
+        arena->base = NULL;
+        arena->size = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+    void *ptr;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > arena->size - arena->used) {
+        return NULL;
+    }
+    ptr = arena->base + arena->used;
+    arena->used += size;
+
+    return ptr;
+}
+
+void
+arena_free(arena_t *arena)
+{
+    if (arena->base != NULL) {
+        munmap(arena->base, arena->size);
+        arena->base = NULL;
+    }
+    arena->size = 0;
+    arena->used = 0;
+}
+
+void
+pool_init(pool_t *pool, arena_t *arena, size_t size)
+{
+    pool->arena = arena;
+    pool->free = NULL;
+    pool->size = (size < sizeof(void*) ? sizeof(void*) : size);
+}
+
+void *
+pool_get(pool_t *pool)
+{
+    void *obj = pool->free;
+
+    if (obj == NULL) {
+        return arena_alloc(pool->arena, pool->size);
+    }
+    memcpy(&pool->free, obj, sizeof(void*));
+
+    return obj;
+}
+
+void
+pool_put(pool_t *pool, void *obj)
+{
+    memcpy(obj, &pool->free, sizeof(void*));
+    pool->free = obj;
+}
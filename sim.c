@@ -0,0 +1,1010 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Deterministic simulation of the querier engine on a virtual clock,
+ * against an in-memory segment of synthetic hosts. Hosts answer queries
+ * after a random delay within the Max Response Time (RFC 2236, section 3
+ * and RFC 3376, section 5.2), IGMPv2 hosts suppress their report once
+ * another member of the group has reported. */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "igmp.h"
+#include "logging.h"
+
+#define SIM_IFINDEX     1
+#define SIM_QUERIER     0x0AFFFFFE  /* 10.255.255.254 */
+#define SIM_HOST_BASE   0x0A000001  /* 10.0.0.1 */
+#define SIM_GROUP_BASE  0xEF010000  /* 239.1.0.0 */
+#define SIM_HOSTS_MAX   (1 << 23)
+#define SIM_START       1000        /* Virtual clock at start, milliseconds */
+#define SIM_DECILES     10
+#define SIM_WINDOW      10          /* Burst peak window, milliseconds */
+#define SIM_LEAVE       0x80000000  /* Due message is a leave */
+
+/* Host flags */
+#define HOST_LEFT       0x01
+#define HOST_SPECIFIC   0x02        /* Report timer set by a group-specific query */
+
+/* Report timer of a host, filed in the calendar bucket of its expiry */
+typedef struct sim_entry {
+    uint32_t host;
+    int32_t  next;
+} sim_entry_t;
+
+typedef struct sim_leave {
+    uint32_t at;                /* Milliseconds */
+    uint32_t host;
+} sim_leave_t;
+
+/* One general query and the reports answering it */
+typedef struct sim_query {
+    uint64_t sent;
+    unsigned mrt;               /* Milliseconds */
+    uint64_t reports;
+    uint64_t deciles[SIM_DECILES];
+    uint64_t peak;              /* Most reports within one window */
+    uint64_t window;
+    uint64_t in_window;
+    uint64_t last;
+} sim_query_t;
+
+typedef struct sim {
+    uint64_t       now;         /* Virtual clock, milliseconds */
+    uint64_t       rng;
+    int            version;
+    uint32_t       n_hosts;
+    uint32_t       n_groups;
+
+    /* Hosts, member of group host % n_groups */
+    uint32_t      *report_at;   /* Pending report, 0 for none */
+    uint32_t      *sched_at;    /* When the report timer was started */
+    uint8_t       *flags;
+
+    /* Groups */
+    uint32_t      *heard;       /* Last report seen, for IGMPv2 suppression */
+    uint32_t      *members;
+    uint32_t      *leave_at;    /* Leave not yet followed by a query */
+    uint32_t      *empty_at;    /* Last member gone, removal pending */
+
+    /* Report timers by expiry, one bucket per millisecond */
+    int32_t       *buckets;
+    size_t         ring_mask;
+    sim_entry_t   *entries;
+    size_t         n_entries;
+    size_t         max_entries;
+    int32_t        free_entry;
+    uint64_t       pending;
+    uint64_t       cursor;      /* Next bucket to collect */
+
+    /* Messages due now, handed to the engine in receive batches */
+    uint32_t      *due;
+    size_t         n_due;
+    size_t         due_head;
+
+    sim_leave_t   *leaves;
+    size_t         n_leaves;
+    size_t         next_leave;
+
+    /* Measurements */
+    sim_query_t   *queries;
+    size_t         n_queries;
+    size_t         max_queries;
+    uint64_t      *leave_query;     /* Leave to group-specific query */
+    size_t         n_leave_query;
+    uint64_t      *leave_removal;   /* Last leave to removal of the group */
+    size_t         n_leave_removal;
+    uint32_t      *watch;           /* Groups whose removal is awaited */
+    size_t         n_watch;
+    uint64_t       received;        /* Packets handed to the engine */
+    uint64_t       sent;            /* Packets sent by the engine */
+    uint64_t       suppressed;
+    uint64_t       specific;        /* Reports to group-specific queries */
+    uint64_t       host_cpu;        /* Nanoseconds spent on the hosts' side */
+} sim_t;
+
+typedef struct sim_options {
+    long n_hosts;
+    long n_groups;
+    long version;
+    long max_resp;
+    long interval;
+    long duration;
+    long churn;
+    long memory;
+    long seed;
+    long pace_rate;
+    long pace_burst;
+    long mrt_target;
+    int  fast_leave;
+} sim_options_t;
+
+static sim_t sim;
+
+static uint64_t
+virtual_now_us(void)
+{
+    return sim.now * 1000;
+}
+
+static uint64_t
+cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* xorshift64*, seeded from the command line for repeatable runs */
+static uint32_t
+sim_random(void)
+{
+    sim.rng ^= sim.rng >> 12;
+    sim.rng ^= sim.rng << 25;
+    sim.rng ^= sim.rng >> 27;
+
+    return (uint32_t)((sim.rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static struct in_addr
+group_addr(uint32_t group)
+{
+    struct in_addr addr;
+
+    addr.s_addr = htonl(SIM_GROUP_BASE + group);
+    return addr;
+}
+
+static int
+grow(void *ptr, size_t *max, size_t want, size_t size)
+{
+    void **array = ptr;
+    size_t n = (*max > 0 ? *max : 64);
+    void *p;
+
+    if (want <= *max) {
+        return 0;
+    }
+    while (n < want) {
+        n *= 2;
+    }
+    p = realloc(*array, n * size);
+    if (p == NULL) {
+        return -1;
+    }
+    *array = p;
+    *max = n;
+
+    return 0;
+}
+
+/* Starts a host's report timer, a running timer is only moved forward */
+static void
+schedule(uint32_t host, unsigned mrt, int specific)
+{
+    uint32_t at;
+    int32_t idx;
+
+    if ((sim.flags[host] & HOST_LEFT) || mrt == 0) {
+        return;
+    }
+    at = sim.now + 1 + sim_random() % mrt;
+    if (sim.report_at[host] != 0 && sim.report_at[host] <= at) {
+        return;
+    }
+
+    if (sim.free_entry >= 0) {
+        idx = sim.free_entry;
+        sim.free_entry = sim.entries[idx].next;
+    } else {
+        if (grow(&sim.entries, &sim.max_entries, sim.n_entries + 1, sizeof(*sim.entries)) != 0) {
+            return;
+        }
+        idx = sim.n_entries++;
+    }
+    sim.entries[idx].host = host;
+    sim.entries[idx].next = sim.buckets[at & sim.ring_mask];
+    sim.buckets[at & sim.ring_mask] = idx;
+    sim.pending++;
+
+    sim.report_at[host] = at;
+    sim.sched_at[host] = sim.now;
+    sim.flags[host] = (specific ? HOST_SPECIFIC : 0);
+}
+
+static int
+push_due(uint32_t msg)
+{
+    static size_t max_due;
+
+    if (grow(&sim.due, &max_due, sim.n_due + 1, sizeof(*sim.due)) != 0) {
+        return -1;
+    }
+    sim.due[sim.n_due++] = msg;
+
+    return 0;
+}
+
+/* Moves expired report timers and leaves up to the current time onto
+ * the due list, dropping timers that were moved or cancelled since */
+static void
+collect(void)
+{
+    sim_entry_t *entry;
+    int32_t idx;
+    uint32_t host;
+
+    for (; sim.cursor <= sim.now && sim.pending > 0; sim.cursor++) {
+        idx = sim.buckets[sim.cursor & sim.ring_mask];
+        sim.buckets[sim.cursor & sim.ring_mask] = -1;
+        while (idx >= 0) {
+            entry = &sim.entries[idx];
+            host = entry->host;
+            if (sim.report_at[host] == sim.cursor) {
+                push_due(host);
+            }
+            sim.pending--;
+            idx = entry->next;
+            entry->next = sim.free_entry;
+            sim.free_entry = entry - sim.entries;
+        }
+    }
+    sim.cursor = sim.now + 1;
+
+    while (sim.next_leave < sim.n_leaves && sim.leaves[sim.next_leave].at <= sim.now) {
+        push_due(sim.leaves[sim.next_leave++].host | SIM_LEAVE);
+    }
+}
+
+/* Earliest report timer before the limit, which is returned if none */
+static uint64_t
+next_report(uint64_t limit)
+{
+    uint64_t t;
+
+    if (sim.pending == 0) {
+        return limit;
+    }
+    for (t = sim.cursor; t < limit; t++) {
+        if (sim.buckets[t & sim.ring_mask] >= 0) {
+            return t;
+        }
+    }
+
+    return limit;
+}
+
+/* IP header of a host's packet, TTL 1 with the Router Alert option */
+static size_t
+build_ip(uint8_t *buf, uint32_t host, struct in_addr dst, size_t len)
+{
+    struct ip *ip = (struct ip*)buf;
+    uint32_t src = htonl(SIM_HOST_BASE + host);
+
+    memset(buf, 0, 24);
+    ip->ip_v = 4;
+    ip->ip_hl = 6;
+    ip->ip_tos = 0xc0;
+    ip->ip_len = htons(24 + len);
+    ip->ip_ttl = 1;
+    ip->ip_p = IPPROTO_IGMP;
+    memcpy(&ip->ip_src, &src, sizeof(src));
+    ip->ip_dst = dst;
+    buf[20] = 0x94;
+    buf[21] = 0x04;
+    ip->ip_sum = cksum(buf, 24);
+
+    return 24;
+}
+
+/* Membership report, or leave, of a host for its single group */
+static size_t
+build_report(uint8_t *buf, uint32_t host, int leave)
+{
+    struct in_addr group = group_addr(host % sim.n_groups);
+    struct in_addr dst;
+    uint8_t *igmp;
+    uint16_t ck;
+    size_t len, hlen;
+
+    if (sim.version == 3) {
+        dst.s_addr = htonl(0xE0000016);
+        len = 8 + 8;
+    } else {
+        dst.s_addr = (leave ? htonl(0xE0000002) : group.s_addr);
+        len = 8;
+    }
+    hlen = build_ip(buf, host, dst, len);
+
+    igmp = buf + hlen;
+    memset(igmp, 0, len);
+    if (sim.version == 3) {
+        igmp[0] = IGMP_V3_MEMBERSHIP_REPORT;
+        igmp[7] = 1;
+        igmp[8] = (leave ? IGMP_CHANGE_TO_INCLUDE_MODE : IGMP_MODE_IS_EXCLUDE);
+        memcpy(igmp + 12, &group, sizeof(group));
+    } else {
+        igmp[0] = (leave ? IGMP_V2_LEAVE_GROUP : IGMP_V2_MEMBERSHIP_REPORT);
+        memcpy(igmp + 4, &group, sizeof(group));
+    }
+    ck = cksum(igmp, len);
+    memcpy(igmp + 2, &ck, sizeof(ck));
+
+    return hlen + len;
+}
+
+/* Report of the current query cycle, for the burst shape */
+static void
+observe_report(void)
+{
+    sim_query_t *q;
+    uint64_t at, slot;
+
+    if (sim.n_queries == 0) {
+        return;
+    }
+    q = &sim.queries[sim.n_queries - 1];
+    at = sim.now - q->sent;
+    slot = (q->mrt > 0 ? at * SIM_DECILES / q->mrt : 0);
+    q->deciles[slot < SIM_DECILES ? slot : SIM_DECILES - 1]++;
+    q->reports++;
+    q->last = sim.now;
+
+    if (sim.now / SIM_WINDOW != q->window) {
+        q->window = sim.now / SIM_WINDOW;
+        q->in_window = 0;
+    }
+    if (++q->in_window > q->peak) {
+        q->peak = q->in_window;
+    }
+}
+
+static void
+handle_leave(uint32_t host)
+{
+    uint32_t group = host % sim.n_groups;
+
+    sim.flags[host] = HOST_LEFT;
+    sim.report_at[host] = 0;
+    if (sim.leave_at[group] == 0) {
+        sim.leave_at[group] = sim.now;
+    }
+    if (--sim.members[group] == 0) {
+        sim.empty_at[group] = sim.now;
+        sim.watch[sim.n_watch++] = group;
+    }
+}
+
+static int
+sim_open(pktio_t *io, iface_t *iface)
+{
+    io->fd = -1;
+    io->priv = &sim;
+
+    return 0;
+}
+
+static int
+sim_adopt(pktio_t *io, iface_t *iface)
+{
+    return -1;
+}
+
+/* Hands the engine a batch of the messages due, as a socket would.
+ * The batch is built before it is delivered so the hosts' share of the
+ * work can be told apart from the engine's. */
+static int
+sim_recv(pktio_t *io, pktio_cb_t cb, void *arg)
+{
+    uint64_t start = cpu_ns();
+    size_t len[PKTIO_BATCH];
+    uint32_t msg, host, group;
+    int i, n = 0;
+
+    while (n < PKTIO_BATCH && sim.due_head < sim.n_due) {
+        msg = sim.due[sim.due_head++];
+        host = msg & ~SIM_LEAVE;
+        group = host % sim.n_groups;
+
+        if (msg & SIM_LEAVE) {
+            handle_leave(host);
+            len[n] = build_report(io->bufs[n], host, 1);
+            n++;
+            continue;
+        }
+        if (sim.flags[host] & HOST_LEFT) {
+            continue;
+        }
+        sim.report_at[host] = 0;
+        if (sim.version == 2 && sim.heard[group] != 0 &&
+            sim.heard[group] >= sim.sched_at[host]) {
+            sim.suppressed++;
+            continue;
+        }
+        sim.heard[group] = sim.now;
+        if (sim.flags[host] & HOST_SPECIFIC) {
+            sim.specific++;
+        } else {
+            observe_report();
+        }
+        len[n] = build_report(io->bufs[n], host, 0);
+        n++;
+    }
+    if (sim.due_head == sim.n_due) {
+        sim.due_head = 0;
+        sim.n_due = 0;
+    }
+    sim.host_cpu += cpu_ns() - start;
+
+    for (i = 0; i < n; i++) {
+        cb(io->bufs[i], len[i], SIM_IFINDEX, 0, arg);
+    }
+    sim.received += n;
+
+    return n;
+}
+
+/* Queries from the engine reach every host on the segment */
+static int
+sim_send(pktio_t *io, int fd, struct mmsghdr *msgs, unsigned n)
+{
+    uint64_t start = cpu_ns();
+    const uint8_t *data;
+    struct in_addr addr;
+    unsigned i, mrt;
+    uint32_t group, host;
+    sim_query_t *q;
+
+    for (i = 0; i < n; i++) {
+        data = msgs[i].msg_hdr.msg_iov->iov_base;
+        if (msgs[i].msg_hdr.msg_iov->iov_len < IGMP_MINLEN ||
+            data[0] != IGMP_MEMBERSHIP_QUERY) {
+            continue;
+        }
+        memcpy(&addr, data + 4, sizeof(addr));
+        mrt = (msgs[i].msg_hdr.msg_iov->iov_len >= IGMP_V3_QUERY_MINLEN ?
+            igmp_decode_code(data[1]) : data[1]) * 100;
+
+        if (addr.s_addr == INADDR_ANY) {
+            if (grow(&sim.queries, &sim.max_queries, sim.n_queries + 1,
+                    sizeof(*sim.queries)) == 0) {
+                q = &sim.queries[sim.n_queries++];
+                memset(q, 0, sizeof(*q));
+                q->sent = sim.now;
+                q->mrt = mrt;
+                q->window = UINT64_MAX;
+            }
+            for (host = 0; host < sim.n_hosts; host++) {
+                schedule(host, mrt, 0);
+            }
+            continue;
+        }
+
+        group = ntohl(addr.s_addr) - SIM_GROUP_BASE;
+        if (group >= sim.n_groups) {
+            continue;
+        }
+        if (sim.leave_at[group] != 0) {
+            sim.leave_query[sim.n_leave_query++] = sim.now - sim.leave_at[group];
+            sim.leave_at[group] = 0;
+        }
+        for (host = group; host < sim.n_hosts; host += sim.n_groups) {
+            schedule(host, mrt, 1);
+        }
+    }
+
+    sim.sent += n;
+    sim.host_cpu += cpu_ns() - start;
+
+    return n;
+}
+
+static void
+sim_close(pktio_t *io)
+{
+    io->priv = NULL;
+}
+
+static const pktio_ops_t sim_ops = {
+    .name  = "sim",
+    .open  = sim_open,
+    .adopt = sim_adopt,
+    .recv  = sim_recv,
+    .send  = sim_send,
+    .close = sim_close,
+};
+
+static int
+compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+static int
+compare_leave(const void *a, const void *b)
+{
+    const sim_leave_t *x = a, *y = b;
+
+    if (x->at != y->at) {
+        return (x->at > y->at) - (x->at < y->at);
+    }
+    return (x->host > y->host) - (x->host < y->host);
+}
+
+/* All members of the churned groups leave at random within ten seconds
+ * from the middle of the run */
+static int
+plan_leaves(const sim_options_t *options)
+{
+    uint32_t group, host;
+    uint64_t start = SIM_START + options->duration * 500;
+    size_t max;
+    long i;
+
+    max = options->churn * (sim.n_hosts / sim.n_groups + 1);
+    sim.leaves = calloc(max + 1, sizeof(*sim.leaves));
+    sim.leave_query = calloc(max + 1, sizeof(*sim.leave_query));
+    sim.leave_removal = calloc(options->churn + 1, sizeof(*sim.leave_removal));
+    sim.watch = calloc(options->churn + 1, sizeof(*sim.watch));
+    if (sim.leaves == NULL || sim.leave_query == NULL || sim.leave_removal == NULL ||
+        sim.watch == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < options->churn; i++) {
+        group = i * sim.n_groups / options->churn;
+        for (host = group; host < sim.n_hosts; host += sim.n_groups) {
+            sim.leaves[sim.n_leaves].at = start + sim_random() % 10000;
+            sim.leaves[sim.n_leaves].host = host;
+            sim.n_leaves++;
+        }
+    }
+    qsort(sim.leaves, sim.n_leaves, sizeof(*sim.leaves), compare_leave);
+
+    return 0;
+}
+
+static int
+sim_init(const sim_options_t *options)
+{
+    uint32_t host;
+    size_t ring = 1;
+
+    sim.now = SIM_START;
+    sim.cursor = SIM_START;
+    sim.rng = (uint64_t)options->seed * 0x9E3779B97F4A7C15ULL + 1;
+    sim.version = options->version;
+    sim.n_hosts = options->n_hosts;
+    sim.n_groups = options->n_groups;
+    sim.free_entry = -1;
+
+    /* Response delays stay below the query interval */
+    while (ring < (size_t)options->interval * 1000) {
+        ring <<= 1;
+    }
+    sim.ring_mask = ring - 1;
+    sim.buckets = malloc(ring * sizeof(*sim.buckets));
+
+    sim.report_at = calloc(sim.n_hosts, sizeof(*sim.report_at));
+    sim.sched_at = calloc(sim.n_hosts, sizeof(*sim.sched_at));
+    sim.flags = calloc(sim.n_hosts, sizeof(*sim.flags));
+    sim.heard = calloc(sim.n_groups, sizeof(*sim.heard));
+    sim.members = calloc(sim.n_groups, sizeof(*sim.members));
+    sim.leave_at = calloc(sim.n_groups, sizeof(*sim.leave_at));
+    sim.empty_at = calloc(sim.n_groups, sizeof(*sim.empty_at));
+    if (sim.buckets == NULL || sim.report_at == NULL || sim.sched_at == NULL ||
+        sim.flags == NULL || sim.heard == NULL || sim.members == NULL ||
+        sim.leave_at == NULL || sim.empty_at == NULL) {
+        return -1;
+    }
+    memset(sim.buckets, 0xff, ring * sizeof(*sim.buckets));
+
+    for (host = 0; host < sim.n_hosts; host++) {
+        sim.members[host % sim.n_groups]++;
+    }
+
+    return plan_leaves(options);
+}
+
+static void
+sim_free(void)
+{
+    free(sim.report_at);
+    free(sim.sched_at);
+    free(sim.flags);
+    free(sim.heard);
+    free(sim.members);
+    free(sim.leave_at);
+    free(sim.empty_at);
+    free(sim.buckets);
+    free(sim.entries);
+    free(sim.due);
+    free(sim.leaves);
+    free(sim.queries);
+    free(sim.leave_query);
+    free(sim.leave_removal);
+    free(sim.watch);
+}
+
+/* Groups whose last member left are timed until the engine drops them */
+static void
+check_removals(engine_t *engine)
+{
+    uint32_t group;
+    size_t i;
+
+    for (i = 0; i < sim.n_watch; ) {
+        group = sim.watch[i];
+        if (membership_lookup(&engine->groups, SIM_IFINDEX, group_addr(group)) != NULL) {
+            i++;
+            continue;
+        }
+        sim.leave_removal[sim.n_leave_removal++] = sim.now - sim.empty_at[group];
+        sim.watch[i] = sim.watch[--sim.n_watch];
+    }
+}
+
+static void
+print_latency(const char *what, uint64_t *samples, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    if (n == 0) {
+        printf("%s: none\n", what);
+        return;
+    }
+    qsort(samples, n, sizeof(*samples), compare_u64);
+    for (i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    printf("%s: %zu, mean %.1f ms, p50 %llu ms, p99 %llu ms, max %llu ms\n", what, n,
+        (double)sum / n, (unsigned long long)samples[n / 2],
+        (unsigned long long)samples[n * 99 / 100], (unsigned long long)samples[n - 1]);
+}
+
+static void
+print_results(engine_t *engine, uint64_t duration, uint64_t engine_cpu, double wall,
+    uint64_t peak_groups, size_t peak_used, size_t base_used)
+{
+    sim_query_t *q;
+    size_t i;
+    int j;
+
+    printf("Simulated %u hosts in %u groups, IGMPv%d, %.1f s virtual in %.2f s\n",
+        sim.n_hosts, sim.n_groups, sim.version, duration / 1000.0, wall);
+
+    printf("\nQuery  Time (s)  MRT (s)  Reports  Peak/%dms  Last (s)  "
+        "Reports per tenth of MRT (%%)\n", SIM_WINDOW);
+    for (i = 0; i < sim.n_queries; i++) {
+        q = &sim.queries[i];
+        printf("%5zu  %8.3f  %7.1f  %7llu  %9llu  %8.3f ", i + 1,
+            (q->sent - SIM_START) / 1000.0, q->mrt / 1000.0,
+            (unsigned long long)q->reports, (unsigned long long)q->peak,
+            (q->reports > 0 ? (q->last - q->sent) / 1000.0 : 0.0));
+        for (j = 0; j < SIM_DECILES; j++) {
+            printf(" %3.0f", (q->reports > 0 ? 100.0 * q->deciles[j] / q->reports : 0.0));
+        }
+        printf("\n");
+    }
+    printf("Reports to group-specific queries: %llu\n", (unsigned long long)sim.specific);
+    if (sim.version == 2) {
+        printf("Suppressed reports: %llu\n", (unsigned long long)sim.suppressed);
+    }
+
+    printf("\n");
+    print_latency("Leaves answered by a group-specific query", sim.leave_query,
+        sim.n_leave_query);
+    print_latency("Emptied groups removed", sim.leave_removal, sim.n_leave_removal);
+    if (sim.n_watch > 0) {
+        printf("Emptied groups still present: %zu\n", sim.n_watch);
+    }
+
+    printf("\nEngine CPU: %.0f ns per packet, %llu received, %llu sent\n",
+        (sim.received + sim.sent > 0 ? (double)engine_cpu / (sim.received + sim.sent) : 0.0),
+        (unsigned long long)sim.received, (unsigned long long)sim.sent);
+    printf("Memory: %.0f bytes per group at %llu groups, %zu bytes index, %zu bytes in use\n",
+        (peak_groups > 0 ? (double)(peak_used - base_used) / peak_groups : 0.0),
+        (unsigned long long)peak_groups, base_used, peak_used);
+    printf("Memory refusals: %llu\n", (unsigned long long)engine->groups.refused);
+}
+
+static void
+usage(char *command)
+{
+    printf("usage: %s [-Fh] [-n HOSTS] [-g GROUPS] [-Q VERSION] [-r MAXRESP] [-s INTERVAL]\n"
+        "       [-t SECONDS] [-c CHURN] [-A PPS] [-P RATE[,BURST]] [-M KBYTES] [-S SEED]\n",
+        command);
+}
+
+static int
+parse_number(const char *arg, long min, long max, long *value)
+{
+    char *endptr = NULL;
+
+    errno = 0;
+    *value = strtol(arg, &endptr, 10);
+    if (*arg == '\0' || *endptr != '\0' || errno != 0 || *value < min || *value > max) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+parse_command_line(int argc, char **argv, sim_options_t *options)
+{
+    char *sep;
+    int c;
+
+    while ((c = getopt(argc, argv, "A:c:Fg:hM:n:P:Q:r:s:S:t:")) != -1) {
+        switch (c) {
+        case 'A':
+            if (parse_number(optarg, 1, INT_MAX, &options->mrt_target) != 0) {
+                fprintf(stderr, "Error: Invalid report rate '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'c':
+            if (parse_number(optarg, 0, INT_MAX, &options->churn) != 0) {
+                fprintf(stderr, "Error: Invalid number of churned groups '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'F':
+            options->fast_leave = 1;
+            break;
+
+        case 'g':
+            if (parse_number(optarg, 1, 1 << 22, &options->n_groups) != 0) {
+                fprintf(stderr, "Error: Invalid number of groups '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'M':
+            if (parse_number(optarg, 64, 16 * 1024 * 1024, &options->memory) != 0) {
+                fprintf(stderr, "Error: Invalid memory limit '%s'\n", optarg);
+                return -1;
+            }
+            options->memory *= 1024;
+            break;
+
+        case 'n':
+            if (parse_number(optarg, 1, SIM_HOSTS_MAX, &options->n_hosts) != 0) {
+                fprintf(stderr, "Error: Invalid number of hosts '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'P':
+            sep = strchr(optarg, ',');
+            if (sep != NULL) {
+                *sep++ = '\0';
+                if (parse_number(sep, 1, INT_MAX, &options->pace_burst) != 0) {
+                    fprintf(stderr, "Error: Invalid query burst '%s'\n", sep);
+                    return -1;
+                }
+            }
+            if (parse_number(optarg, 0, INT_MAX, &options->pace_rate) != 0) {
+                fprintf(stderr, "Error: Invalid query rate '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'Q':
+            if (parse_number(optarg, 2, 3, &options->version) != 0) {
+                fprintf(stderr, "Error: Invalid IGMP version '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'r':
+            if (parse_number(optarg, 1, IGMP_CODE_MAX, &options->max_resp) != 0) {
+                fprintf(stderr, "Error: Invalid max response time '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 's':
+            if (parse_number(optarg, 1, 3600, &options->interval) != 0) {
+                fprintf(stderr, "Error: Invalid interval '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'S':
+            if (parse_number(optarg, 0, LONG_MAX, &options->seed) != 0) {
+                fprintf(stderr, "Error: Invalid seed '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 't':
+            if (parse_number(optarg, 1, 86400, &options->duration) != 0) {
+                fprintf(stderr, "Error: Invalid duration '%s'\n", optarg);
+                return -1;
+            }
+            break;
+
+        case 'h':
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (argc != optind) {
+        usage(argv[0]);
+        return -1;
+    }
+    if (options->max_resp >= options->interval * 10) {
+        fprintf(stderr, "Error: Max response time must be shorter than the interval\n");
+        return -1;
+    }
+    if (options->version == 2 && options->max_resp > 255) {
+        fprintf(stderr, "Error: IGMPv2 max response time is at most 255\n");
+        return -1;
+    }
+    if (options->n_groups > options->n_hosts || options->churn > options->n_groups) {
+        fprintf(stderr, "Error: Every group needs a member, churned groups must exist\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    sim_options_t options;
+    igmp_params_t params;
+    engine_t engine;
+    struct in_addr addr;
+    uint64_t end, next, limit, engine_cpu = 0, peak_groups = 0, groups, start, host_cpu;
+    size_t base_used, peak_used = 0;
+    struct timespec t0, t1;
+    iface_t *iface;
+
+    memset(&options, 0, sizeof(options));
+    options.n_hosts = 10000;
+    options.n_groups = 1000;
+    options.version = 3;
+    options.max_resp = IGMP_QUERY_RESPONSE_INTERVAL;
+    options.interval = 125;
+    options.duration = 600;
+    options.churn = 10;
+    options.memory = ENGINE_MEMORY_DEFAULT;
+    options.seed = 1;
+    options.pace_rate = ENGINE_PACE_RATE;
+    options.pace_burst = ENGINE_PACE_BURST;
+    if (parse_command_line(argc, argv, &options) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    init_logger(0);
+    if (sim_init(&options) != 0) {
+        fprintf(stderr, "Error: Could not allocate memory for %ld hosts\n", options.n_hosts);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The engine runs on the virtual clock from the start */
+    engine_set_clock(virtual_now_us);
+    srandom(options.seed);
+
+    params.family = AF_INET;
+    params.version = options.version;
+    params.max_resp = options.max_resp;
+    params.robustness = IGMP_ROBUSTNESS;
+    params.interval = options.interval;
+    params.lmqi = IGMP_LAST_MEMBER_INTERVAL;
+    params.lmqc = IGMP_ROBUSTNESS;
+    params.jitter = 0;
+    if (engine_init(&engine, &params, options.memory) != 0) {
+        goto fail;
+    }
+    engine_set_fast_leave(&engine, options.fast_leave);
+    engine_set_pacing(&engine, options.pace_rate, options.pace_burst);
+    engine_set_adaptive(&engine, options.mrt_target, ENGINE_MRT_MIN, ENGINE_MRT_MAX);
+
+    addr.s_addr = htonl(SIM_QUERIER);
+    if (engine_add_virtual_iface(&engine, "sim0", SIM_IFINDEX, addr, &sim_ops) != 0) {
+        goto fail;
+    }
+    iface = engine.ifaces;
+    base_used = engine.groups.arena.used;
+
+    if (start_logger() != 0) {
+        goto fail;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    engine_start(&engine);
+
+    /* Jump from one event to the next: a report timer, a leave or an
+     * engine timer, and let the engine work through what is due */
+    end = SIM_START + options.duration * 1000;
+    for (;;) {
+        collect();
+        do {
+            start = cpu_ns();
+            host_cpu = sim.host_cpu;
+            engine_poll(&engine);
+            engine_cpu += cpu_ns() - start - (sim.host_cpu - host_cpu);
+        } while (sim.n_due > 0);
+        check_removals(&engine);
+
+        groups = STATS_GET(&iface->stats, groups);
+        if (groups > peak_groups) {
+            peak_groups = groups;
+            peak_used = engine.groups.arena.used;
+        }
+
+        limit = engine_next_timer(&engine);
+        if (sim.next_leave < sim.n_leaves && sim.leaves[sim.next_leave].at < limit) {
+            limit = sim.leaves[sim.next_leave].at;
+        }
+        next = next_report(limit < end ? limit : end);
+        if (next <= sim.now) {
+            next = sim.now + 1;
+        }
+        if (next >= end) {
+            break;
+        }
+        sim.now = next;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    print_results(&engine, end - SIM_START, engine_cpu, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9,
+        peak_groups, peak_used, base_used);
+
+    engine_close(&engine);
+    close_logger();
+    sim_free();
+    exit(EXIT_SUCCESS);
+
+fail:
+    engine_close(&engine);
+    close_logger();
+    sim_free();
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,342 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "snapshot.h"
+
+#define BOOT_ID_PATH "/proc/sys/kernel/random/boot_id"
+
+static void
+read_boot_id(char *buf, size_t len)
+{
+    FILE *fp;
+
+    memset(buf, 0, len);
+    fp = fopen(BOOT_ID_PATH, "r");
+    if (fp == NULL) {
+        return;
+    }
+    if (fgets(buf, len, fp) != NULL) {
+        buf[strcspn(buf, "\n")] = '\0';
+    }
+    fclose(fp);
+}
+
+static uint32_t
+alloc_record(snapshot_t *snap)
+{
+    return (snap->n_free > 0 ? snap->free[--snap->n_free] : 0);
+}
+
+static void
+free_record(snapshot_t *snap, uint32_t index)
+{
+    snap->records[index].type = SNAPSHOT_FREE;
+    snap->free[snap->n_free++] = index;
+}
+
+/* Follows a group's source chain, returning the number of sources or -1
+ * if the chain is damaged. Decodes into the buffer when asked to. */
+static ssize_t
+walk_chain(snapshot_t *snap, uint32_t index, uint8_t *used, source_t *out)
+{
+    snapshot_record_t *rec = &snap->records[index];
+    uint32_t blk;
+    size_t n = 0;
+    int i;
+
+    for (blk = rec->next; blk != 0; blk = snap->records[blk].next) {
+        if (blk > snap->header->capacity || snap->records[blk].type != SNAPSHOT_SOURCES ||
+                snap->records[blk].n > SNAPSHOT_BLOCK ||
+                n + snap->records[blk].n > SOURCES_MAX || (used != NULL && used[blk])) {
+            return -1;
+        }
+        if (used != NULL) {
+            used[blk] = 1;
+        }
+        for (i = 0; out != NULL && i < snap->records[blk].n; i++) {
+            out[n + i].addr = snap->records[blk].u.sources.addr[i];
+            out[n + i].expires = snap->records[blk].u.sources.expires[i];
+            out[n + i].retrans = 0;
+        }
+        n += snap->records[blk].n;
+    }
+
+    return (n == rec->n ? (ssize_t)n : -1);
+}
+
+static int
+reset(snapshot_t *snap, uint32_t capacity, const char *boot_id)
+{
+    /* Dropping the old contents leaves a sparse, all free file */
+    if (ftruncate(snap->fd, 0) != 0 || ftruncate(snap->fd, snap->size) != 0) {
+        logger(LOG_LEVEL_ERR, "Could not size membership snapshot: %s", strerror(errno));
+        return -1;
+    }
+    snap->header->magic = SNAPSHOT_MAGIC;
+    snap->header->version = SNAPSHOT_VERSION;
+    snap->header->record_size = sizeof(snapshot_record_t);
+    snap->header->capacity = capacity;
+    memcpy(snap->header->boot_id, boot_id, sizeof(snap->header->boot_id));
+
+    return 0;
+}
+
+int
+snapshot_open(snapshot_t *snap, const char *path, uint32_t capacity)
+{
+    char boot_id[sizeof(snap->header->boot_id)];
+    uint8_t *used = NULL;
+    struct stat st;
+    uint32_t i;
+
+    memset(snap, 0, offsetof(snapshot_t, buf));
+    snap->fd = -1;
+    snap->size = ((size_t)capacity + 1) * sizeof(snapshot_record_t);
+    read_boot_id(boot_id, sizeof(boot_id));
+
+    snap->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (snap->fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not open membership snapshot '%s': %s", path,
+            strerror(errno));
+        return -1;
+    }
+    if (fstat(snap->fd, &st) != 0 || (st.st_size != snap->size &&
+            ftruncate(snap->fd, snap->size) != 0)) {
+        logger(LOG_LEVEL_ERR, "Could not size membership snapshot '%s': %s", path,
+            strerror(errno));
+        goto fail;
+    }
+
+    snap->header = mmap(NULL, snap->size, PROT_READ | PROT_WRITE, MAP_SHARED, snap->fd, 0);
+    if (snap->header == MAP_FAILED) {
+        snap->header = NULL;
+        logger(LOG_LEVEL_ERR, "Could not map membership snapshot '%s': %s", path,
+            strerror(errno));
+        goto fail;
+    }
+    snap->records = (snapshot_record_t*)snap->header;
+
+    snap->free = malloc(capacity * sizeof(*snap->free));
+    snap->pending = malloc(capacity * sizeof(*snap->pending));
+    used = calloc(capacity + 1, 1);
+    if (snap->free == NULL || snap->pending == NULL || used == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate membership snapshot index: %s",
+            strerror(errno));
+        goto fail;
+    }
+
+    /* Times are CLOCK_MONOTONIC, which starts over on reboot */
+    if (st.st_size != snap->size || snap->header->magic != SNAPSHOT_MAGIC ||
+            snap->header->version != SNAPSHOT_VERSION ||
+            snap->header->record_size != sizeof(snapshot_record_t) ||
+            snap->header->capacity != capacity ||
+            strncmp(snap->header->boot_id, boot_id, sizeof(boot_id)) != 0) {
+        if (st.st_size > 0) {
+            logger(LOG_LEVEL_INFO, "Discarding membership snapshot '%s' from another "
+                "version, size or boot", path);
+        }
+        if (reset(snap, capacity, boot_id) != 0) {
+            goto fail;
+        }
+    }
+
+    /* Groups with intact chains wait for their interface to come up,
+     * everything else is free */
+    for (i = 1; i <= capacity; i++) {
+        if (snap->records[i].type == SNAPSHOT_GROUP && walk_chain(snap, i, used, NULL) >= 0) {
+            used[i] = 1;
+            snap->pending[snap->n_pending++] = i;
+        }
+    }
+    for (i = capacity; i >= 1; i--) {
+        if (!used[i]) {
+            if (snap->records[i].type != SNAPSHOT_FREE) {
+                snap->records[i].type = SNAPSHOT_FREE;
+            }
+            snap->free[snap->n_free++] = i;
+        }
+    }
+    free(used);
+
+    return 0;
+
+fail:
+    free(used);
+    snapshot_close(snap);
+    return -1;
+}
+
+/* Hands the loaded groups of one interface to the callback. Groups
+ * already timed out are dropped along the way, whatever their interface. */
+size_t
+snapshot_restore(snapshot_t *snap, const char *ifname, uint64_t now,
+    snapshot_cb_t cb, void *arg)
+{
+    snapshot_record_t *rec;
+    snapshot_entry_t entry;
+    uint32_t i, j = 0, index;
+    size_t n, k, restored = 0;
+    int live;
+
+    for (i = 0; i < snap->n_pending; i++) {
+        index = snap->pending[i];
+        rec = &snap->records[index];
+        n = (size_t)walk_chain(snap, index, NULL, snap->buf);
+
+        live = (rec->u.group.expires > now);
+        for (k = 0; k < n && !live; k++) {
+            live = (snap->buf[k].expires > now);
+        }
+
+        if (live && strncmp(rec->u.group.ifname, ifname, IF_NAMESIZE) != 0) {
+            snap->pending[j++] = index;
+            continue;
+        }
+
+        if (live) {
+            entry.index = index;
+            entry.addr = rec->u.group.addr;
+            entry.mode = rec->mode;
+            entry.expires = rec->u.group.expires;
+            entry.sources = snap->buf;
+            entry.n_sources = n;
+            if (cb(&entry, arg) == 0) {
+                restored++;
+                continue;
+            }
+        }
+        snapshot_drop(snap, &index);
+    }
+    snap->n_pending = j;
+
+    return restored;
+}
+
+/* Rewrites a group in place, reusing its source records as far as they
+ * go. A group that no longer fits is dropped from the file. */
+int
+snapshot_save(snapshot_t *snap, uint32_t *index, const char *ifname, struct in_addr addr,
+    uint8_t mode, uint64_t expires, const source_t *src, size_t n)
+{
+    snapshot_record_t *rec, *blk;
+    uint32_t *link, next;
+    size_t i, k;
+
+    if (*index == 0) {
+        *index = alloc_record(snap);
+        if (*index == 0) {
+            snap->failures++;
+            return -1;
+        }
+        snap->records[*index].next = 0;
+    }
+    rec = &snap->records[*index];
+    __atomic_store_n(&rec->type, SNAPSHOT_FREE, __ATOMIC_RELEASE);
+
+    link = &rec->next;
+    for (i = 0; i < n; i += SNAPSHOT_BLOCK) {
+        if (*link == 0) {
+            *link = alloc_record(snap);
+            if (*link == 0) {
+                snapshot_drop(snap, index);
+                snap->failures++;
+                return -1;
+            }
+            snap->records[*link].next = 0;
+        }
+        blk = &snap->records[*link];
+        blk->n = (n - i < SNAPSHOT_BLOCK ? n - i : SNAPSHOT_BLOCK);
+        for (k = 0; k < blk->n; k++) {
+            blk->u.sources.addr[k] = src[i + k].addr;
+            blk->u.sources.expires[k] = src[i + k].expires;
+        }
+        blk->type = SNAPSHOT_SOURCES;
+        link = &blk->next;
+    }
+
+    /* Records the shorter list no longer needs */
+    next = *link;
+    *link = 0;
+    while (next != 0) {
+        blk = &snap->records[next];
+        free_record(snap, next);
+        next = blk->next;
+    }
+
+    rec->mode = mode;
+    rec->n = n;
+    rec->u.group.addr = addr;
+    rec->u.group.expires = expires;
+    snprintf(rec->u.group.ifname, sizeof(rec->u.group.ifname), "%s", ifname);
+    __atomic_store_n(&rec->type, SNAPSHOT_GROUP, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void
+snapshot_drop(snapshot_t *snap, uint32_t *index)
+{
+    uint32_t next;
+
+    if (*index == 0) {
+        return;
+    }
+    next = snap->records[*index].next;
+    __atomic_store_n(&snap->records[*index].type, SNAPSHOT_FREE, __ATOMIC_RELEASE);
+    free_record(snap, *index);
+    while (next != 0) {
+        free_record(snap, next);
+        next = snap->records[next].next;
+    }
+    *index = 0;
+}
+
+void
+snapshot_close(snapshot_t *snap)
+{
+    if (snap->header != NULL) {
+        munmap(snap->header, snap->size);
+        snap->header = NULL;
+        snap->records = NULL;
+    }
+    if (snap->fd >= 0) {
+        close(snap->fd);
+        snap->fd = -1;
+    }
+    free(snap->free);
+    free(snap->pending);
+    snap->free = NULL;
+    snap->pending = NULL;
+}
@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include "sources.h"
+
+#define SNAPSHOT_MAGIC   0x50534d47u    /* "GMSP" */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BLOCK   4              /* Sources per continuation record */
+
+#define SNAPSHOT_FREE    0
+#define SNAPSHOT_GROUP   1
+#define SNAPSHOT_SOURCES 2
+
+/* File header, also the size of one record */
+typedef struct snapshot_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;                  /* Records following the header */
+    uint32_t reserved;
+    char     boot_id[40];               /* Monotonic times only hold within one boot */
+    uint8_t  pad[8];
+} snapshot_header_t;
+
+/* A group record, chained to as many source records as its list needs.
+ * The type is written last, so a record torn by a crash reads as free. */
+typedef struct snapshot_record {
+    uint8_t  type;
+    uint8_t  mode;
+    uint16_t n;                         /* Sources, of the group or in this record */
+    uint32_t next;                      /* Next source record, 0 ends the chain */
+    union {
+        struct {
+            struct in_addr addr;
+            uint32_t       reserved;
+            uint64_t       expires;     /* Group timer, CLOCK_MONOTONIC ms, 0 if stopped */
+            char           ifname[IF_NAMESIZE];
+        } group;
+        struct {
+            uint32_t addr[SNAPSHOT_BLOCK];
+            uint64_t expires[SNAPSHOT_BLOCK];
+        } sources;
+    } u;
+    uint8_t  pad[8];
+} snapshot_record_t;
+
+/* Group found in the file, sources decoded into the snapshot's buffer */
+typedef struct snapshot_entry {
+    uint32_t        index;
+    struct in_addr  addr;
+    uint8_t         mode;
+    uint64_t        expires;
+    const source_t *sources;
+    size_t          n_sources;
+} snapshot_entry_t;
+
+/* Returns 0 when the entry was taken over, its record then stays in use */
+typedef int (*snapshot_cb_t)(const snapshot_entry_t *entry, void *arg);
+
+/* Membership table mirrored into a shared file mapping. Records are
+ * updated in place as groups change, so the page cache holds current
+ * state when the daemon exits. */
+typedef struct snapshot {
+    int                fd;
+    snapshot_header_t *header;
+    snapshot_record_t *records;         /* Record 0 is the header */
+    size_t             size;
+    uint32_t          *free;
+    uint32_t           n_free;
+    uint32_t          *pending;         /* Groups loaded but not yet restored */
+    uint32_t           n_pending;
+    uint64_t           failures;        /* Saves that did not fit */
+    source_t           buf[SOURCES_MAX];
+} snapshot_t;
+
+int snapshot_open(snapshot_t *snap, const char *path, uint32_t capacity);
+
+size_t snapshot_restore(snapshot_t *snap, const char *ifname, uint64_t now,
+    snapshot_cb_t cb, void *arg);
+
+int snapshot_save(snapshot_t *snap, uint32_t *index, const char *ifname, struct in_addr addr,
+    uint8_t mode, uint64_t expires, const source_t *src, size_t n);
+
+void snapshot_drop(snapshot_t *snap, uint32_t *index);
+
+void snapshot_close(snapshot_t *snap);
+
+#endif /* __SNAPSHOT_H__ */
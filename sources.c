@@ -0,0 +1,257 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "igmp.h"
+#include "sources.h"
+
+/* What a report does to the sources only in the current state (old),
+ * only in the report (new) and in both, following the tables in RFC 3376,
+ * sections 6.4.1 and 6.4.2 */
+#define OLD_KEEP  0
+#define OLD_DROP  1
+
+#define NEW_SKIP  0
+#define NEW_GMI   1
+#define NEW_ZERO  2
+#define NEW_GROUP 3
+
+#define BOTH_KEEP 0
+#define BOTH_GMI  1
+
+/* Classes whose sources are queried, if their timer runs */
+#define Q_OLD  0x01
+#define Q_NEW  0x02
+#define Q_BOTH 0x04
+
+typedef struct rule {
+    uint8_t old;
+    uint8_t new;
+    uint8_t both;
+    uint8_t query;
+    uint8_t mode;           /* Resulting filter mode */
+    uint8_t group_timer;    /* Group timer set to GMI */
+} rule_t;
+
+/* Indexed by filter mode, then record type */
+static const rule_t rules[2][7] = {
+    [SOURCES_INCLUDE] = {
+        [IGMP_MODE_IS_INCLUDE]        = { OLD_KEEP, NEW_GMI,  BOTH_GMI,  0,      SOURCES_INCLUDE, 0 },
+        [IGMP_MODE_IS_EXCLUDE]        = { OLD_DROP, NEW_ZERO, BOTH_KEEP, 0,      SOURCES_EXCLUDE, 1 },
+        [IGMP_CHANGE_TO_INCLUDE_MODE] = { OLD_KEEP, NEW_GMI,  BOTH_GMI,  Q_OLD,  SOURCES_INCLUDE, 0 },
+        [IGMP_CHANGE_TO_EXCLUDE_MODE] = { OLD_DROP, NEW_ZERO, BOTH_KEEP, Q_BOTH, SOURCES_EXCLUDE, 1 },
+        [IGMP_ALLOW_NEW_SOURCES]      = { OLD_KEEP, NEW_GMI,  BOTH_GMI,  0,      SOURCES_INCLUDE, 0 },
+        [IGMP_BLOCK_OLD_SOURCES]      = { OLD_KEEP, NEW_SKIP, BOTH_KEEP, Q_BOTH, SOURCES_INCLUDE, 0 },
+    },
+    [SOURCES_EXCLUDE] = {
+        [IGMP_MODE_IS_INCLUDE]        = { OLD_KEEP, NEW_GMI,   BOTH_GMI,  0,              SOURCES_EXCLUDE, 0 },
+        [IGMP_MODE_IS_EXCLUDE]        = { OLD_DROP, NEW_GMI,   BOTH_KEEP, 0,              SOURCES_EXCLUDE, 1 },
+        [IGMP_CHANGE_TO_INCLUDE_MODE] = { OLD_KEEP, NEW_GMI,   BOTH_GMI,  Q_OLD,          SOURCES_EXCLUDE, 0 },
+        [IGMP_CHANGE_TO_EXCLUDE_MODE] = { OLD_DROP, NEW_GROUP, BOTH_KEEP, Q_NEW | Q_BOTH, SOURCES_EXCLUDE, 1 },
+        [IGMP_ALLOW_NEW_SOURCES]      = { OLD_KEEP, NEW_GMI,   BOTH_GMI,  0,              SOURCES_EXCLUDE, 0 },
+        [IGMP_BLOCK_OLD_SOURCES]      = { OLD_KEEP, NEW_GROUP, BOTH_KEEP, Q_NEW | Q_BOTH, SOURCES_EXCLUDE, 0 },
+    },
+};
+
+/* Least significant byte first radix sort, four passes over the keys
+ * with all histograms taken in the first one */
+static void
+radix_sort(uint32_t *addrs, uint32_t *tmp, size_t n)
+{
+    size_t count[4][256];
+    size_t i, sum, c;
+    uint32_t *src = addrs, *dst = tmp, *swap;
+    int pass, b;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i++) {
+        for (pass = 0; pass < 4; pass++) {
+            count[pass][(addrs[i] >> (pass * 8)) & 0xFF]++;
+        }
+    }
+
+    for (pass = 0; pass < 4; pass++) {
+        for (b = 0, sum = 0; b < 256; b++) {
+            c = count[pass][b];
+            count[pass][b] = sum;
+            sum += c;
+        }
+        for (i = 0; i < n; i++) {
+            dst[count[pass][(src[i] >> (pass * 8)) & 0xFF]++] = src[i];
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+    /* An even number of passes leaves the result back in addrs */
+}
+
+/* Sorts a report source list in place and drops duplicates, tmp must
+ * hold as many entries as addrs */
+size_t
+sources_sort(uint32_t *addrs, uint32_t *tmp, size_t n)
+{
+    size_t i, j;
+    uint32_t key;
+
+    if (n < 2) {
+        return n;
+    }
+
+    if (n < 32) {
+        for (i = 1; i < n; i++) {
+            key = addrs[i];
+            for (j = i; j > 0 && addrs[j - 1] > key; j--) {
+                addrs[j] = addrs[j - 1];
+            }
+            addrs[j] = key;
+        }
+    } else {
+        radix_sort(addrs, tmp, n);
+    }
+
+    for (i = 1, j = 0; i < n; i++) {
+        if (addrs[i] != addrs[j]) {
+            addrs[++j] = addrs[i];
+        }
+    }
+
+    return j + 1;
+}
+
+static inline void
+mark(source_t *src, int query, const sources_times_t *times, size_t *queried)
+{
+    /* Excluded sources have nothing to lose by a query */
+    if (!query || src->expires == 0) {
+        return;
+    }
+    if (src->expires > times->lmqt) {
+        src->expires = times->lmqt;
+    }
+    src->retrans = times->lmqc;
+    (*queried)++;
+}
+
+/* Applies one group record to the sorted source list of a group in a
+ * single merge pass, writing at most SOURCES_MAX sources to out. Returns
+ * the number of sources marked for group-and-source-specific queries. */
+size_t
+sources_apply(int *mode, int *group_timer, int type, const source_t *cur, size_t n_cur,
+    const uint32_t *report, size_t n_report, const sources_times_t *times,
+    source_t *out, size_t *n_out)
+{
+    const rule_t *rule;
+    size_t i = 0, j = 0, n = 0, queried = 0;
+    source_t *src;
+
+    if (type < IGMP_MODE_IS_INCLUDE || type > IGMP_BLOCK_OLD_SOURCES) {
+        *n_out = 0;
+        for (i = 0; i < n_cur; i++) {
+            out[(*n_out)++] = cur[i];
+        }
+        *group_timer = 0;
+        return 0;
+    }
+    rule = &rules[*mode][type];
+
+    while ((i < n_cur || j < n_report) && n < SOURCES_MAX) {
+        src = &out[n];
+        if (j == n_report || (i < n_cur && cur[i].addr < report[j])) {
+            /* Only in the current state */
+            i++;
+            if (rule->old == OLD_DROP) {
+                continue;
+            }
+            *src = cur[i - 1];
+            mark(src, rule->query & Q_OLD, times, &queried);
+        } else if (i == n_cur || report[j] < cur[i].addr) {
+            /* Only in the report */
+            j++;
+            if (rule->new == NEW_SKIP) {
+                continue;
+            }
+            src->addr = report[j - 1];
+            src->retrans = 0;
+            src->expires = (rule->new == NEW_GMI ? times->gmi :
+                rule->new == NEW_GROUP ? times->group : 0);
+            mark(src, rule->query & Q_NEW, times, &queried);
+        } else {
+            *src = cur[i];
+            if (rule->both == BOTH_GMI) {
+                /* Reported again, which answers any pending query */
+                src->expires = times->gmi;
+                src->retrans = 0;
+            }
+            mark(src, rule->query & Q_BOTH, times, &queried);
+            i++;
+            j++;
+        }
+        n++;
+    }
+
+    *mode = rule->mode;
+    *group_timer = rule->group_timer;
+    *n_out = n;
+
+    return queried;
+}
+
+/* Runs the source timers up to now: expired sources are deleted in
+ * INCLUDE mode and blocked in EXCLUDE mode (RFC 3376, section 6.3) */
+size_t
+sources_expire(source_t *src, size_t n, int mode, uint64_t now)
+{
+    size_t i, j = 0;
+
+    for (i = 0; i < n; i++) {
+        if (src[i].expires != 0 && src[i].expires <= now) {
+            if (mode == SOURCES_INCLUDE) {
+                continue;
+            }
+            src[i].expires = 0;
+            src[i].retrans = 0;
+        }
+        src[j++] = src[i];
+    }
+
+    return j;
+}
+
+uint64_t
+sources_next_expiry(const source_t *src, size_t n)
+{
+    uint64_t next = UINT64_MAX;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (src[i].expires != 0 && src[i].expires < next) {
+            next = src[i].expires;
+        }
+    }
+
+    return next;
+}
@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SOURCES_H__
+#define __SOURCES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sources kept per group, bounds both memory and report processing time */
+#define SOURCES_MAX 1024
+
+/* Router filter mode of a group (RFC 3376, section 6.2.1) */
+#define SOURCES_INCLUDE 0
+#define SOURCES_EXCLUDE 1
+
+/* Source record. In EXCLUDE mode a stopped timer (0) marks the sources
+ * to block, the rest are the requested list. */
+typedef struct source {
+    uint32_t addr;      /* Host byte order, arrays are sorted by it */
+    uint8_t  retrans;   /* Group-and-source queries still to send */
+    uint64_t expires;   /* Source timer, milliseconds */
+} source_t;
+
+/* Absolute deadlines a report may assign, in milliseconds */
+typedef struct sources_times {
+    uint64_t gmi;       /* Now plus Group Membership Interval */
+    uint64_t group;     /* Current group timer */
+    uint64_t lmqt;      /* Now plus Last Member Query Time */
+    uint8_t  lmqc;
+} sources_times_t;
+
+size_t sources_sort(uint32_t *addrs, uint32_t *tmp, size_t n);
+
+size_t sources_apply(int *mode, int *group_timer, int type, const source_t *cur, size_t n_cur,
+    const uint32_t *report, size_t n_report, const sources_times_t *times,
+    source_t *out, size_t *n_out);
+
+size_t sources_expire(source_t *src, size_t n, int mode, uint64_t now);
+
+uint64_t sources_next_expiry(const source_t *src, size_t n);
+
+#endif /* __SOURCES_H__ */
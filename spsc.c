@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "spsc.h"
+
+int
+spsc_init(spsc_t *q, size_t size, size_t elem)
+{
+    q->head = 0;
+    q->tail = 0;
+    q->size = size;
+    q->elem = elem;
+    q->slots = malloc(size * elem);
+    if (q->slots == NULL) {
+        logger(LOG_LEVEL_ERR, "Could not allocate queue: %s", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+spsc_free(spsc_t *q)
+{
+    free(q->slots);
+    q->slots = NULL;
+}
+
+/* Producer side, fails with the queue full */
+int
+spsc_push(spsc_t *q, const void *msg)
+{
+    uint64_t head = q->head;
+
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->size) {
+        return -1;
+    }
+    memcpy(q->slots + (head & (q->size - 1)) * q->elem, msg, q->elem);
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Consumer side, returns 0 with the queue empty */
+int
+spsc_pop(spsc_t *q, void *msg)
+{
+    uint64_t tail = q->tail;
+
+    if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail) {
+        return 0;
+    }
+    memcpy(msg, q->slots + (tail & (q->size - 1)) * q->elem, q->elem);
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+/* Bounded lock-free queue of fixed size messages between exactly one
+ * producer and one consumer thread. Each side only ever writes its own
+ * index, kept on a cache line of its own. */
+typedef struct spsc {
+    uint64_t  head __attribute__((aligned(STATS_CACHELINE)));   /* Producer */
+    uint64_t  tail __attribute__((aligned(STATS_CACHELINE)));   /* Consumer */
+    size_t    size __attribute__((aligned(STATS_CACHELINE)));   /* Slots, a power of two */
+    size_t    elem;
+    uint8_t  *slots;
+} spsc_t;
+
+int spsc_init(spsc_t *q, size_t size, size_t elem);
+
+void spsc_free(spsc_t *q);
+
+int spsc_push(spsc_t *q, const void *msg);
+
+int spsc_pop(spsc_t *q, void *msg);
+
+#endif /* __SPSC_H__ */
@@ -0,0 +1,478 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "logging.h"
+#include "stats.h"
+
+const uint64_t stats_hist_bounds[STATS_HIST_BUCKETS - 1] = {
+    10, 100, 1000, 10000, 100000, 1000000,
+};
+
+void
+stats_observe(stats_hist_t *hist, uint64_t usec)
+{
+    int i;
+
+    for (i = 0; i < STATS_HIST_BUCKETS - 1; i++) {
+        if (usec <= stats_hist_bounds[i]) {
+            break;
+        }
+    }
+    STATS_INC(hist, buckets[i]);
+    STATS_ADD(hist, sum, usec);
+}
+
+static void
+server_init(stats_server_t *server)
+{
+    int i;
+
+    memset(server, 0, sizeof(*server));
+    for (i = 0; i < STATS_MAX_CLIENTS; i++) {
+        server->clients[i].fd = -1;
+    }
+}
+
+int
+stats_server_open(stats_server_t *server, const char *path)
+{
+    struct sockaddr_un sun;
+
+    server_init(server);
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        logger(LOG_LEVEL_ERR, "Stats socket path '%s' too long", path);
+        server->fd = -1;
+        return -1;
+    }
+
+    server->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not create stats socket: %s", strerror(errno));
+        return -1;
+    }
+
+    /* A stale socket from an earlier run would make bind() fail */
+    unlink(path);
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+    if (bind(server->fd, (struct sockaddr*)&sun, sizeof(sun)) < 0 ||
+        listen(server->fd, STATS_MAX_CLIENTS) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not listen on stats socket '%s': %s",
+            path, strerror(errno));
+        close(server->fd);
+        server->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+render_hist(FILE *out, const char *metric, const char *labels, stats_hist_t *hist)
+{
+    uint64_t cumulative = 0;
+    int i;
+
+    for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+        cumulative += STATS_GET(hist, buckets[i]);
+        if (i < STATS_HIST_BUCKETS - 1) {
+            fprintf(out, "%s_bucket{%s,le=\"%g\"} %llu\n", metric,
+                labels, stats_hist_bounds[i] / 1e6, (unsigned long long)cumulative);
+        } else {
+            fprintf(out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", metric,
+                labels, (unsigned long long)cumulative);
+        }
+    }
+    fprintf(out, "%s_sum{%s} %g\n", metric, labels, STATS_GET(hist, sum) / 1e6);
+    fprintf(out, "%s_count{%s} %llu\n", metric, labels, (unsigned long long)cumulative);
+}
+
+static void
+render_iface(FILE *out, iface_t *iface)
+{
+    stats_t *stats = &iface->stats;
+    char labels[IFNAMSIZ + 64];
+    int i, first;
+
+    /* An interface can run IGMP and MLD side by side. MLDv1 and MLDv2
+     * reports are counted as their IGMPv2 and IGMPv3 equivalents. */
+    if (iface->params.family == AF_INET6) {
+        snprintf(labels, sizeof(labels), "interface=\"%s\",protocol=\"mld\"", iface->name);
+        first = 1;
+    } else {
+        snprintf(labels, sizeof(labels), "interface=\"%s\",protocol=\"igmp\"", iface->name);
+        first = 0;
+    }
+
+    fprintf(out, "igmpqd_querier{%s} %d\n", labels, iface->querier);
+    fprintf(out, "igmpqd_max_response_seconds{%s} %g\n", labels,
+        igmp_max_resp(&iface->params) / 10.0);
+    fprintf(out, "igmpqd_queries_sent_total{%s} %llu\n", labels,
+        (unsigned long long)STATS_GET(stats, queries_sent));
+    fprintf(out, "igmpqd_send_errors_total{%s} %llu\n", labels,
+        (unsigned long long)STATS_GET(stats, send_errors));
+    for (i = first; i < 3; i++) {
+        fprintf(out, "igmpqd_reports_total{%s,version=\"%d\"} %llu\n",
+            labels, i + 1 - first, (unsigned long long)STATS_GET(stats, reports[i]));
+    }
+    fprintf(out, "igmpqd_leaves_total{%s} %llu\n", labels,
+        (unsigned long long)STATS_GET(stats, leaves));
+    fprintf(out, "igmpqd_groups{%s} %llu\n", labels,
+        (unsigned long long)STATS_GET(stats, groups));
+    fprintf(out, "igmpqd_sources{%s} %llu\n", labels,
+        (unsigned long long)STATS_GET(stats, sources));
+    fprintf(out, "igmpqd_group_queries_sent_total{%s} %llu\n", labels,
+        (unsigned long long)STATS_GET(stats, group_queries));
+    fprintf(out, "igmpqd_paced_queries{%s} %llu\n", labels,
+        (unsigned long long)STATS_GET(stats, paced));
+    fprintf(out, "igmpqd_pace_drops_total{%s} %llu\n", labels,
+        (unsigned long long)STATS_GET(stats, pace_drops));
+
+    render_hist(out, "igmpqd_query_lateness_seconds", labels, &stats->lateness);
+    render_hist(out, "igmpqd_leave_latency_seconds", labels, &stats->leave_latency);
+    render_hist(out, "igmpqd_pace_delay_seconds", labels, &stats->pace_delay);
+}
+
+/* Counters of the interfaces of one shard, rendered by its own thread */
+int
+stats_render_part(engine_t *engine, char **buf, size_t *len)
+{
+    iface_t *iface;
+    FILE *out;
+
+    out = open_memstream(buf, len);
+    if (out == NULL) {
+        return -1;
+    }
+    for (iface = engine->ifaces; iface != NULL; iface = iface->next) {
+        render_iface(out, iface);
+    }
+
+    return fclose(out);
+}
+
+/* Head of the dump, with the memory figures collected from workers */
+static int
+render_header(engine_t *engine, stats_client_t *client, char **buf, size_t *len)
+{
+    FILE *out;
+
+    out = open_memstream(buf, len);
+    if (out == NULL) {
+        return -1;
+    }
+
+    fprintf(out, "# TYPE igmpqd_querier gauge\n"
+        "# TYPE igmpqd_max_response_seconds gauge\n"
+        "# TYPE igmpqd_queries_sent_total counter\n"
+        "# TYPE igmpqd_send_errors_total counter\n"
+        "# TYPE igmpqd_reports_total counter\n"
+        "# TYPE igmpqd_leaves_total counter\n"
+        "# TYPE igmpqd_groups gauge\n"
+        "# TYPE igmpqd_sources gauge\n"
+        "# TYPE igmpqd_group_queries_sent_total counter\n"
+        "# TYPE igmpqd_paced_queries gauge\n"
+        "# TYPE igmpqd_pace_drops_total counter\n"
+        "# TYPE igmpqd_query_lateness_seconds histogram\n"
+        "# TYPE igmpqd_leave_latency_seconds histogram\n"
+        "# TYPE igmpqd_pace_delay_seconds histogram\n"
+        "# TYPE igmpqd_log_suppressed_total counter\n"
+        "# TYPE igmpqd_memory_used_bytes gauge\n"
+        "# TYPE igmpqd_memory_limit_bytes gauge\n"
+        "# TYPE igmpqd_memory_refusals_total counter\n"
+        "# TYPE igmpqd_snapshot_failures_total counter\n"
+        "igmpqd_log_suppressed_total %llu\n"
+        "igmpqd_memory_used_bytes %zu\n"
+        "igmpqd_memory_limit_bytes %zu\n"
+        "igmpqd_memory_refusals_total %llu\n"
+        "igmpqd_snapshot_failures_total %llu\n",
+        (unsigned long long)logger_suppressed(), engine->groups.arena.used + client->mem_used,
+        engine->groups.arena.size + client->mem_limit,
+        (unsigned long long)(engine->groups.refused + client->refused),
+        (unsigned long long)engine->snapshot.failures);
+
+    return fclose(out);
+}
+
+/* Next piece of the dump once the previous one is out: a batch of our
+ * own interfaces, then the parts of the workers. Returns 1 with a piece
+ * in the buffer, 0 when the dump is complete. */
+static int
+render_next(stats_client_t *client)
+{
+    FILE *out;
+    int i;
+
+    free(client->buf);
+    client->buf = NULL;
+    client->len = 0;
+    client->off = 0;
+
+    if (client->next != NULL) {
+        out = open_memstream(&client->buf, &client->len);
+        if (out == NULL) {
+            return -1;
+        }
+        for (i = 0; i < STATS_BATCH && client->next != NULL; i++) {
+            render_iface(out, client->next);
+            client->next = client->next->next;
+        }
+        if (fclose(out) != 0) {
+            client->buf = NULL;
+            return -1;
+        }
+        return 1;
+    }
+
+    if (client->parts != NULL) {
+        client->buf = client->parts;
+        client->len = client->parts_len;
+        client->parts = NULL;
+        client->parts_len = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void
+client_close(stats_client_t *client)
+{
+    if (client->polled) {
+        event_del(&client->server->engine->loop, &client->ev);
+        client->polled = 0;
+    }
+    close(client->fd);
+    client->fd = -1;
+    free(client->buf);
+    client->buf = NULL;
+    free(client->parts);
+    client->parts = NULL;
+    client->parts_len = 0;
+    client->next = NULL;
+    client->pending = 0;
+    client->mem_used = 0;
+    client->mem_limit = 0;
+    client->refused = 0;
+}
+
+/* Returns 0 once the whole dump has been written, 1 if more is pending */
+static int
+client_write(stats_client_t *client)
+{
+    ssize_t n;
+
+    while (client->off < client->len) {
+        n = write(client->fd, client->buf + client->off, client->len - client->off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+            return -1;
+        }
+        client->off += n;
+    }
+
+    return 0;
+}
+
+/* Renders at most one batch per wakeup, so a dump of many interfaces
+ * never holds up the loop. The next piece goes out on the next wakeup,
+ * the socket being writable still. */
+static void
+client_cb(uint32_t events, void *arg)
+{
+    stats_client_t *client = arg;
+    int ret;
+
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        client_close(client);
+        return;
+    }
+
+    ret = client_write(client);
+    if (ret == 0) {
+        ret = render_next(client);
+        if (ret < 0) {
+            logger(LOG_LEVEL_ERR, "Could not render statistics");
+        }
+    }
+    if (ret <= 0) {
+        client_close(client);
+    }
+}
+
+static void
+client_finish(stats_client_t *client)
+{
+    stats_server_t *server = client->server;
+
+    if (render_header(server->engine, client, &client->buf, &client->len) < 0) {
+        logger(LOG_LEVEL_ERR, "Could not render statistics");
+        client->buf = NULL;
+        client_close(client);
+        return;
+    }
+    client->next = server->engine->ifaces;
+
+    if (event_add(&server->engine->loop, &client->ev, client->fd, EPOLLOUT,
+            client_cb, client) != 0) {
+        client_close(client);
+        return;
+    }
+    client->polled = 1;
+}
+
+static void
+accept_cb(uint32_t events, void *arg)
+{
+    stats_server_t *server = arg;
+    stats_client_t *client = NULL;
+    int fd, i;
+
+    fd = accept4(server->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            logger(LOG_LEVEL_ERR, "Could not accept stats client: %s", strerror(errno));
+        }
+        return;
+    }
+
+    for (i = 0; i < STATS_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd < 0) {
+            client = &server->clients[i];
+            break;
+        }
+    }
+    if (client == NULL) {
+        logger(LOG_LEVEL_INFO, "Too many stats clients, dropping connection");
+        close(fd);
+        return;
+    }
+
+    client->fd = fd;
+    client->server = server;
+    client->off = 0;
+
+    /* Workers render their own interfaces, the dump goes out once the
+     * last of them has answered */
+    client->pending = engine_request_stats(server->engine, client);
+    if (client->pending == 0) {
+        client_finish(client);
+    }
+}
+
+/* A worker's part of the dump for a waiting client */
+void
+stats_server_collect(void *arg, char *buf, size_t len, size_t mem_used, size_t mem_limit,
+    uint64_t refused)
+{
+    stats_client_t *client = arg;
+    char *parts;
+
+    if (buf != NULL) {
+        parts = realloc(client->parts, client->parts_len + len);
+        if (parts != NULL) {
+            memcpy(parts + client->parts_len, buf, len);
+            client->parts = parts;
+            client->parts_len += len;
+        }
+        free(buf);
+    }
+    client->mem_used += mem_used;
+    client->mem_limit += mem_limit;
+    client->refused += refused;
+
+    if (--client->pending == 0) {
+        client_finish(client);
+    }
+}
+
+/* Moves dumps in progress past an interface about to be removed */
+void
+stats_server_forget(stats_server_t *server, iface_t *iface)
+{
+    int i;
+
+    for (i = 0; i < STATS_MAX_CLIENTS; i++) {
+        if (server->clients[i].next == iface) {
+            server->clients[i].next = iface->next;
+        }
+    }
+}
+
+/* Listening socket handed over by a previous instance */
+void
+stats_server_adopt(stats_server_t *server, int fd)
+{
+    server_init(server);
+    server->fd = fd;
+}
+
+int
+stats_server_start(stats_server_t *server, engine_t *engine)
+{
+    server->engine = engine;
+    return event_add(&engine->loop, &server->ev, server->fd, EPOLLIN, accept_cb, server);
+}
+
+void
+stats_server_close(stats_server_t *server)
+{
+    int i;
+
+    if (server->fd < 0) {
+        return;
+    }
+
+    for (i = 0; i < STATS_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0) {
+            client_close(&server->clients[i]);
+        }
+    }
+    if (server->engine != NULL) {
+        event_del(&server->engine->loop, &server->ev);
+    }
+    close(server->fd);
+    server->fd = -1;
+}
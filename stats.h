@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+#include "event.h"
+
+#define STATS_CACHELINE        64
+#define STATS_HIST_BUCKETS     7
+#define STATS_MAX_CLIENTS      4
+#define STATS_BATCH            16  /* Interfaces rendered per write wakeup */
+
+/* Counters are only ever written by the thread owning the interface,
+ * using plain relaxed stores, and read with relaxed loads. Neither side
+ * takes a lock or issues a locked instruction. */
+#define STATS_ADD(s, field, n) \
+    __atomic_store_n(&(s)->field, (s)->field + (n), __ATOMIC_RELAXED)
+#define STATS_INC(s, field) STATS_ADD(s, field, 1)
+#define STATS_DEC(s, field) STATS_ADD(s, field, -1)
+#define STATS_GET(s, field) __atomic_load_n(&(s)->field, __ATOMIC_RELAXED)
+
+/* Latency histogram, in microseconds */
+typedef struct stats_hist {
+    uint64_t buckets[STATS_HIST_BUCKETS];
+    uint64_t sum;
+} stats_hist_t;
+
+/* Per-interface counters, kept on cache lines of their own */
+typedef struct stats {
+    uint64_t queries_sent;
+    uint64_t send_errors;
+    uint64_t reports[3];        /* By IGMP version */
+    uint64_t leaves;
+    uint64_t groups;            /* Live groups */
+    uint64_t sources;           /* Live IGMPv3 sources */
+    uint64_t group_queries;     /* Group-specific queries sent */
+    uint64_t paced;             /* Group-specific queries held by the pacer */
+    uint64_t pace_drops;        /* Dropped with the pacer queue full */
+    stats_hist_t lateness;      /* Query deadline to query */
+    stats_hist_t leave_latency; /* Leave to group-specific query */
+    stats_hist_t pace_delay;    /* Time spent in the pacer */
+} __attribute__((aligned(STATS_CACHELINE))) stats_t;
+
+/* Upper bounds of the histogram buckets, in microseconds */
+extern const uint64_t stats_hist_bounds[STATS_HIST_BUCKETS - 1];
+
+struct engine;
+struct iface;
+struct stats_server;
+
+typedef struct stats_client {
+    struct stats_server *server;
+    int                  fd;
+    event_t              ev;
+    char                *buf;
+    size_t               len;
+    size_t               off;
+    int                  polled;
+    struct iface        *next;      /* Next interface to render */
+    int                  pending;   /* Workers yet to send their part */
+    char                *parts;
+    size_t               parts_len;
+    size_t               mem_used;
+    size_t               mem_limit;
+    uint64_t             refused;
+} stats_client_t;
+
+/* Local stream socket handing out a text dump of all counters */
+typedef struct stats_server {
+    struct engine  *engine;
+    int             fd;
+    event_t         ev;
+    stats_client_t  clients[STATS_MAX_CLIENTS];
+} stats_server_t;
+
+void stats_observe(stats_hist_t *hist, uint64_t usec);
+
+int stats_server_open(stats_server_t *server, const char *path);
+
+void stats_server_adopt(stats_server_t *server, int fd);
+
+int stats_server_start(stats_server_t *server, struct engine *engine);
+
+void stats_server_close(stats_server_t *server);
+
+void stats_server_forget(stats_server_t *server, struct iface *iface);
+
+int stats_render_part(struct engine *engine, char **buf, size_t *len);
+
+void stats_server_collect(void *client, char *buf, size_t len, size_t mem_used,
+    size_t mem_limit, uint64_t refused);
+
+#endif /* __STATS_H__ */
@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# IGMPv1 and IGMPv2 reports to groups the querier host has not joined
+# must reach the default socket backend. A host in a second network
+# namespace joins groups through the kernel, which reports them, and
+# the querier's counters must show every group.
+#
+# Needs root for the network namespaces, and python3 to read the stats
+# socket. Skipped without either.
+
+BINARY=${1:-./igmpqd}
+NS=igmpqd-check-$$
+SOCK=/tmp/$NS.sock
+
+if [ "$(id -u)" != 0 ] || ! command -v python3 > /dev/null; then
+    echo "SKIP: needs root and python3"
+    exit 0
+fi
+
+cleanup() {
+    [ -n "$PID" ] && kill "$PID" 2> /dev/null
+    ip netns del "$NS-q" 2> /dev/null
+    ip netns del "$NS-h" 2> /dev/null
+    rm -f "$SOCK"
+}
+trap cleanup EXIT
+
+set -e
+ip netns add "$NS-q"
+ip netns add "$NS-h"
+ip link add vq netns "$NS-q" type veth peer name vh netns "$NS-h"
+ip -n "$NS-q" addr add 10.99.0.1/24 dev vq
+ip -n "$NS-h" addr add 10.99.0.2/24 dev vh
+ip -n "$NS-q" link set vq up
+ip -n "$NS-h" link set vh up
+
+ip netns exec "$NS-q" "$BINARY" -f -i vq -Q 2 -S "$SOCK" &
+PID=$!
+sleep 1
+
+ip netns exec "$NS-h" sysctl -qw net.ipv4.conf.vh.force_igmp_version=1
+ip -n "$NS-h" addr add 239.1.2.1/32 dev vh autojoin
+# Reports go out shortly after the join, in the version of the moment
+sleep 1
+ip netns exec "$NS-h" sysctl -qw net.ipv4.conf.vh.force_igmp_version=2
+ip -n "$NS-h" addr add 239.1.2.2/32 dev vh autojoin
+ip -n "$NS-h" addr add 239.1.2.3/32 dev vh autojoin
+sleep 1
+
+STATS=$(python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+data = b""
+while True:
+    buf = s.recv(65536)
+    if not buf:
+        break
+    data += buf
+sys.stdout.write(data.decode())
+' "$SOCK")
+set +e
+
+status=0
+check() {
+    value=$(echo "$STATS" | grep "^$1{" | grep "$2" | awk '{ print $2 }')
+    if [ "${value:-0}" -lt "$3" ]; then
+        echo "FAIL: $1 $2 is ${value:-missing}, expected at least $3"
+        status=1
+    fi
+}
+check igmpqd_reports_total 'version="1"' 1
+check igmpqd_reports_total 'version="2"' 2
+check igmpqd_groups 'interface="vq"' 3
+
+[ $status = 0 ] && echo "PASS: reports to unjoined groups are seen"
+exit $status
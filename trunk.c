@@ -0,0 +1,196 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/if_ether.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "igmp.h"
+#include "logging.h"
+#include "trunk.h"
+
+/* Offsets into the header template */
+#define FRAME_TCI   14
+#define FRAME_IP    18
+#define FRAME_LEN   (FRAME_IP + 2)
+#define FRAME_CKSUM (FRAME_IP + 10)
+#define FRAME_DST   (FRAME_IP + 16)
+
+/* Hardware and primary address of the parent, the latter optional */
+static int
+parent_addrs(trunk_t *trunk)
+{
+    struct ifreq ifr;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        logger(LOG_LEVEL_ERR, "Could not open socket: %s", strerror(errno));
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", trunk->name);
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0 || ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+        logger(LOG_LEVEL_ERR, "Trunk interface '%s' is not an Ethernet device", trunk->name);
+        close(fd);
+        return -1;
+    }
+    memcpy(trunk->mac, ifr.ifr_hwaddr.sa_data, sizeof(trunk->mac));
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", trunk->name);
+    ifr.ifr_addr.sa_family = AF_INET;
+    if (ioctl(fd, SIOCGIFADDR, &ifr) < 0) {
+        logger(LOG_LEVEL_INFO, "No IPv4 address on trunk interface '%s', "
+            "querier election disabled", trunk->name);
+        trunk->addr.s_addr = INADDR_ANY;
+    } else {
+        trunk->addr = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr;
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+int
+trunk_open(trunk_t *trunk, const char *name)
+{
+    memset(trunk, 0, sizeof(*trunk));
+    trunk->io.fd = -1;
+
+    snprintf(trunk->name, sizeof(trunk->name), "%s", name);
+    trunk->index = if_nametoindex(name);
+    if (trunk->index == 0) {
+        logger(LOG_LEVEL_ERR, "Unknown interface '%s': %s", name, strerror(errno));
+        return -1;
+    }
+
+    if (parent_addrs(trunk) != 0) {
+        return -1;
+    }
+    filter_build_trunk(&trunk->filter, trunk->addr);
+
+    /* Whole frames both ways, the tag is only visible to taps on all
+     * protocols, protocol handlers see it stripped and gone */
+    if (pktio_ring_open(&trunk->io, name, trunk->index, SOCK_RAW, ETH_P_ALL,
+            &trunk->filter) != 0) {
+        return -1;
+    }
+    if (pktio_ring_allmulti(&trunk->io, name, trunk->index) != 0) {
+        trunk_close(trunk);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Sets up a querier instance for one VLAN, sending and receiving
+ * through the trunk socket */
+int
+trunk_add_vlan(trunk_t *trunk, iface_t *iface, unsigned vlan)
+{
+    /* IP Router Alert option (RFC 2113), as on the raw sockets */
+    static const uint8_t ip[24] = {
+        0x46, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x01, IPPROTO_IGMP, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x94, 0x04, 0x00, 0x00,
+    };
+    uint8_t *frame = iface->frame;
+    uint16_t word;
+
+    memset(iface, 0, sizeof(*iface));
+    iface->sockfd = -1;
+    iface->rx.fd = -1;
+    iface->tx_head = -1;
+    iface->vif = -1;
+
+    if (snprintf(iface->name, sizeof(iface->name), "%s.%u", trunk->name, vlan) >=
+        (int)sizeof(iface->name)) {
+        logger(LOG_LEVEL_ERR, "Trunk interface name '%s' too long for VLAN names", trunk->name);
+        return -1;
+    }
+    iface->index = TRUNK_INDEX(trunk->index, vlan);
+    iface->addr = trunk->addr;
+    iface->filter = trunk->filter;
+    iface->trunk = trunk;
+    iface->vlan = vlan;
+
+    /* Multicast destination MAC follows per packet */
+    memcpy(frame + 6, trunk->mac, sizeof(trunk->mac));
+    word = htons(ETH_P_8021Q);
+    memcpy(frame + 12, &word, sizeof(word));
+    word = htons(vlan);
+    memcpy(frame + FRAME_TCI, &word, sizeof(word));
+    word = htons(ETH_P_IP);
+    memcpy(frame + FRAME_TCI + 2, &word, sizeof(word));
+
+    /* Length and destination are patched per packet, from zero */
+    memcpy(frame + FRAME_IP, ip, sizeof(ip));
+    memcpy(frame + FRAME_IP + 12, &trunk->addr, sizeof(trunk->addr));
+    word = cksum(frame + FRAME_IP, sizeof(ip));
+    memcpy(frame + FRAME_CKSUM, &word, sizeof(word));
+
+    trunk->vlans[vlan] = iface;
+
+    return 0;
+}
+
+/* Link and IP headers in front of an IGMP message of the given length */
+void
+trunk_frame_build(const iface_t *iface, uint8_t *buf, size_t len, struct in_addr dst)
+{
+    uint32_t group = ntohl(dst.s_addr);
+    uint16_t ck, total;
+
+    memcpy(buf, iface->frame, IFACE_FRAMELEN);
+
+    /* 01:00:5e and the low 23 bits of the group (RFC 1112, section 6.4) */
+    buf[0] = 0x01;
+    buf[1] = 0x00;
+    buf[2] = 0x5E;
+    buf[3] = (group >> 16) & 0x7F;
+    buf[4] = (group >> 8) & 0xFF;
+    buf[5] = group & 0xFF;
+
+    memcpy(&ck, buf + FRAME_CKSUM, sizeof(ck));
+    total = htons(IFACE_FRAMELEN - FRAME_IP + len);
+    memcpy(buf + FRAME_LEN, &total, sizeof(total));
+    ck = cksum_update(ck, iface->frame + FRAME_LEN, buf + FRAME_LEN, sizeof(total));
+    memcpy(buf + FRAME_DST, &dst, sizeof(dst));
+    ck = cksum_update(ck, iface->frame + FRAME_DST, buf + FRAME_DST, sizeof(dst));
+    memcpy(buf + FRAME_CKSUM, &ck, sizeof(ck));
+}
+
+void
+trunk_close(trunk_t *trunk)
+{
+    pktio_ring_ops.close(&trunk->io);
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TRUNK_H__
+#define __TRUNK_H__
+
+#include <stdint.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include "event.h"
+#include "filter.h"
+#include "iface.h"
+#include "pktio.h"
+
+#define TRUNK_VLANS 4096
+
+/* Membership key of a VLAN, clear of real interface indexes */
+#define TRUNK_INDEX(parent, vlan) (((uint32_t)(vlan) << 20) | (parent))
+
+struct engine;
+
+/* One packet socket on a parent device serving many VLANs. Frames are
+ * built and tagged here instead of going through a VLAN device each. */
+typedef struct trunk {
+    struct trunk  *next;
+    struct engine *engine;
+    char           name[IF_NAMESIZE];
+    unsigned       index;
+    uint8_t        mac[6];
+    struct in_addr addr;        /* Query source of every VLAN */
+    filter_t       filter;
+    pktio_t        io;
+    event_t        ev;
+    iface_t       *vlans[TRUNK_VLANS];
+} trunk_t;
+
+int trunk_open(trunk_t *trunk, const char *name);
+
+int trunk_add_vlan(trunk_t *trunk, iface_t *iface, unsigned vlan);
+
+void trunk_frame_build(const iface_t *iface, uint8_t *buf, size_t len, struct in_addr dst);
+
+void trunk_close(trunk_t *trunk);
+
+#endif /* __TRUNK_H__ */
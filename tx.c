@@ -0,0 +1,199 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "engine.h"
+#include "iface.h"
+#include "logging.h"
+#include "trunk.h"
+#include "tx.h"
+
+/* Keep packet buffers aligned for the checksum routines */
+#define TX_ALIGN(len) (((len) + 7) & ~(size_t)7)
+
+void
+tx_init(tx_batch_t *tx)
+{
+    tx->dirty = NULL;
+    tx->count = 0;
+    tx->used = 0;
+}
+
+static tx_entry_t *
+queue(tx_batch_t *tx, iface_t *iface, size_t len, uint64_t stamp)
+{
+    tx_entry_t *entry;
+    int idx;
+
+    if (tx->count == TX_BATCH || tx->used + TX_ALIGN(len) > TX_DATASIZE) {
+        tx_flush(tx);
+    }
+
+    idx = tx->count++;
+    entry = &tx->entries[idx];
+    entry->iface = iface;
+    entry->next = -1;
+    entry->iov.iov_base = tx->data + tx->used;
+    entry->iov.iov_len = len;
+    entry->stamp = stamp;
+    tx->used += TX_ALIGN(len);
+
+    if (iface->tx_head < 0) {
+        iface->tx_head = idx;
+        iface->tx_dirty = tx->dirty;
+        tx->dirty = iface;
+    } else {
+        tx->entries[iface->tx_tail].next = idx;
+    }
+    iface->tx_tail = idx;
+
+    return entry;
+}
+
+void *
+tx_packet(tx_batch_t *tx, iface_t *iface, size_t len, struct in_addr dst,
+    uint64_t stamp)
+{
+    tx_entry_t *entry;
+    size_t hdr;
+
+    /* Trunk VLANs send whole frames, headed from their template */
+    hdr = (iface->trunk != NULL ? IFACE_FRAMELEN : 0);
+    entry = queue(tx, iface, hdr + len, stamp);
+    entry->dst.v4.sin_family = AF_INET;
+    entry->dst.v4.sin_port = htons(0);
+    entry->dst.v4.sin_addr = dst;
+
+    if (hdr > 0) {
+        trunk_frame_build(iface, entry->iov.iov_base, len, dst);
+    }
+
+    return (uint8_t*)entry->iov.iov_base + hdr;
+}
+
+/* MLD packets come with their IPv6 header, the address only routes them */
+void *
+tx_packet6(tx_batch_t *tx, iface_t *iface, size_t len, const struct in6_addr *dst,
+    uint64_t stamp)
+{
+    tx_entry_t *entry;
+
+    entry = queue(tx, iface, len, stamp);
+    memset(&entry->dst.v6, 0, sizeof(entry->dst.v6));
+    entry->dst.v6.sin6_family = AF_INET6;
+    entry->dst.v6.sin6_addr = *dst;
+    entry->dst.v6.sin6_scope_id = iface->index;
+
+    return entry->iov.iov_base;
+}
+
+static void
+flush_iface(tx_batch_t *tx, iface_t *iface)
+{
+    struct mmsghdr msgs[TX_BATCH];
+    tx_entry_t *entries[TX_BATCH];
+    tx_entry_t *entry;
+    const pktio_ops_t *ops;
+    pktio_t *io;
+    uint64_t now = 0;
+    int i, j, n = 0, sent, fd;
+
+    /* The trunk socket is bound to its parent, frames need no address */
+    if (iface->trunk != NULL) {
+        io = &iface->trunk->io;
+        ops = &pktio_ring_ops;
+        fd = io->fd;
+    } else {
+        io = &iface->rx;
+        ops = io->ops;
+        fd = iface->sockfd;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = iface->tx_head; i >= 0; i = entry->next) {
+        entry = &tx->entries[i];
+        if (iface->trunk == NULL) {
+            msgs[n].msg_hdr.msg_name = &entry->dst;
+            msgs[n].msg_hdr.msg_namelen = (iface->params.family == AF_INET6 ?
+                sizeof(entry->dst.v6) : sizeof(entry->dst.v4));
+        }
+        msgs[n].msg_hdr.msg_iov = &entry->iov;
+        msgs[n].msg_hdr.msg_iovlen = 1;
+        entries[n++] = entry;
+    }
+
+    /* A failing message stops the batch, report it and carry on after it */
+    for (i = 0; i < n; i += sent) {
+        sent = ops->send(io, fd, msgs + i, n - i);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                sent = 0;
+                continue;
+            }
+            logger(LOG_LEVEL_ERR, "Could not send query on interface '%s': %s",
+                iface->name, strerror(errno));
+            /* Socket buffer full, the rest would fail alike */
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                STATS_ADD(&iface->stats, send_errors, n - i);
+                break;
+            }
+            STATS_INC(&iface->stats, send_errors);
+            sent = 1;
+        } else {
+            STATS_ADD(&iface->stats, queries_sent, sent);
+            /* Time from the triggering leave until the query left */
+            for (j = i; j < i + sent; j++) {
+                if (entries[j]->stamp != 0) {
+                    if (now == 0) {
+                        now = engine_now_us();
+                    }
+                    stats_observe(&iface->stats.leave_latency, now - entries[j]->stamp);
+                }
+            }
+        }
+    }
+
+    iface->tx_head = -1;
+}
+
+void
+tx_flush(tx_batch_t *tx)
+{
+    iface_t *iface;
+
+    while (tx->dirty != NULL) {
+        iface = tx->dirty;
+        tx->dirty = iface->tx_dirty;
+        iface->tx_dirty = NULL;
+        flush_iface(tx, iface);
+    }
+
+    tx->count = 0;
+    tx->used = 0;
+}
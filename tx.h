@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TX_H__
+#define __TX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+
+#define TX_BATCH    256
+#define TX_DATASIZE 65536
+
+struct iface;
+
+typedef struct tx_entry {
+    struct iface       *iface;
+    int                 next;   /* Next entry for the same interface, -1 ends */
+    struct iovec        iov;
+    union {
+        struct sockaddr_in  v4;
+        struct sockaddr_in6 v6;
+    } dst;
+    uint64_t            stamp;  /* Triggering event in microseconds, or 0 */
+} tx_entry_t;
+
+/* Packets due in the same tick, sent with one sendmmsg() per socket */
+typedef struct tx_batch {
+    struct iface *dirty;        /* Interfaces with queued packets */
+    unsigned      count;
+    size_t        used;
+    tx_entry_t    entries[TX_BATCH];
+    uint8_t       data[TX_DATASIZE];
+} tx_batch_t;
+
+void tx_init(tx_batch_t *tx);
+
+void *tx_packet(tx_batch_t *tx, struct iface *iface, size_t len, struct in_addr dst,
+    uint64_t stamp);
+
+void *tx_packet6(tx_batch_t *tx, struct iface *iface, size_t len, const struct in6_addr *dst,
+    uint64_t stamp);
+
+void tx_flush(tx_batch_t *tx);
+
+#endif /* __TX_H__ */
@@ -0,0 +1,224 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "wheel.h"
+
+#define LEVEL_SHIFT(level) ((level) * WHEEL_BITS)
+#define WHEEL_SPAN         ((1ULL << LEVEL_SHIFT(WHEEL_LEVELS)) - 1)
+
+void
+wheel_init(timer_wheel_t *wheel, uint64_t now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+void
+wheel_timer_init(wheel_timer_t *timer, wheel_cb_t cb, void *arg)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->cb = cb;
+    timer->arg = arg;
+}
+
+static inline void
+link_timer(wheel_timer_t **head, wheel_timer_t *timer)
+{
+    timer->next = *head;
+    if (timer->next != NULL) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+static inline void
+unlink_timer(wheel_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/* The earliest tick a timer can still fire at is the current one while
+ * cascading into it, otherwise the next one */
+static void
+place(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t earliest)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    int level;
+
+    if (expires < earliest) {
+        expires = earliest;
+    }
+
+    delta = expires - wheel->now;
+    if (delta > WHEEL_SPAN) {
+        delta = WHEEL_SPAN;
+        expires = wheel->now + delta;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ULL << LEVEL_SHIFT(level + 1))) {
+            break;
+        }
+    }
+
+    link_timer(&wheel->slots[level][(expires >> LEVEL_SHIFT(level)) & WHEEL_MASK], timer);
+}
+
+void
+wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t expires)
+{
+    if (wheel_pending(timer)) {
+        unlink_timer(timer);
+    } else {
+        wheel->count++;
+    }
+
+    timer->expires = expires;
+    place(wheel, timer, wheel->now + 1);
+}
+
+void
+wheel_cancel(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+    if (wheel_pending(timer)) {
+        unlink_timer(timer);
+        wheel->count--;
+    }
+}
+
+static void
+cascade(timer_wheel_t *wheel, int level, int slot)
+{
+    wheel_timer_t *timer, *next;
+
+    timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+
+    for (; timer != NULL; timer = next) {
+        next = timer->next;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        place(wheel, timer, wheel->now);
+    }
+}
+
+static void
+run_slot(timer_wheel_t *wheel, wheel_timer_t **slot)
+{
+    wheel_timer_t *pending = NULL;
+    wheel_timer_t *timer;
+
+    /* Detach the slot first, callbacks are free to add and cancel timers */
+    if (*slot == NULL) {
+        return;
+    }
+    pending = *slot;
+    pending->pprev = &pending;
+    *slot = NULL;
+
+    while (pending != NULL) {
+        timer = pending;
+        unlink_timer(timer);
+        wheel->count--;
+        timer->cb(timer, timer->arg);
+    }
+}
+
+void
+wheel_advance(timer_wheel_t *wheel, uint64_t now)
+{
+    uint64_t next;
+    int level, slot;
+
+    while (wheel->now < now) {
+        /* Skip idle stretches without walking every tick */
+        if (now - wheel->now > WHEEL_SIZE) {
+            next = wheel_next(wheel);
+            if (next > wheel->now + 1) {
+                wheel->now = (next - 1 < now ? next - 1 : now);
+                continue;
+            }
+        }
+
+        wheel->now++;
+        slot = wheel->now & WHEEL_MASK;
+        if (slot == 0) {
+            for (level = 1; level < WHEEL_LEVELS; level++) {
+                slot = (wheel->now >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+                cascade(wheel, level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+
+        run_slot(wheel, &wheel->slots[0][wheel->now & WHEEL_MASK]);
+    }
+}
+
+uint64_t
+wheel_next(const timer_wheel_t *wheel)
+{
+    uint64_t next = UINT64_MAX;
+    uint64_t base;
+    int level, k;
+
+    if (wheel->count == 0) {
+        return UINT64_MAX;
+    }
+
+    for (k = 1; k < WHEEL_SIZE; k++) {
+        if (wheel->slots[0][(wheel->now + k) & WHEEL_MASK] != NULL) {
+            next = wheel->now + k;
+            break;
+        }
+    }
+
+    /* Timers on higher levels expire no earlier than their slot is cascaded */
+    for (level = 1; level < WHEEL_LEVELS; level++) {
+        base = wheel->now >> LEVEL_SHIFT(level);
+        for (k = 1; k <= WHEEL_SIZE; k++) {
+            if (wheel->slots[level][(base + k) & WHEEL_MASK] != NULL) {
+                if (((base + k) << LEVEL_SHIFT(level)) < next) {
+                    next = (base + k) << LEVEL_SHIFT(level);
+                }
+                break;
+            }
+        }
+    }
+
+    return next;
+}
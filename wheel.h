@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) 2013, Henrik Brix Andersen <henrik@brixandersen.dk>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __WHEEL_H__
+#define __WHEEL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Four levels of 256 slots with one millisecond ticks cover 49 days,
+ * timers further out are parked on the top level and cascaded again */
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS   8
+#define WHEEL_SIZE   (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+
+typedef struct wheel_timer wheel_timer_t;
+
+typedef void (*wheel_cb_t)(wheel_timer_t *timer, void *arg);
+
+struct wheel_timer {
+    wheel_timer_t  *next;
+    wheel_timer_t **pprev;   /* NULL when not pending */
+    uint64_t        expires; /* Monotonic time in milliseconds */
+    wheel_cb_t      cb;
+    void           *arg;
+};
+
+typedef struct timer_wheel {
+    uint64_t       now;
+    size_t         count;
+    wheel_timer_t *slots[WHEEL_LEVELS][WHEEL_SIZE];
+} timer_wheel_t;
+
+void wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+void wheel_timer_init(wheel_timer_t *timer, wheel_cb_t cb, void *arg);
+
+void wheel_add(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t expires);
+
+void wheel_cancel(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+void wheel_advance(timer_wheel_t *wheel, uint64_t now);
+
+uint64_t wheel_next(const timer_wheel_t *wheel);
+
+static inline int
+wheel_pending(const wheel_timer_t *timer)
+{
+    return timer->pprev != NULL;
+}
+
+#endif /* __WHEEL_H__ */